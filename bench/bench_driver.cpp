@@ -0,0 +1,159 @@
+// 编译吞吐量基准测试驱动
+// 用法: bench_driver 编译器 生成器 [-sizes N,N,...] [-repeat N] [-baseline 文件]
+//                   [-update-baseline] [-threshold R] [-max-exponent E]
+// 对每个规模用生成器产生 SysY 程序, 分别以 -koopa 和 -riscv 模式运行编译器,
+// 取多次运行中的最短时间, 输出每秒处理的行数, 并用 log(时间) 对 log(行数)
+// 做最小二乘拟合得到规模指数 (线性为 1)
+// 最大规模下的吞吐量比基线低出 threshold 以上, 或规模指数超过 max-exponent 时返回 1
+// 基线文件不存在时用本次结果创建
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+using namespace std;
+
+static string compiler, generator;
+static int repeat = 3;
+
+static double run(const string &cmd)
+{
+  auto start = chrono::steady_clock::now();
+  if (system(cmd.c_str()) != 0)
+  {
+    fprintf(stderr, "bench: command failed: %s\n", cmd.c_str());
+    exit(2);
+  }
+  chrono::duration<double> wall = chrono::steady_clock::now() - start;
+  return wall.count();
+}
+
+static long count_lines(const string &path)
+{
+  ifstream in(path);
+  string line;
+  long lines = 0;
+  while (getline(in, line)) lines++;
+  return lines;
+}
+
+// 最小二乘拟合 y = k x + b 的斜率
+static double slope(const vector<double> &x, const vector<double> &y)
+{
+  double n = x.size(), sx = 0, sy = 0, sxx = 0, sxy = 0;
+  for (size_t i = 0; i < x.size(); i++)
+  {
+    sx += x[i];
+    sy += y[i];
+    sxx += x[i] * x[i];
+    sxy += x[i] * y[i];
+  }
+  return (n * sxy - sx * sy) / (n * sxx - sx * sx);
+}
+
+int main(int argc, char *argv[])
+{
+  if (argc < 3)
+  {
+    fprintf(stderr, "usage: %s compiler generator [-sizes N,N,...] [-repeat N] "
+      "[-baseline file] [-update-baseline] [-threshold R] [-max-exponent E]\n", argv[0]);
+    return 2;
+  }
+  compiler = argv[1];
+  generator = argv[2];
+  vector<int> sizes = {200, 400, 800, 1600};
+  string baseline;
+  bool update = false;
+  double threshold = 0.2, max_exponent = 1.2;
+  for (int i = 3; i < argc; i++)
+  {
+    if (!strcmp(argv[i], "-sizes") && i + 1 < argc)
+    {
+      sizes.clear();
+      stringstream list(argv[++i]);
+      string size;
+      while (getline(list, size, ',')) sizes.push_back(atoi(size.c_str()));
+    }
+    else if (!strcmp(argv[i], "-repeat") && i + 1 < argc) repeat = atoi(argv[++i]);
+    else if (!strcmp(argv[i], "-baseline") && i + 1 < argc) baseline = argv[++i];
+    else if (!strcmp(argv[i], "-update-baseline")) update = true;
+    else if (!strcmp(argv[i], "-threshold") && i + 1 < argc) threshold = atof(argv[++i]);
+    else if (!strcmp(argv[i], "-max-exponent") && i + 1 < argc)
+      max_exponent = atof(argv[++i]);
+    else
+    {
+      fprintf(stderr, "bench: unknown option %s\n", argv[i]);
+      return 2;
+    }
+  }
+  if (sizes.size() < 2)
+  {
+    fprintf(stderr, "bench: need at least two sizes\n");
+    return 2;
+  }
+
+  const char *modes[] = {"koopa", "riscv"};
+  map<string, double> throughput;
+  bool failed = false;
+  printf("%-6s %8s %10s %12s %14s\n", "mode", "funcs", "lines", "time (s)", "lines/s");
+  for (auto mode : modes)
+  {
+    vector<double> log_lines, log_time;
+    for (int size : sizes)
+    {
+      string input = "bench_" + to_string(size) + ".c";
+      string output = "bench_" + to_string(size) + "." + mode;
+      run(generator + " " + to_string(size) + " > " + input);
+      long lines = count_lines(input);
+      double best = 1e30;
+      for (int i = 0; i < repeat; i++)
+        best = min(best, run(compiler + " -" + mode + " " + input + " -o " + output +
+          " > /dev/null"));
+      printf("%-6s %8d %10ld %12.4f %14.0f\n", mode, size, lines, best, lines / best);
+      fflush(stdout);
+      log_lines.push_back(log((double)lines));
+      log_time.push_back(log(best));
+      throughput[mode] = lines / best;
+    }
+    double exponent = slope(log_lines, log_time);
+    printf("%-6s scaling exponent %.3f\n", mode, exponent);
+    if (exponent > max_exponent)
+    {
+      printf("FAIL: %s scaling exponent %.3f exceeds %.3f\n", mode, exponent,
+        max_exponent);
+      failed = true;
+    }
+  }
+
+  if (baseline.empty()) return failed;
+  ifstream in(baseline);
+  if (!in || update)
+  {
+    in.close();
+    ofstream out(baseline);
+    for (auto &entry : throughput) out << entry.first << " " << entry.second << "\n";
+    printf("baseline written to %s\n", baseline.c_str());
+    return failed;
+  }
+  string mode;
+  double expected;
+  while (in >> mode >> expected)
+  {
+    if (!throughput.count(mode)) continue;
+    double ratio = throughput[mode] / expected;
+    printf("%-6s %.0f lines/s vs baseline %.0f (%+.1f%%)\n", mode.c_str(), throughput[mode],
+      expected, (ratio - 1) * 100);
+    if (ratio < 1 - threshold)
+    {
+      printf("FAIL: %s throughput regressed by more than %.0f%%\n", mode.c_str(),
+        threshold * 100);
+      failed = true;
+    }
+  }
+  return failed;
+}
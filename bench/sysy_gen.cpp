@@ -0,0 +1,169 @@
+// 确定性的 SysY 大程序生成器, 供编译吞吐量基准测试使用
+// 用法: sysy_gen 函数个数 [-seed N] [-depth N] [-chain N] [-arrays]
+// 生成的程序包含大量全局变量/常量, 多层嵌套的 if/while, 长表达式链,
+// 以及函数间调用; 加 -arrays 时额外生成带初始化列表的大数组
+// 相同的参数总是生成相同的程序, 输出写到标准输出
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+using namespace std;
+
+static mt19937 rng;
+static int funcs = 1000;
+static int depth = 4;          // if/while 的嵌套层数
+static int chain = 48;         // 表达式链中的运算个数
+static bool arrays = false;
+static int globals, consts, array_len = 256;
+static int loops;              // 当前函数中循环变量的编号
+
+static int pick(int n) { return (int)(rng() % (unsigned)n); }
+
+// 由局部变量, 参数, 全局变量和常量组成的一个操作数
+static string operand()
+{
+  switch (pick(6))
+  {
+    case 0: return "a";
+    case 1: return "b";
+    case 2: return "x" + to_string(pick(4));
+    case 3: return "g" + to_string(pick(globals));
+    case 4: return "c" + to_string(pick(consts));
+    default: return to_string(pick(1000));
+  }
+}
+
+// 长度为 n 的左结合表达式链, 只用不会在常量求值时出错的运算
+static string expr(int n)
+{
+  static const char *ops[] = {" + ", " - ", " * ", " + ", " - "};
+  string e = operand();
+  for (int i = 0; i < n; i++)
+  {
+    e += ops[pick(5)];
+    e += operand();
+  }
+  return e;
+}
+
+static string cond()
+{
+  static const char *rel[] = {" < ", " > ", " <= ", " >= ", " == ", " != "};
+  string c = operand() + rel[pick(6)] + operand();
+  if (pick(3) == 0) c += (pick(2) ? " && " : " || ") + operand() + " < " +
+    to_string(pick(100));
+  return c;
+}
+
+static void indent(int level)
+{
+  for (int i = 0; i < level; i++) fputs("  ", stdout);
+}
+
+static void statements(int func, int level, int nest)
+{
+  indent(level);
+  printf("x%d = %s;\n", pick(4), expr(chain / 4 + pick(chain / 2 + 1)).c_str());
+  if (nest == 0)
+  {
+    indent(level);
+    printf("g%d = x%d - %s;\n", pick(globals), pick(4), operand().c_str());
+    return;
+  }
+  if (pick(2) == 0)
+  {
+    // 循环次数有界, 生成的程序可以实际运行
+    int i = loops++;
+    indent(level);
+    printf("{\n");
+    indent(level + 1);
+    printf("int i%d = 0;\n", i);
+    indent(level + 1);
+    printf("while (i%d < %d) {\n", i, 2 + pick(3));
+    statements(func, level + 2, nest - 1);
+    indent(level + 2);
+    printf("if (x%d > %d) break;\n", pick(4), 10000 + pick(1000));
+    indent(level + 2);
+    printf("i%d = i%d + 1;\n", i, i);
+    indent(level + 1);
+    printf("}\n");
+    indent(level);
+    printf("}\n");
+  }
+  else
+  {
+    indent(level);
+    printf("if (%s) {\n", cond().c_str());
+    statements(func, level + 1, nest - 1);
+    indent(level);
+    printf("} else {\n");
+    statements(func, level + 1, nest - 1);
+    indent(level);
+    printf("}\n");
+  }
+}
+
+static void function(int func)
+{
+  loops = 0;
+  printf("int f%d(int a, int b) {\n", func);
+  printf("  int x0 = a;\n  int x1 = b;\n  int x2 = 0;\n  int x3 = 0;\n");
+  printf("  x2 = %s;\n", expr(chain / 4).c_str());
+  if (arrays)
+  {
+    printf("  int t[%d] = {", array_len / 4);
+    for (int i = 0; i < 8; i++) printf("%s%d", i ? ", " : "", pick(100));
+    printf("};\n  x3 = t[%d] + arr%d[%d];\n", pick(8), pick(globals / 8 + 1),
+      pick(array_len));
+  }
+  // 每个函数只在最外层调用一次前一个函数, 所有函数都从 main 可达,
+  // 不会被不可达函数的删除去掉; 运行时间随函数个数线性增长
+  if (func > 0)
+    printf("  x3 = x3 + f%d(x%d, %d);\n", func - 1, pick(4), pick(100));
+  statements(func, 1, depth);
+  printf("  return x0 + x1 - x2 + x3;\n}\n\n");
+}
+
+int main(int argc, char *argv[])
+{
+  unsigned seed = 20240601;
+  for (int i = 1; i < argc; i++)
+  {
+    if (!strcmp(argv[i], "-seed") && i + 1 < argc) seed = atoi(argv[++i]);
+    else if (!strcmp(argv[i], "-depth") && i + 1 < argc) depth = atoi(argv[++i]);
+    else if (!strcmp(argv[i], "-chain") && i + 1 < argc) chain = atoi(argv[++i]);
+    else if (!strcmp(argv[i], "-arrays")) arrays = true;
+    else if (argv[i][0] != '-') funcs = atoi(argv[i]);
+    else
+    {
+      fprintf(stderr, "usage: %s funcs [-seed N] [-depth N] [-chain N] [-arrays]\n",
+        argv[0]);
+      return 1;
+    }
+  }
+  rng.seed(seed);
+  globals = funcs / 2 + 8;
+  consts = funcs / 4 + 8;
+
+  for (int i = 0; i < consts; i++)
+    printf("const int c%d = %d;\n", i, pick(1000));
+  for (int i = 0; i < globals; i++)
+    printf("int g%d;\n", i);
+  if (arrays)
+    for (int i = 0; i < globals / 8 + 1; i++)
+    {
+      printf("int arr%d[%d] = {", i, array_len);
+      for (int j = 0; j < array_len; j++)
+        printf("%s%d", j ? (j % 16 ? ", " : ",\n  ") : "", pick(1000));
+      printf("};\n");
+    }
+  printf("\n");
+  for (int i = 0; i < funcs; i++) function(i);
+
+  printf("int main() {\n  int s = 0;\n");
+  for (int i = funcs - 1; i >= 0; i -= funcs / 16 + 1)
+    printf("  s = s + f%d(%d, s);\n", i, pick(100));
+  printf("  return s;\n}\n");
+  return 0;
+}
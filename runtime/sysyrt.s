@@ -0,0 +1,292 @@
+# SysY 运行时库, 供编译器生成的 RV32 代码链接, 直接通过 Linux 系统调用读写,
+# 可以在 qemu-riscv32 (用户态) 下运行
+# 输入输出各有一个 4KB 缓冲区: 读空时一次读入一整块, 写满时一次写出,
+# 程序从 main 返回后 _start 写出剩余的输出, 以 main 的返回值退出
+#
+# 寄存器约定: 库函数除 ra 外只改写 a0, a1, t0, t1, t2, 其余寄存器都保持不变.
+# 编译器带 -fbuffered-io 时依赖这一点, 调用库函数前只保存这五个寄存器中的值
+
+        .equ    SYS_read, 63
+        .equ    SYS_write, 64
+        .equ    SYS_exit, 93
+        .equ    BUF_SIZE, 4096
+
+        .bss
+        .p2align 2
+out_buf:
+        .zero   BUF_SIZE
+in_buf:
+        .zero   BUF_SIZE
+out_len:
+        .zero   4
+in_pos:                         # in_len 紧跟在 in_pos 之后
+        .zero   4
+in_len:
+        .zero   4
+
+        .text
+        .globl  _start
+_start:
+        call    main
+        call    flush
+        li      a7, SYS_exit
+        ecall
+
+# 写出输出缓冲区, 不改变任何寄存器
+flush:
+        addi    sp, sp, -32
+        sw      a0, 0(sp)
+        sw      a1, 4(sp)
+        sw      a2, 8(sp)
+        sw      a7, 12(sp)
+        sw      t0, 16(sp)
+        la      t0, out_len
+        lw      a2, 0(t0)
+        la      a1, out_buf
+1:
+        beqz    a2, 2f
+        li      a0, 1
+        li      a7, SYS_write
+        ecall
+        blez    a0, 2f                  # 出错时丢弃剩余的输出
+        add     a1, a1, a0
+        sub     a2, a2, a0
+        j       1b
+2:
+        sw      zero, 0(t0)
+        lw      a0, 0(sp)
+        lw      a1, 4(sp)
+        lw      a2, 8(sp)
+        lw      a7, 12(sp)
+        lw      t0, 16(sp)
+        addi    sp, sp, 32
+        ret
+
+# 先写出已有的输出 (交互时提示先于等待输入出现), 再读入一块输入,
+# 文件结束时 in_len 为 0. 不改变任何寄存器
+refill:
+        addi    sp, sp, -32
+        sw      ra, 28(sp)
+        sw      a0, 0(sp)
+        sw      a1, 4(sp)
+        sw      a2, 8(sp)
+        sw      a7, 12(sp)
+        sw      t0, 16(sp)
+        call    flush
+        li      a0, 0
+        la      a1, in_buf
+        li      a2, BUF_SIZE
+        li      a7, SYS_read
+        ecall
+        bgez    a0, 1f
+        li      a0, 0
+1:
+        la      t0, in_pos
+        sw      zero, 0(t0)
+        sw      a0, 4(t0)
+        lw      a0, 0(sp)
+        lw      a1, 4(sp)
+        lw      a2, 8(sp)
+        lw      a7, 12(sp)
+        lw      t0, 16(sp)
+        lw      ra, 28(sp)
+        addi    sp, sp, 32
+        ret
+
+# 下一个字节, 输入结束时为 -1. 只改变 a0, t0, t1, t2
+        .globl  getch
+getch:
+        la      t0, in_pos
+        lw      t1, 0(t0)
+        lw      t2, 4(t0)
+        bne     t1, t2, 1f
+        addi    sp, sp, -16
+        sw      ra, 12(sp)
+        call    refill
+        lw      ra, 12(sp)
+        addi    sp, sp, 16
+        lw      t1, 0(t0)
+        lw      t2, 4(t0)
+        bne     t1, t2, 1f
+        li      a0, -1
+        ret
+1:
+        la      a0, in_buf
+        add     a0, a0, t1
+        lbu     a0, 0(a0)
+        addi    t1, t1, 1
+        sw      t1, 0(t0)
+        ret
+
+# 跳过数字和负号以外的字符, 读一个十进制整数. 数字后的第一个字符留给下次读取,
+# 与 scanf("%d") 相同. 没有整数时返回 0
+        .globl  getint
+getint:
+        addi    sp, sp, -16
+        sw      ra, 12(sp)
+        sw      zero, 8(sp)             # 是否为负
+1:
+        call    getch
+        bltz    a0, 4f
+        li      t0, '-'
+        bne     a0, t0, 2f
+        li      t0, 1
+        sw      t0, 8(sp)
+        call    getch
+        j       3f
+2:
+        addi    t0, a0, -'0'
+        li      t1, 10
+        bgeu    t0, t1, 1b
+3:
+        li      a1, 0                   # getch 不改变 a1, 用它累加
+5:
+        addi    t0, a0, -'0'
+        li      t1, 10
+        bgeu    t0, t1, 6f
+        slli    t1, a1, 3
+        slli    t2, a1, 1
+        add     a1, t1, t2
+        add     a1, a1, t0
+        call    getch
+        j       5b
+6:
+        bltz    a0, 7f
+        la      t0, in_pos              # 退回刚读到的非数字字符
+        lw      t1, 0(t0)
+        addi    t1, t1, -1
+        sw      t1, 0(t0)
+7:
+        mv      a0, a1
+        lw      t0, 8(sp)
+        beqz    t0, 8f
+        neg     a0, a0
+8:
+        lw      ra, 12(sp)
+        addi    sp, sp, 16
+        ret
+4:
+        li      a1, 0
+        j       7b
+
+# 读入个数 n 和 n 个整数存入 a0 指向的数组, 返回 n
+        .globl  getarray
+getarray:
+        addi    sp, sp, -16
+        sw      ra, 12(sp)
+        sw      a0, 8(sp)               # 下一个元素的地址
+        call    getint
+        sw      a0, 4(sp)
+        sw      a0, 0(sp)               # 还要读的个数
+1:
+        lw      t0, 0(sp)
+        blez    t0, 2f
+        addi    t0, t0, -1
+        sw      t0, 0(sp)
+        call    getint
+        lw      t1, 8(sp)
+        sw      a0, 0(t1)
+        addi    t1, t1, 4
+        sw      t1, 8(sp)
+        j       1b
+2:
+        lw      a0, 4(sp)
+        lw      ra, 12(sp)
+        addi    sp, sp, 16
+        ret
+
+# 只改变 t0, t1, t2
+        .globl  putch
+putch:
+        la      t0, out_len
+        lw      t1, 0(t0)
+        la      t2, out_buf
+        add     t2, t2, t1
+        sb      a0, 0(t2)
+        addi    t1, t1, 1
+        sw      t1, 0(t0)
+        li      t2, BUF_SIZE
+        beq     t1, t2, flush           # flush 直接返回到调用者
+        ret
+
+# 数字从栈上 12(sp) 往前逆序生成, 再复制进输出缓冲区
+        .globl  putint
+putint:
+        addi    sp, sp, -16
+        mv      t0, a0
+        bgez    a0, 1f
+        neg     t0, a0                  # -2^31 取反不变, 按无符号数除仍然正确
+1:
+        addi    t2, sp, 12
+        li      t1, 10
+2:
+        remu    a1, t0, t1
+        divu    t0, t0, t1
+        addi    a1, a1, '0'
+        addi    t2, t2, -1
+        sb      a1, 0(t2)
+        bnez    t0, 2b
+        bgez    a0, 3f
+        li      a1, '-'
+        addi    t2, t2, -1
+        sb      a1, 0(t2)
+3:
+        la      t0, out_len
+        lw      t1, 0(t0)
+4:
+        lbu     a1, 0(t2)
+        la      a0, out_buf
+        add     a0, a0, t1
+        sb      a1, 0(a0)
+        addi    t1, t1, 1
+        addi    t2, t2, 1
+        li      a0, BUF_SIZE
+        bne     t1, a0, 5f
+        sw      t1, 0(t0)
+        sw      ra, 12(sp)
+        call    flush
+        lw      ra, 12(sp)
+        li      t1, 0
+5:
+        addi    a0, sp, 12
+        bne     t2, a0, 4b
+        sw      t1, 0(t0)
+        addi    sp, sp, 16
+        ret
+
+# 输出 "n:", 每个元素前加一个空格, 最后换行
+        .globl  putarray
+putarray:
+        addi    sp, sp, -16
+        sw      ra, 12(sp)
+        sw      a1, 8(sp)               # 下一个元素的地址
+        sw      a0, 4(sp)               # 还要输出的个数
+        call    putint
+        li      a0, ':'
+        call    putch
+1:
+        lw      t0, 4(sp)
+        blez    t0, 2f
+        addi    t0, t0, -1
+        sw      t0, 4(sp)
+        li      a0, ' '
+        call    putch
+        lw      t1, 8(sp)
+        lw      a0, 0(t1)
+        addi    t1, t1, 4
+        sw      t1, 8(sp)
+        call    putint
+        j       1b
+2:
+        li      a0, '\n'
+        call    putch
+        lw      ra, 12(sp)
+        addi    sp, sp, 16
+        ret
+
+# 不计时
+        .globl  starttime
+        .globl  stoptime
+starttime:
+stoptime:
+        ret
@@ -2,15 +2,23 @@
 #include <iostream>
 #include <vector>
 #include <string>
+#include <string_view>
 #include <memory>
 #include <cassert>
+#include <cstdint>
+#include <algorithm>
+#include <deque>
 #include <map>
+#include <optional>
+#include <set>
+#include <unordered_map>
 #include <variant>
 #include <stdlib.h>
+#include "cache.hpp"
+#include "stats.hpp"
+#include "profile.hpp"
 
 enum class FuncFParamType { var, list };
-enum class UnaryExpType { primary, unary, func_call };
-enum class PrimaryExpType { exp, number, lval, list };
 enum class StmtType { if_, ifelse, simple, while_ };
 enum class SimpleStmtType { lval, exp, block, ret, break_, continue_, list,null };
 enum class DeclType { const_decl, var_decl };
@@ -38,32 +46,167 @@ enum class InitValType { exp, list };
 #define Or 15
 #define NotEqualZero 16
 
-static std::vector<std::map<std::string, int>> symbol_tables;
-static std::vector<std::map<std::string, int>> var_types;
-static std::map<std::string, std::string> function_table; 
-static std::map<std::string, std::string> function_ret_type;
-static std::map<std::string, int> function_param_num;  
-static std::vector<int> while_stack;
-static int level=0;
-static int nowww=0;
-static int if_else_num=0;
-static int while_num=0;
-static std::map<std::string, std::vector<std::string>> function_param_idents;
-static std::map<std::string, std::vector<std::string>> function_param_names;
-static std::map<std::string, std::vector<std::string>> function_param_types;
-static std::string present_func_type;
-
-static int func_num=0;
+inline std::vector<std::map<std::string, int>> symbol_tables;
+inline std::vector<std::map<std::string, int>> var_types;
+inline std::map<std::string, std::string> function_table; 
+inline std::map<std::string, std::string> function_ret_type;
+inline std::map<std::string, int> function_param_num;  
+inline std::vector<int> while_stack;
+inline int level=0;
+inline int nowww=0;
+inline int if_else_num=0;
+inline int while_num=0;
+inline std::map<std::string, std::vector<std::string>> function_param_idents;
+inline std::map<std::string, std::vector<std::string>> function_param_names;
+inline std::map<std::string, std::vector<std::string>> function_param_types;
+inline std::string present_func_type;
+// var_types 中 3 表示数组, 4 表示数组形参 (保存首元素指针的局部变量)
+// 数组的各维长度, 形参的第一维记为 0; 常量数组另外保存展开后的初值
+struct ArrayInfo
+{
+  std::vector<int> dims;
+  std::vector<int> values;
+};
+inline std::vector<std::map<std::string, ArrayInfo>> array_tables;
+inline std::map<std::string, std::vector<std::vector<int>>> function_param_dims;
+inline int zero_fill_num=0;
+
+inline int func_num=0;
 // 所有 AST 的基类
 class BaseAST {
  public:
+  BaseAST() { ++stat_ast_nodes; }
   virtual ~BaseAST() = default;
   virtual void Dump() const = 0;
   virtual int Calc() const { assert(false); return -1; }
   virtual void dump() const { assert(false); return ;}
   virtual std::string Type() const { assert(false); return ""; }
   virtual std::string get_ident() const { assert(false); return ""; }
+  // 子树的结构指纹, 用于增量编译缓存的键
+  virtual void Fingerprint(std::string &fp) const { assert(false); }
+};
+
+// 计算指纹时顺带收集子树引用到的标识符 (变量与函数)
+inline std::set<std::string> fingerprint_refs;
+
+inline void fingerprint_child(const std::unique_ptr<BaseAST> &child, std::string &fp)
+{
+  if (child) child->Fingerprint(fp);
+  else fp += '~';
+}
+
+inline void dump_func_def(const BaseAST *func_def);
+inline void fingerprint_expr(int root, std::string &fp);
+inline void fingerprint_funcs(const std::vector<std::unique_ptr<BaseAST>> &func_def_list);
+// 所有函数定义, 供编译期求值时查找被调函数
+inline std::map<std::string, const BaseAST *> func_defs;
+// 从 main 出发沿调用关系可达的函数, 以及它们引用到的标识符.
+// 不可达的函数和只被它们引用的全局变量不生成代码; 没有 main 时两者为空, 全部保留
+inline std::set<std::string> reachable_funcs;
+inline std::set<std::string> reachable_refs;
+inline void find_reachable_funcs();
+inline bool func_reachable(const std::string &ident)
+{
+  return reachable_funcs.empty() || reachable_funcs.count(ident);
+}
+inline bool global_live(const std::string &ident)
+{
+  return reachable_funcs.empty() || reachable_refs.count(ident);
+}
+
+// 过程间优化对函数签名的改写: 去掉没有用到的形参, 所有调用点都传同一个常量的形参
+// 在函数内直接当作常量, 没有调用点使用返回值时改为 void 函数;
+// 循环中以常量实参调用的函数另外生成特化的副本
+enum class ParamKind { pass, drop, constant };
+struct ParamPlan
+{
+  ParamKind kind = ParamKind::pass;
+  int value = 0;
+  bool assigned = false;    // 函数体中对该形参赋过值, 常量形参仍需要分配空间
+};
+struct FuncPlan
+{
+  std::string name;         // 输出的函数名, 特化的副本与原函数不同
+  std::vector<ParamPlan> params;
+  bool drop_ret = false;
+};
+// 调用点实际调用的函数, 以及需要传递的实参下标
+struct CallPlan
+{
+  std::string callee;
+  std::vector<int> args = {};
 };
+inline std::map<std::string, FuncPlan> func_plans;
+inline std::map<std::string, std::vector<FuncPlan>> func_clones;
+inline std::unordered_map<int, CallPlan> call_plans;
+// 正在输出的特化副本, 为空时按 func_plans 输出原函数
+inline const FuncPlan *dump_plan = nullptr;
+inline std::map<std::string, std::vector<ParamPlan>> function_param_plans;
+// 全局变量的初值, 以及在程序中任何地方被赋值过的名字.
+// 后端会把从未写过的全局变量的读取换成初值, 两者都要进缓存的键
+inline std::map<std::string, std::string> global_inits;
+inline std::set<std::string> assigned_anywhere;
+inline void plan_functions(const std::vector<std::unique_ptr<BaseAST>> &func_def_list,
+  const std::vector<std::unique_ptr<BaseAST>> &decl_list);
+inline void dump_func_clones(const BaseAST *func_def);
+inline std::string plan_descriptor(const std::string &ident);
+inline int calc_expr(int root);
+inline std::vector<int> flatten_init(const BaseAST *init, const std::vector<int> &dims);
+inline void dump_array_def(const std::string &ident, const std::vector<int> &dims,
+  const std::vector<int> &roots);
+
+// 输出运行时库函数的声明, 建立全局作用域
+inline void begin_comp_unit()
+{
+  std::cout << "decl @getint(): i32" << std::endl;
+  std::cout << "decl @getch(): i32" << std::endl;
+  std::cout << "decl @getarray(*i32): i32" << std::endl;
+  std::cout << "decl @putint(i32)" << std::endl;
+  std::cout << "decl @putch(i32)" << std::endl;
+  std::cout << "decl @putarray(i32, *i32)" << std::endl;
+  std::cout << "decl @starttime()" << std::endl;
+  std::cout << "decl @stoptime()" << std::endl << std::endl;
+  function_table["getint"] = "@getint";
+  function_table["getch"] = "@getch";
+  function_table["getarray"] = "@getarray";
+  function_table["putint"] = "@putint";
+  function_table["putch"] = "@putch";
+  function_table["putarray"] = "@putarray";
+  function_table["starttime"] = "@starttime";
+  function_table["stoptime"] = "@stoptime";
+  function_ret_type["getint"] = "int";
+  function_ret_type["getch"] = "int";
+  function_ret_type["getarray"] = "int";
+  function_ret_type["putint"] = "void";
+  function_ret_type["putch"] = "void";
+  function_ret_type["putarray"] = "void";
+  function_ret_type["starttime"] = "void";
+  function_ret_type["stoptime"] = "void";
+  function_param_num["getint"] = 0;
+  function_param_num["getch"] = 0;
+  function_param_num["getarray"] = 1;
+  function_param_num["putint"] = 1;
+  function_param_num["putch"] = 1;
+  function_param_num["putarray"] = 2;
+  function_param_num["starttime"] = 0;
+  function_param_num["stoptime"] = 0;
+  std::map<std::string, int> global_syms;
+  std::map<std::string, int> global_var_type;
+  symbol_tables.push_back(global_syms);
+  var_types.push_back(global_var_type);
+  array_tables.emplace_back();
+}
+
+inline void end_comp_unit()
+{
+  symbol_tables.pop_back();
+  var_types.pop_back();
+  array_tables.pop_back();
+}
+
+// 流式编译时 parser 每归约出一个顶层的函数定义或声明就交给这个函数处理,
+// 不再收集进 CompUnitAST
+inline void (*stream_item)(std::unique_ptr<BaseAST> item) = nullptr;
 
 // CompUnit 是 BaseAST
 class CompUnitAST : public BaseAST {
@@ -72,47 +215,20 @@ class CompUnitAST : public BaseAST {
   std::vector<std::unique_ptr<BaseAST>> func_def_list;
   std::vector<std::unique_ptr<BaseAST>> decl_list;
   void Dump() const override {
-    std::cout << "decl @getint(): i32" << std::endl;
-    std::cout << "decl @getch(): i32" << std::endl;
-    std::cout << "decl @getarray(*i32): i32" << std::endl;
-    std::cout << "decl @putint(i32)" << std::endl;
-    std::cout << "decl @putch(i32)" << std::endl;
-    std::cout << "decl @putarray(i32, *i32)" << std::endl;
-    std::cout << "decl @starttime()" << std::endl;
-    std::cout << "decl @stoptime()" << std::endl << std::endl;
-    function_table["getint"] = "@getint";
-    function_table["getch"] = "@getch";
-    function_table["getarray"] = "@getarray";
-    function_table["putint"] = "@putint";
-    function_table["putch"] = "@putch";
-    function_table["putarray"] = "@putarray";
-    function_table["starttime"] = "@starttime";
-    function_table["stoptime"] = "@stoptime";
-    function_ret_type["getint"] = "int";
-    function_ret_type["getch"] = "int";
-    function_ret_type["getarray"] = "int";
-    function_ret_type["putint"] = "void";
-    function_ret_type["putch"] = "void";
-    function_ret_type["putarray"] = "void";
-    function_ret_type["starttime"] = "void";
-    function_ret_type["stoptime"] = "void";
-    function_param_num["getint"] = 0;
-    function_param_num["getch"] = 0;
-    function_param_num["getarray"] = 1;
-    function_param_num["putint"] = 1;
-    function_param_num["putch"] = 1;
-    function_param_num["putarray"] = 2;
-    function_param_num["starttime"] = 0;
-    function_param_num["stoptime"] = 0;
-    std::map<std::string, int> global_syms;
-    std::map<std::string, int> global_var_type;
-    symbol_tables.push_back(global_syms);
-    var_types.push_back(global_var_type);
+    begin_comp_unit();
+    for (auto&& func_def : func_def_list) func_defs[func_def->get_ident()] = func_def.get();
+    find_reachable_funcs();
     for (auto&& decl : decl_list) decl->Dump();
       std::cout << std::endl;
-    for (auto&& func_def : func_def_list)func_def->Dump();
-    symbol_tables.pop_back();
-    var_types.pop_back();
+    plan_functions(func_def_list, decl_list);
+    if (!cache_dir.empty()) fingerprint_funcs(func_def_list);
+    for (auto&& func_def : func_def_list)
+    {
+      if (!func_reachable(func_def->get_ident())) continue;
+      dump_func_def(func_def.get());
+      dump_func_clones(func_def.get());
+    }
+    end_comp_unit();
   }
 };
 
@@ -121,6 +237,14 @@ class FuncFParamAST : public BaseAST{
     FuncFParamType type;
     std::string b_type;
     std::string ident;
+    std::vector<int> dims;    // 第一维之后各维长度的表达式
+    // 数组形参的各维长度, 第一维记为 0; 普通形参为空
+    std::vector<int> Dims() const{
+      if (type == FuncFParamType::var) return {};
+      std::vector<int> result{0};
+      for (int dim : dims) result.push_back(calc_expr(dim));
+      return result;
+    }
     void Dump() const override{
       assert(b_type == "int");
       std::string param_name="@"+ident;
@@ -131,7 +255,26 @@ class FuncFParamAST : public BaseAST{
       return ident;
     }
     std::string Type() const override{
-      return "i32";
+      if (type == FuncFParamType::var) return "i32";
+      std::vector<int> param_dims = Dims();
+      std::string elem = "i32";
+      for (int k = param_dims.size() - 1; k >= 1; k--)
+        elem = "[" + elem + ", " + std::to_string(param_dims[k]) + "]";
+      return "*" + elem;
+    }
+    void Fingerprint(std::string &fp) const override{
+      fp += "P" + b_type + " " + ident;
+      if (type == FuncFParamType::list)
+      {
+        fp += "[]";
+        for (int dim : dims)
+        {
+          fp += "[";
+          fingerprint_expr(dim, fp);
+          fp += "]";
+        }
+      }
+      fp += ";";
     }
 };
 
@@ -142,34 +285,202 @@ class FuncDefAST : public BaseAST {
   std::string ident;
   std::unique_ptr<BaseAST> block;
   std::vector<std::unique_ptr<BaseAST> > params;
+  // 当前输出所用的改写方案, 没有时按原样输出
+  const FuncPlan *Plan() const {
+    if (dump_plan) return dump_plan;
+    auto it = func_plans.find(ident);
+    return it == func_plans.end() ? nullptr : &it->second;
+  }
+  std::string Name() const {
+    return Plan() ? Plan()->name : ident;
+  }
+  std::string RetType() const {
+    return Plan() && Plan()->drop_ret ? "void" : func_type;
+  }
+  bool Passed(int i) const {
+    return !Plan() || Plan()->params[i].kind == ParamKind::pass;
+  }
+  // 只登记函数签名, 命中缓存时不必生成函数体
+  void Declare() const {
+    std::string name = Name();
+    function_table[name] = "@" + name;
+    function_ret_type[name] = RetType();
+    int num = 0;
+    for (size_t i = 0; i < params.size(); i++) num += Passed(i);
+    function_param_num[name] = num;
+  }
+  // 对应的 Koopa 声明, 供命中缓存的函数在 -riscv 模式下占位
+  std::string DeclLine() const {
+    std::string line = "decl @" + Name() + "(";
+    bool first = true;
+    for (size_t i = 0; i < params.size(); i++)
+    {
+      if (!Passed(i)) continue;
+      if (!first) line += ", ";
+      first = false;
+      line += params[i]->Type();
+    }
+    line += ")";
+    if(RetType()=="int") line += ": i32";
+    return line;
+  }
   void Dump() const override {
     func_num++;
-    std::string name = "@" + ident;
-    function_table[ident] = name;
-    function_ret_type[ident] = func_type;
-    function_param_num[ident] = params.size();
-    present_func_type = function_ret_type[ident];
+    // 编号在函数内唯一即可, 每个函数从头编号使输出与函数在文件中的位置无关
+    nowww = if_else_num = while_num = zero_fill_num = 0;
+    Declare();
+    present_func_type = RetType();
     std::vector<std::string> idents, names, types;
-    std::cout << "fun @"<<ident<<"(";
+    std::vector<std::vector<int>> dims;
+    std::cout << "fun @"<<Name()<<"(";
+    bool first = true;
     for (int i = 0; i < params.size(); i++)
     {
       idents.push_back(params[i]->get_ident());
-      params[i]->Dump();
       std::string param_name = "@" + idents.back()+"_"+std::to_string(func_num)+"_"+std::to_string(level+1);
       names.push_back(param_name);
       types.push_back(params[i]->Type());
+      dims.push_back(static_cast<const FuncFParamAST *>(params[i].get())->Dims());
+      if (!Passed(i)) continue;
+      if (!first) std::cout << ", ";
+      first = false;
+      params[i]->Dump();
       std::cout << ": " << params[i]->Type();
-      if (i != params.size() - 1)std::cout << ", ";
     }
     function_param_idents[ident] = move(idents);
     function_param_names[ident] = move(names);
     function_param_types[ident] = move(types);
+    function_param_dims[ident] = move(dims);
+    if (Plan()) function_param_plans[ident] = Plan()->params;
+    else function_param_plans[ident].assign(params.size(), ParamPlan());
     std::cout<<")";
-    if(func_type=="int") std::cout<<": i32 ";
+    if(RetType()=="int") std::cout<<": i32 ";
     block->Dump();
   }
+  std::string get_ident() const override {
+    return ident;
+  }
+  void Fingerprint(std::string &fp) const override {
+    fp += "F" + func_type + " " + ident + "(";
+    for (auto&& param : params) param->Fingerprint(fp);
+    fp += ")";
+    block->Fingerprint(fp);
+  }
 };
 
+// 每个函数体的指纹散列, 直接调用的函数和引用的其余名字 (全局变量和常量)
+inline std::map<std::string, std::string> func_body_hashes;
+inline std::map<std::string, std::set<std::string>> func_callees;
+inline std::map<std::string, std::set<std::string>> func_global_refs;
+
+inline void fingerprint_funcs(const std::vector<std::unique_ptr<BaseAST>> &func_def_list)
+{
+  for (auto&& func_def : func_def_list)
+  {
+    if (!func_reachable(func_def->get_ident())) continue;
+    fingerprint_refs.clear();
+    std::string fp;
+    func_def->Fingerprint(fp);
+    std::string ident = func_def->get_ident();
+    func_body_hashes[ident] = cache_hash(fp);
+    for (auto&& ref : fingerprint_refs)
+      if (func_defs.count(ref)) func_callees[ident].insert(ref);
+      else func_global_refs[ident].insert(ref);
+  }
+}
+
+// 全局变量或常量的类型, 值, 初值和是否被写, 它们变化时引用它的函数要重新生成
+inline void fingerprint_global(const std::string &ref, std::string &fp)
+{
+  if (var_types[0].count(ref))
+    fp += "\nglobal " + ref + ":" + std::to_string(var_types[0][ref]) + ":" +
+      std::to_string(symbol_tables[0][ref]) + ":" + global_inits[ref] +
+      (assigned_anywhere.count(ref) ? "w" : "");
+}
+
+inline void find_reachable_funcs()
+{
+  if (!func_defs.count("main")) return;
+  std::vector<std::string> work{"main"};
+  reachable_funcs.insert("main");
+  while (!work.empty())
+  {
+    const BaseAST *def = func_defs[work.back()];
+    work.pop_back();
+    fingerprint_refs.clear();
+    std::string fp;
+    def->Fingerprint(fp);
+    for (auto&& ref : fingerprint_refs)
+    {
+      reachable_refs.insert(ref);
+      if (func_defs.count(ref) && reachable_funcs.insert(ref).second) work.push_back(ref);
+    }
+  }
+  stat_dead_funcs += func_defs.size() - reachable_funcs.size();
+}
+
+// 输出一个函数定义, 启用缓存时先按键查找已有的结果
+inline void dump_func_def(const BaseAST *func_def)
+{
+  auto def = static_cast<const FuncDefAST *>(func_def);
+  if (cache_dir.empty())
+  {
+    def->Dump();
+    return;
+  }
+  fingerprint_refs.clear();
+  std::string fp = cache_flags + "\n";
+  def->Fingerprint(fp);
+  for (auto&& ref : fingerprint_refs)
+  {
+    fingerprint_global(ref, fp);
+    if (function_ret_type.count(ref) && ref != def->ident)
+      fp += "\nfunc " + ref + ":" + function_ret_type[ref] + ":" +
+        std::to_string(function_param_num[ref]);
+  }
+  // 本函数和直接调用的函数的签名改写决定了函数头和调用点的写法
+  fp += "\nplan " + plan_descriptor(def->ident);
+  for (auto&& callee : func_callees[def->ident])
+    fp += "\nplan " + callee + ":" + plan_descriptor(callee);
+  // 以常量实参调用的纯函数会在编译期求值, 结果取决于所有可能调用到的函数体
+  // 和它们读到的全局变量与常量
+  std::set<std::string> reached{def->ident};
+  std::vector<std::string> work{def->ident};
+  while (!work.empty())
+  {
+    std::string func = work.back();
+    work.pop_back();
+    for (auto&& callee : func_callees[func])
+      if (reached.insert(callee).second)
+      {
+        work.push_back(callee);
+        fp += "\nbody " + callee + ":" + func_body_hashes[callee];
+        for (auto&& ref : func_global_refs[callee]) fingerprint_global(ref, fp);
+      }
+  }
+  std::string key = cache_hash(fp), text;
+  cache_keys[def->ident] = key;
+  if (cache_load(key, ".koopa", text))
+  {
+    def->Declare();
+    // 汇编也命中时只需留下声明, 后端直接使用缓存的汇编
+    if (cache_riscv && cache_load(key, ".S", cached_asm[def->ident]))
+    {
+      std::cout << def->DeclLine() << std::endl;
+      return;
+    }
+    cached_asm.erase(def->ident);
+    std::cout << text;
+    return;
+  }
+  std::ostringstream buf;
+  std::streambuf *old = std::cout.rdbuf(buf.rdbuf());
+  def->Dump();
+  std::cout.rdbuf(old);
+  cache_store(key, ".koopa", buf.str());
+  std::cout << buf.str();
+}
+
 class BlockAST : public BaseAST{
   public:
     std::vector<std::unique_ptr<BaseAST>> block_item_list;
@@ -180,6 +491,7 @@ class BlockAST : public BaseAST{
       level++;
       std::map<std::string, int> symbol_table;
       std::map<std::string, int> var_type;
+      std::map<std::string, ArrayInfo> array_table;
       
       if(level==1) std::cout<<"{"<<std::endl;
       if(level==1) std::cout<<"%""entry:"<<std::endl;
@@ -189,19 +501,33 @@ class BlockAST : public BaseAST{
         std::vector<std::string> idents = function_param_idents[func];
         std::vector<std::string> names = function_param_names[func];
         std::vector<std::string> types = function_param_types[func];
+        std::vector<ParamPlan> plans = function_param_plans[func];
+        std::vector<std::vector<int>> dims = function_param_dims[func];
         for (int i = 0; i < names.size(); i++)
         {
           std::string ident = idents[i];
+          if (plans[i].kind == ParamKind::drop) continue;
+          // 没有被赋值的常量形参与局部常量一样直接替换成值
+          if (plans[i].kind == ParamKind::constant && !plans[i].assigned)
+          {
+            symbol_table[ident] = plans[i].value;
+            var_type[ident] = 0;
+            continue;
+          }
           std::string name = names[i]; name[0] = '%';
           symbol_table[ident] = func_num;
-          var_type[ident] = 2;
+          var_type[ident] = dims[i].empty() ? 2 : 4;
+          if (!dims[i].empty()) array_table[ident].dims = dims[i];
           std::cout << " " << name << " = alloc ";
           std::cout << types[i] << std::endl;
-          std::cout << " store " << names[i] << ", " << name << std::endl;
+          if (plans[i].kind == ParamKind::constant)
+            std::cout << " store " << plans[i].value << ", " << name << std::endl;
+          else std::cout << " store " << names[i] << ", " << name << std::endl;
         }
       }
       symbol_tables.push_back(symbol_table);
       var_types.push_back(var_type);
+      array_tables.push_back(array_table);
       for (auto&& block_item : block_item_list) 
       {
         block_item->Dump();
@@ -214,13 +540,14 @@ class BlockAST : public BaseAST{
       
       if(func!=""&&c==0) 
       {
-        if (func_type == "int")std::cout << " ret 0" << std::endl;
-        else if (func_type == "void")std::cout << " ret" << std::endl;
+        if (present_func_type == "int")std::cout << " ret 0" << std::endl;
+        else if (present_func_type == "void")std::cout << " ret" << std::endl;
         else assert(false);
       }
       if(level==1) std::cout<<"}"<<std::endl;
       symbol_tables.pop_back();
       var_types.pop_back();
+      array_tables.pop_back();
       level--;
   }
   std::string Type() const override{
@@ -233,6 +560,11 @@ class BlockAST : public BaseAST{
         return "cont";
     return "not";    
   }
+  void Fingerprint(std::string &fp) const override{
+    fp += "{";
+    for (auto&& block_item : block_item_list) block_item->Fingerprint(fp);
+    fp += "}";
+  }
 };
 
 class BlockItemAST : public BaseAST
@@ -244,6 +576,9 @@ public:
     std::string Type() const override{
       return content->Type();
     }
+    void Fingerprint(std::string &fp) const override{
+      content->Fingerprint(fp);
+    }
 };
 
 class ComplexStmtAST : public BaseAST{
@@ -287,15 +622,22 @@ class ComplexStmtAST : public BaseAST{
           std::string entry_label = "\%while__" + std::to_string(while_num);
           std::string body_label = "\%do__" + std::to_string(while_num);
           std::string end_label = "\%while_end__" + std::to_string(while_num);
+          std::string guard_label = "\%while_guard__" + std::to_string(while_num);
           while_stack.push_back(while_num++);
-          std::cout << " jump " << entry_label << std::endl;
-          std::cout << entry_label << ":" << std::endl;
+          // 循环倒置: 进入前判断一次条件, 循环体之后的 %while__ 块再判断并跳回循环体开头,
+          // 每次迭代只执行一个条件分支. continue 跳到循环体之后的判断.
+          // 入口的判断单独成块, 不延长前一个块里寄存器的占用
+          std::cout << " jump " << guard_label << std::endl;
+          std::cout << guard_label << ":" << std::endl;
           exp->Dump();
           std::cout << " br %" << nowww-1 << ", " << body_label << ", " << end_label << std::endl;
           std::cout << body_label << ":" << std::endl;
           while_stmt->Dump();
           if (while_stmt->Type() != "ret" && while_stmt->Type() != "break" && while_stmt->Type() != "cont")
             std::cout << " jump " << entry_label << std::endl;
+          std::cout << entry_label << ":" << std::endl;
+          exp->Dump();
+          std::cout << " br %" << nowww-1 << ", " << body_label << ", " << end_label << std::endl;
           std::cout << end_label << ":" << std::endl;
           while_stack.pop_back();
         }
@@ -311,6 +653,14 @@ class ComplexStmtAST : public BaseAST{
       else if(type==StmtType::while_) return "not";
       
     }
+    void Fingerprint(std::string &fp) const override{
+      fp += "S" + std::to_string((int)type) + "(";
+      fingerprint_child(exp, fp);
+      fingerprint_child(if_stmt, fp);
+      fingerprint_child(else_stmt, fp);
+      fingerprint_child(while_stmt, fp);
+      fp += ")";
+    }
 };
 
 class StmtAST : public BaseAST{
@@ -322,8 +672,10 @@ class StmtAST : public BaseAST{
     void Dump() const override {
       if(type==SimpleStmtType::ret)
       {
-        exp->Dump();
-        std::cout<<" ret %"<<nowww-1<<std::endl;
+        if(exp) exp->Dump();
+        // 返回值没有被使用的函数已经改成 void, 只保留表达式的副作用
+        if(present_func_type=="void"||!exp) std::cout<<" ret"<<std::endl;
+        else std::cout<<" ret %"<<nowww-1<<std::endl;
       }
       else if(type==SimpleStmtType::lval)
       {
@@ -360,352 +712,450 @@ class StmtAST : public BaseAST{
       else if(type==SimpleStmtType::continue_) return "cont";
       else return "not";
     }
+    void Fingerprint(std::string &fp) const override{
+      fp += "s" + std::to_string((int)type) + "(";
+      fingerprint_child(exp, fp);
+      fingerprint_child(lval, fp);
+      fingerprint_child(block, fp);
+      fp += ")";
+    }
 };
 
-class NumberAST : public BaseAST{
-  public:
-    int num;
-    void Dump() const override {
-    std::cout<<" %"<<nowww<<" = add 0, "<<num<<std::endl;
-    nowww++;
-  }
-  int Calc()const override{
-      return num;
-  }
+// 表达式不再为每一层文法建一个 AST 结点, 而是由 parser 直接在 expr_pool 中
+// 分配紧凑的结点, 只保留有实际运算的结点 (只有一个孩子的中间层在建树时就被去掉),
+// 结点之间用下标引用. 遍历都用显式栈, 不走虚函数, 任意深的表达式也不会撑爆栈
+enum class ExprKind : uint8_t { number, lval, unary, binary, call };
+
+struct ExprNode
+{
+  ExprKind kind;
+  uint8_t op;     // unary/binary 的运算符
+  uint8_t need;   // 求值时同时活跃的值的个数 (Sethi-Ullman 数), 最大 255
+  bool calls;     // 子树中有函数调用
+  int a;          // number: 值; lval/call: 标识符编号; unary/binary: (左) 操作数
+  int b;          // binary: 右操作数; lval/call: 下标或实参在 expr_args 中的起始位置
+  int c;          // lval/call: 下标或实参个数
 };
 
-class ExpAST : public BaseAST{
-  public:
-    std::unique_ptr<BaseAST> lor_exp;
-    void Dump()const override{
-      lor_exp->Dump();
-    }
-    int Calc()const override{
-      return lor_exp->Calc();
+inline std::vector<ExprNode> expr_pool;
+inline std::vector<int> expr_args;
+// 标识符只保存一份, 结点里存编号
+inline std::deque<std::string> expr_idents;
+inline std::unordered_map<std::string_view, int> expr_ident_ids;
+
+inline int expr_ident_id(std::string_view ident)
+{
+  auto it = expr_ident_ids.find(ident);
+  if (it != expr_ident_ids.end()) return it->second;
+  expr_idents.emplace_back(ident);
+  int id = expr_idents.size() - 1;
+  expr_ident_ids[expr_idents.back()] = id;
+  return id;
+}
+
+inline int expr_node(ExprKind kind, int op, int a, int b = 0, int c = 0)
+{
+  ++stat_expr_nodes;
+  // 孩子总是先于父结点建立, 建结点时即可算出寄存器需求
+  int need = 1;
+  bool calls = kind == ExprKind::call;
+  if (kind == ExprKind::unary) need = expr_pool[a].need, calls = expr_pool[a].calls;
+  else if (kind == ExprKind::binary)
+  {
+    int l = expr_pool[a].need, r = expr_pool[b].need;
+    need = l == r ? l + 1 : std::max(l, r);
+    calls = expr_pool[a].calls || expr_pool[b].calls;
+  }
+  else if (kind == ExprKind::lval || kind == ExprKind::call)
+    // 下标和实参依次求值, 前面的结果在求后面的时都还活跃
+    for (int k = 0; k < c; k++)
+    {
+      const ExprNode &child = expr_pool[expr_args[b + k]];
+      need = std::max(need, child.need + k);
+      calls |= child.calls;
     }
-};
+  expr_pool.push_back({kind, (uint8_t)op, (uint8_t)std::min(need, 255), calls, a, b, c});
+  return expr_pool.size() - 1;
+}
 
-class LOrExpAST : public BaseAST{
-  public:
-    std::unique_ptr<BaseAST> land_exp;
-    int op;
-    std::unique_ptr<BaseAST> lor_exp;
-    void Dump()const override
+inline int expr_call(std::string_view ident, const std::vector<int> &args)
+{
+  int first = expr_args.size();
+  expr_args.insert(expr_args.end(), args.begin(), args.end());
+  return expr_node(ExprKind::call, 0, expr_ident_id(ident), first, args.size());
+}
+
+inline int expr_lval(std::string_view ident, const std::vector<int> &indices)
+{
+  int first = expr_args.size();
+  expr_args.insert(expr_args.end(), indices.begin(), indices.end());
+  return expr_node(ExprKind::lval, 0, expr_ident_id(ident), first, indices.size());
+}
+
+// 第 k 个要求值的孩子, 没有时返回 -1
+// 加减与逻辑运算先求右操作数, 其余运算从左往右, 与原先逐层 Dump 的顺序相同
+inline int expr_child(const ExprNode &e, int k)
+{
+  switch (e.kind)
+  {
+    case ExprKind::unary: return k == 0 ? e.a : -1;
+    case ExprKind::binary:
+      if (k > 1) return -1;
+      if (e.op == Add || e.op == Sub || e.op == And || e.op == Or)
+        return k == 0 ? e.b : e.a;
+      return k == 0 ? e.a : e.b;
+    case ExprKind::lval:
+    case ExprKind::call: return k < e.c ? expr_args[e.b + k] : -1;
+    default: return -1;
+  }
+}
+
+// 生成代码时第 k 个求值的孩子: 二元运算两边都没有函数调用时先求寄存器需求大的一边,
+// 求完后只多占一个寄存器; 有调用时保持 expr_child 的顺序
+inline int expr_eval_child(const ExprNode &e, int k)
+{
+  if (e.kind != ExprKind::binary || k > 1) return expr_child(e, k);
+  int first = expr_child(e, 0), second = expr_child(e, 1);
+  if (expr_pool[first].calls || expr_pool[second].calls ||
+    expr_pool[second].need <= expr_pool[first].need)
+    return k == 0 ? first : second;
+  if (k == 0) ++stat_expr_reordered;
+  return k == 0 ? second : first;
+}
+
+inline int find_level(const std::string &ident)
+{
+  for (int i=level;i>=0;--i)
+    if(var_types[i].count(ident)) return i;
+  return -1;
+}
+
+// 数组元素或子数组的地址, idx 是各下标所在的 Koopa 值编号, 结果在 %(nowww-1) 中
+// 下标不全时得到的子数组退化成指向其首元素的指针, 可以直接作为实参
+inline void dump_array_ptr(int i, const std::string &ident, const int *idx, int n)
+{
+  const ArrayInfo &info = array_tables[i][ident];
+  std::string name = ident+"_"+std::to_string(symbol_tables[i][ident])+"_"+std::to_string(i);
+  std::string ptr = "@" + name;
+  int k = 0;
+  if(var_types[i][ident]==4)
+  {
+    std::cout<<" %"<<nowww<<" = load %"<<name<<std::endl;
+    ptr = "%" + std::to_string(nowww++);
+    if(n==0) return;
+    std::cout<<" %"<<nowww<<" = getptr "<<ptr<<", %"<<idx[0]<<std::endl;
+    ptr = "%" + std::to_string(nowww++);
+    k = 1;
+  }
+  for (; k < n; k++)
+  {
+    std::cout<<" %"<<nowww<<" = getelemptr "<<ptr<<", %"<<idx[k]<<std::endl;
+    ptr = "%" + std::to_string(nowww++);
+  }
+  if(n<(int)info.dims.size())
+    std::cout<<" %"<<nowww++<<" = getelemptr "<<ptr<<", 0"<<std::endl;
+}
+
+// 常量数组元素在展开后的初值中的位置, 下标越界时返回 -1
+inline int array_offset(const ArrayInfo &info, const int *idx, int n)
+{
+  if(n!=(int)info.dims.size()) return -1;
+  int offset = 0;
+  for (int k = 0; k < n; k++)
+  {
+    if(idx[k]<0||idx[k]>=info.dims[k]) return -1;
+    offset = offset*info.dims[k]+idx[k];
+  }
+  return offset;
+}
+
+inline void dump_lval_load(const std::string &ident, const int *idx = nullptr, int n = 0)
+{
+  for (int i=level;i>=0;--i)
+  {
+    if(var_types[i].count(ident))
     {
-      int now1,now2;
-      if(op==-1)
+      if(var_types[i][ident]>=3)
       {
-        land_exp->Dump();
+        dump_array_ptr(i, ident, idx, n);
+        if(n==(int)array_tables[i][ident].dims.size())
+        {
+          std::cout<<" %"<<nowww<<" = load %"<<nowww-1<<std::endl;
+          nowww++;
+        }
+        break;
       }
+      if(var_types[i][ident]==0)
+        std::cout<<" %"<<nowww<<" = add "<<"0 ,"<<symbol_tables[i][ident]<<std::endl;
+      else if(var_types[i][ident]==1)
+        std::cout<<" %"<<nowww<<" = load "<<"@"<<ident<<"_"<<symbol_tables[i][ident]<<"_"<<i<<std::endl;
       else
-      {
-        land_exp->Dump();
-        now1=nowww-1;
-        lor_exp->Dump();
-        now2=nowww-1;
-        std::cout<<" %"<<nowww<<" = ne %"<<now1<<", 0"<<std::endl;
-        ++nowww;
-        std::cout<<" %"<<nowww<<" = ne %"<<now2<<", 0"<<std::endl;
-        ++nowww;
-        std::cout<<" %"<<nowww<<" = or %"<<nowww-2<<", %"<<nowww-1<<std::endl;
-        ++nowww;
-      }
+        std::cout<<" %"<<nowww<<" = load "<<"%"<<ident<<"_"<<symbol_tables[i][ident]<<"_"<<i<<std::endl;
+      nowww++;
+      break;
     }
-    int Calc()const override{
-      if(op==-1) return land_exp->Calc();
-      else
+  }
+}
+
+inline int calc_lval(const std::string &ident)
+{
+  int cal;
+  for (int i=level;i>=0;--i)
+  {
+    if(symbol_tables[i].count(ident))
       {
-        int left_v= lor_exp->Calc();
-        if(left_v) return 1;
-        int right_v=land_exp->Calc();
-        if(right_v) return 1;
-        return 0;
+        cal=symbol_tables[i][ident];
+        break;
       }
-    }
-};
+  }
+  return cal;
+}
 
-class LAndExpAST : public BaseAST{
-  public:
-    std::unique_ptr<BaseAST> eq_exp;
-    int op;
-    std::unique_ptr<BaseAST> land_exp;
-    void Dump()const override
+inline bool fold_call(const ExprNode &e, int &value);
+inline bool fold_elem(int id, int &value);
+
+// 生成表达式的 Koopa IR, 结果在 %(nowww-1) 中
+inline void dump_expr(int root)
+{
+  // val[结点] 是该结点结果所在的 Koopa 值编号, 两个数组在调用之间复用
+  static std::vector<int> val;
+  if (val.size() < expr_pool.size()) val.resize(expr_pool.size());
+  static std::vector<std::pair<int, int>> stack;
+  stack.assign(1, {root, 0});
+  while (!stack.empty())
+  {
+    int id = stack.back().first;
+    const ExprNode &e = expr_pool[id];
+    int folded;
+    if (stack.back().second == 0 && ((e.kind == ExprKind::call && fold_call(e, folded)) ||
+      (e.kind == ExprKind::lval && e.c && fold_elem(id, folded))))
     {
-      int now1,now2;
-      if(op==-1)
-      {
-        eq_exp->Dump();
-      }
-      else
-      {
-        eq_exp->Dump();
-        now1=nowww-1;
-        land_exp->Dump();
-        now2=nowww-1;
-        std::cout<<" %"<<nowww<<" = ne %"<<now1<<", 0"<<std::endl;
-        ++nowww;
-        std::cout<<" %"<<nowww<<" = ne %"<<now2<<", 0"<<std::endl;
-        ++nowww;
-        std::cout<<" %"<<nowww<<" = and %"<<nowww-2<<", %"<<nowww-1<<std::endl;
-        ++nowww;
-      }
-    }
-    int Calc()const override{
-      if(op==-1) return eq_exp->Calc();
-      else{
-        int left_v=land_exp->Calc();
-        if(left_v==0) return 0;
-        int right_v=eq_exp->Calc();
-        if(right_v==0) return 0;
-        return 1;
-      }
+      // 纯函数以常量实参调用, 或常量数组以常量下标访问, 直接使用编译期求出的结果
+      stack.pop_back();
+      std::cout<<" %"<<nowww<<" = add 0, "<<folded<<std::endl;
+      val[id] = nowww++;
+      continue;
     }
-};
-
-class EqExpAST : public BaseAST{
-  public:
-    std::unique_ptr<BaseAST> rel_exp;
-    int op;
-    std::unique_ptr<BaseAST> eq_exp;
-    void Dump()const override
+    // 改写过签名的函数只对需要传递的实参求值, 去掉的实参都没有副作用
+    const CallPlan *plan = nullptr;
+    if (e.kind == ExprKind::call && !call_plans.empty())
     {
-      int now1,now2;
-      if(op==-1)
-      {
-        rel_exp->Dump();
-      }
-      else
-      {
-        eq_exp->Dump();
-        now1=nowww-1;
-        rel_exp->Dump();
-        now2=nowww-1;
-        if(op==Equal)
-        {
-          std::cout<<" %"<<nowww<<" = eq %"<<now1<<", %"<<now2<<std::endl;
-          ++nowww;
-        }
-        else if(op==NotEqual)
-        {
-          std::cout<<" %"<<nowww<<" = ne %"<<now1<<", %"<<now2<<std::endl;
-          ++nowww;
-        }
-      }
+      auto it = call_plans.find(id);
+      if (it != call_plans.end()) plan = &it->second;
     }
-    int Calc()const override{
-      if(op==-1) return rel_exp->Calc();
-      else{
-        int left_v=eq_exp->Calc();
-        int right_v=rel_exp->Calc();
-        if(op==Equal) return left_v==right_v;
-        else if(op==NotEqual) return left_v!=right_v;
-      }
+    int k = stack.back().second++;
+    int child = !plan ? expr_eval_child(e, k) : k < (int)plan->args.size() ? expr_args[e.b + plan->args[k]] : -1;
+    if (child >= 0)
+    {
+      stack.push_back({child, 0});
+      continue;
     }
-};
-
-class RelExpAST : public BaseAST{
-  public:
-    std::unique_ptr<BaseAST> add_exp;
-    int op;
-    std::unique_ptr<BaseAST> rel_exp;
-    void Dump()const override
+    stack.pop_back();
+    switch (e.kind)
     {
-      int now1,now2;
-      if(op==-1)
+      case ExprKind::number:
+        std::cout<<" %"<<nowww<<" = add 0, "<<e.a<<std::endl;
+        nowww++;
+        break;
+      case ExprKind::lval:
       {
-        add_exp->Dump();
+        static std::vector<int> idx;
+        idx.clear();
+        for (int k = 0; k < e.c; k++) idx.push_back(val[expr_args[e.b + k]]);
+        dump_lval_load(expr_idents[e.a], idx.data(), e.c);
+        break;
       }
-      else
-      {
-        rel_exp->Dump();
-        now1=nowww-1;
-        add_exp->Dump();
-        now2=nowww-1;
-        if(op==Less)
-        {
-          std::cout<<" %"<<nowww<<" = lt %"<<now1<<", %"<<now2<<std::endl;
-          ++nowww;
+      case ExprKind::unary:
+        if(e.op==Invert){
+          std::cout<<" %"<<nowww<<" = sub 0, %"<<val[e.a]<<std::endl;
+          nowww++;
         }
-        else if(op==Greater)
-        {
-          std::cout<<" %"<<nowww<<" = gt %"<<now1<<", %"<<now2<<std::endl;
-          ++nowww;
+        else if(e.op==EqualZero){
+          std::cout<<" %"<<nowww<<" = eq 0, %"<<val[e.a]<<std::endl;
+          nowww++;
         }
-        else if(op==LessEq)
+        break;
+      case ExprKind::binary:
+      {
+        static const char *names[] = {"", "", "", "add", "sub", "mul", "div", "mod",
+          "lt", "gt", "le", "ge", "eq", "ne", "and", "or"};
+        int l = val[e.a], r = val[e.b];
+        if(e.op==And||e.op==Or)
         {
-          std::cout<<" %"<<nowww<<" = le %"<<now1<<", %"<<now2<<std::endl;
+          std::cout<<" %"<<nowww<<" = ne %"<<r<<", 0"<<std::endl;
           ++nowww;
-        }
-        else if(op==GreaterEq)
-        {
-          std::cout<<" %"<<nowww<<" = ge %"<<now1<<", %"<<now2<<std::endl;
+          std::cout<<" %"<<nowww<<" = ne %"<<l<<", 0"<<std::endl;
           ++nowww;
+          std::cout<<" %"<<nowww<<" = "<<names[e.op]<<" %"<<nowww-2<<", %"<<nowww-1<<std::endl;
         }
+        else if(e.op==Add)
+          std::cout<<" %"<<nowww<<" = add %"<<r<<", %"<<l<<std::endl;
+        else
+          std::cout<<" %"<<nowww<<" = "<<names[e.op]<<" %"<<l<<", %"<<r<<std::endl;
+        ++nowww;
+        break;
       }
-    }
-    int Calc()const override{
-      if(op==-1) return add_exp->Calc();
-      else{
-        int left_v=rel_exp->Calc();
-        int right_v=add_exp->Calc();
-        if(op==Less) return left_v<right_v;
-        else if(op==Greater) return left_v>right_v;
-        else if(op==LessEq) return left_v<=right_v;
-        else if(op==GreaterEq) return left_v>=right_v;
-      }
-    }
-    
-};
-
-class AddExpAST : public BaseAST{
-  public:
-    std::unique_ptr<BaseAST> mu_exp;
-    int op;
-    std::unique_ptr<BaseAST> add_exp;
-    void Dump()const override
-    {
-      int now1,now2;
-      if(op==-1)
-      {
-        mu_exp->Dump();
-      }
-      else
+      case ExprKind::call:
       {
-        mu_exp->Dump();
-        now1=nowww-1;
-        add_exp->Dump();
-        now2=nowww-1;
-        if(op==Add)
-        {
-          std::cout<<" %"<<nowww<<" = add %"<<now1<<", %"<<now2<<std::endl;
-          ++nowww;
-        }
-        else if(op==Sub)
+        const std::string &ident = plan ? plan->callee : expr_idents[e.a];
+        int argc = plan ? plan->args.size() : e.c;
+        assert(function_table.count(ident));
+        assert(function_param_num[ident] == argc);
+        if(function_ret_type[ident]=="int") std::cout<<" %"<<nowww<<" =";
+        std::cout<<" call "<<function_table[ident]<<"(";
+        for(int i=0;i<argc;++i)
         {
-          std::cout<<" %"<<nowww<<" = sub %"<<now2<<", %"<<now1<<std::endl;
-          ++nowww;
+          std::cout<<"%"<<val[expr_args[e.b+(plan ? plan->args[i] : i)]];
+          if(i!=argc-1) std::cout<<", ";
         }
+        std::cout<<")"<<std::endl;
+        nowww++;
+        break;
       }
     }
-    int Calc()const override{
-      if(op==-1) return mu_exp->Calc();
-      else{
-        int left_v=add_exp->Calc();
-        int right_v=mu_exp->Calc();
-        if(op==Add) return left_v+right_v;
-        else if(op==Sub) return left_v-right_v;
-      }
-    }
-};
+    val[id] = nowww - 1;
+  }
+}
 
-class MulExpAST : public BaseAST{
-  public:
-    std::unique_ptr<BaseAST> mu_exp;
-    int op;
-    std::unique_ptr<BaseAST> u_exp;
-    void Dump()const override
+// 常量求值, 逻辑运算短路, 函数调用只能是可以在编译期求值的纯函数
+inline int calc_expr(int root)
+{
+  static std::vector<int> val;
+  if (val.size() < expr_pool.size()) val.resize(expr_pool.size());
+  static std::vector<std::pair<int, int>> stack;
+  stack.assign(1, {root, 0});
+  while (!stack.empty())
+  {
+    int id = stack.back().first;
+    int k = stack.back().second++;
+    const ExprNode &e = expr_pool[id];
+    int child = -1;
+    if (e.kind == ExprKind::unary && k == 0) child = e.a;
+    else if (e.kind == ExprKind::binary && k < 2)
     {
-      int now1,now2;
-      if(op==-1)
-      {
-        u_exp->Dump();
-      }
-      else
-      {
-        mu_exp->Dump();
-        now1=nowww-1;
-        u_exp->Dump();
-        now2=nowww-1;
-        if(op==Mul)
-        {
-          std::cout<<" %"<<nowww<<" = mul %"<<now1<<", %"<<now2<<std::endl;
-          ++nowww;
-        }
-        else if(op==Div)
-        {
-          std::cout<<" %"<<nowww<<" = div %"<<now1<<", %"<<now2<<std::endl;
-          ++nowww;
-        }
-        else if(op==Mod)
-        {
-          std::cout<<" %"<<nowww<<" = mod %"<<now1<<", %"<<now2<<std::endl;
-          ++nowww;
-        }
-      }
+      child = k == 0 ? e.a : e.b;
+      // 左操作数已经决定结果时不再求右操作数
+      if (k == 1 && ((e.op == Or && val[e.a]) || (e.op == And && !val[e.a])))
+        child = -1;
     }
-    int Calc()const override{
-      if(op==-1) return u_exp->Calc();
-      else{
-        int left_v=mu_exp->Calc();
-        int right_v=u_exp->Calc();
-        if(op==Mul) return left_v*right_v;
-        else if(op==Div) return left_v/right_v;
-        else if(op==Mod) return left_v%right_v;
-      }
+    else if (e.kind == ExprKind::lval && k < e.c) child = expr_args[e.b + k];
+    if (child >= 0)
+    {
+      stack.push_back({child, 0});
+      continue;
     }
-};
-
-class UnaryExpAST : public BaseAST{
-  public:
-    UnaryExpType type;
-    std::unique_ptr<BaseAST> pu_exp;
-    std::string ident;
-    std::vector<std::unique_ptr<BaseAST> > params;
-    int op;
-    void Dump()const override{
-      if(type!=UnaryExpType::func_call)
+    stack.pop_back();
+    int &v = val[id];
+    switch (e.kind)
+    {
+      case ExprKind::number: v = e.a; break;
+      case ExprKind::lval:
       {
-        if(op==-1||op==NoOperation) pu_exp->Dump();
-        else if(op==Invert){
-          pu_exp->Dump();
-          std::cout<<" %"<<nowww<<" = sub 0, %"<<nowww-1<<std::endl;
-          nowww++;
-        } 
-        else if(op==EqualZero){
-          pu_exp->Dump();
-          std::cout<<" %"<<nowww<<" = eq 0, %"<<nowww-1<<std::endl;
-          nowww++;
+        if (!e.c)
+        {
+          v = calc_lval(expr_idents[e.a]);
+          break;
         }
+        // 常量数组的元素
+        const std::string &ident = expr_idents[e.a];
+        int i = find_level(ident);
+        assert(i >= 0 && var_types[i][ident] == 3);
+        const ArrayInfo &info = array_tables[i][ident];
+        std::vector<int> idx;
+        for (int k = 0; k < e.c; k++) idx.push_back(val[expr_args[e.b + k]]);
+        int offset = array_offset(info, idx.data(), e.c);
+        assert(!info.values.empty() && offset >= 0);
+        v = info.values[offset];
+        break;
       }
-      else
+      case ExprKind::unary:
+        if(e.op==Invert) v = -val[e.a];
+        else if(e.op==EqualZero) v = !val[e.a];
+        else v = val[e.a];
+        break;
+      case ExprKind::binary:
       {
-        std::vector<int> param_vars;
-        for (auto&& param : params)
+        int l = val[e.a];
+        if(e.op==Or&&l) { v = 1; break; }
+        if(e.op==And&&!l) { v = 0; break; }
+        int r = val[e.b];
+        switch (e.op)
         {
-          param->Dump();
-          param_vars.push_back(nowww-1);
+          case Add: v = l + r; break;
+          case Sub: v = l - r; break;
+          case Mul: v = l * r; break;
+          case Div: v = l / r; break;
+          case Mod: v = l % r; break;
+          case Less: v = l < r; break;
+          case Greater: v = l > r; break;
+          case LessEq: v = l <= r; break;
+          case GreaterEq: v = l >= r; break;
+          case Equal: v = l == r; break;
+          case NotEqual: v = l != r; break;
+          default: v = r != 0; break;
         }
-        assert(function_table.count(ident));
-        assert(function_param_num[ident] == params.size());
-        if(function_ret_type[ident]=="int") std::cout<<" %"<<nowww<<" =";
-        std::cout<<" call "<<function_table[ident]<<"(";
-        for(int i=0;i<param_vars.size();++i)
+        break;
+      }
+      case ExprKind::call:
+      {
+        bool ok = fold_call(e, v);
+        // 流式编译不保留已经生成的函数体, 常量表达式中的调用无法求值
+        if (!ok && stream_item)
         {
-          std::cout<<"%"<<param_vars[i];
-          if(i!=param_vars.size()-1) std::cout<<", ";
+          std::cerr << "error: -stream cannot evaluate call to " << expr_idents[e.a]
+            << " in a constant expression" << std::endl;
+          exit(1);
         }
-        std::cout<<")"<<std::endl;
-        nowww++;
+        assert(ok);
+        break;
       }
     }
-    int Calc()const override{
-      if(op==-1||op==NoOperation) return pu_exp->Calc();
-      else{
-        if(op==Invert) return -pu_exp->Calc();
-        else if(op==EqualZero) return !pu_exp->Calc();
-      }
+  }
+  return val[root];
+}
+
+// 按先序把表达式写入指纹, 同时记录引用到的标识符
+inline void fingerprint_expr(int root, std::string &fp)
+{
+  std::vector<int> stack{root};
+  while (!stack.empty())
+  {
+    const ExprNode &e = expr_pool[stack.back()];
+    stack.pop_back();
+    fp += std::to_string((int)e.kind) + ":" + std::to_string(e.op) + ":";
+    if (e.kind == ExprKind::number) fp += std::to_string(e.a);
+    else if (e.kind == ExprKind::lval || e.kind == ExprKind::call)
+    {
+      fingerprint_refs.insert(expr_idents[e.a]);
+      fp += expr_idents[e.a] + "/" + std::to_string(e.c);
     }
-};
+    fp += ";";
+    for (int k = 1; ; k++)
+    {
+      // 倒序压栈, 出栈时按书写顺序
+      int child = e.kind == ExprKind::binary ? (k == 1 ? e.b : k == 2 ? e.a : -1) :
+        e.kind == ExprKind::unary ? (k == 1 ? e.a : -1) :
+        e.kind == ExprKind::call || e.kind == ExprKind::lval ?
+        (k <= e.c ? expr_args[e.b + e.c - k] : -1) : -1;
+      if (child < 0) break;
+      stack.push_back(child);
+    }
+  }
+}
 
-class PrimaryExpAST : public BaseAST{
+// 语句中的一个完整表达式, 只记录根结点的下标
+class ExpAST : public BaseAST{
   public:
-    PrimaryExpType type;
-    std::unique_ptr<BaseAST> p_exp;
+    int root;
+    explicit ExpAST(int root) : root(root) {}
     void Dump()const override{
-      p_exp->Dump();
+      dump_expr(root);
     }
     int Calc()const override{
-      return p_exp->Calc();
+      return calc_expr(root);
+    }
+    void Fingerprint(std::string &fp) const override{
+      fingerprint_expr(root, fp);
     }
 };
 
@@ -719,6 +1169,9 @@ class DeclAST : public BaseAST{
     std::string Type() const override{
       return "notret";
     }
+    void Fingerprint(std::string &fp) const override{
+      decl->Fingerprint(fp);
+    }
 };
 
 class ConstDeclAST : public BaseAST{
@@ -730,11 +1183,17 @@ class ConstDeclAST : public BaseAST{
         assert(b_type == "int");
         for (auto&& const_def : const_def_list) const_def->Dump();
     }
+    void Fingerprint(std::string &fp) const override{
+      fp += "C" + b_type + "(";
+      for (auto&& const_def : const_def_list) const_def->Fingerprint(fp);
+      fp += ")";
+    }
 };
 
 class ConstDefAST :public BaseAST{
   public:
     std::string ident;
+    std::vector<int> dims;
     std::unique_ptr<BaseAST> c_initval;
     int Calc()const override{
       symbol_tables[level][ident]=c_initval->Calc();
@@ -742,15 +1201,45 @@ class ConstDefAST :public BaseAST{
     }
     void Dump() const override
     {
-      var_types[level][ident]=0;
-      Calc();
+      if(dims.empty())
+      {
+        var_types[level][ident]=0;
+        Calc();
+        return;
+      }
+      // 常量数组在编译期求出全部初值, 常量下标的访问直接替换成值,
+      // 其余的访问与变量数组一样读内存
+      std::vector<int> sizes;
+      for (int dim : dims) sizes.push_back(calc_expr(dim));
+      std::vector<int> roots = flatten_init(c_initval.get(), sizes);
+      ArrayInfo &info = array_tables[level][ident];
+      info.dims = sizes;
+      info.values.assign(roots.size(), 0);
+      for (size_t f = 0; f < roots.size(); f++)
+        if(roots[f]>=0) info.values[f] = calc_expr(roots[f]);
+      for (size_t f = 0; f < roots.size(); f++)
+        roots[f] = info.values[f] ? expr_node(ExprKind::number, 0, info.values[f]) : -1;
+      dump_array_def(ident, sizes, roots);
+    }
+    void Fingerprint(std::string &fp) const override{
+      fp += ident;
+      for (int dim : dims)
+      {
+        fp += "[";
+        fingerprint_expr(dim, fp);
+        fp += "]";
+      }
+      fp += "=";
+      c_initval->Fingerprint(fp);
+      fp += ";";
     }
-    
 };
 
 class ConstInitValAST : public BaseAST{
   public:
+    ConstInitValType type = ConstInitValType::const_exp;
     std::unique_ptr<BaseAST> c_exp;
+    std::vector<std::unique_ptr<BaseAST>> list;
     void Dump() const override
     {
       c_exp->Dump();
@@ -758,6 +1247,16 @@ class ConstInitValAST : public BaseAST{
     int Calc()const override{
       return c_exp->Calc();
     }
+    void Fingerprint(std::string &fp) const override{
+      if(type==ConstInitValType::const_exp)
+      {
+        c_exp->Fingerprint(fp);
+        return;
+      }
+      fp += "{";
+      for (auto&& item : list) item->Fingerprint(fp);
+      fp += "}";
+    }
 };
 
 class ConstExpAST : public BaseAST{
@@ -770,6 +1269,9 @@ class ConstExpAST : public BaseAST{
     int Calc()const override{
       return exp->Calc();
     }
+    void Fingerprint(std::string &fp) const override{
+      exp->Fingerprint(fp);
+    }
 };
 
 class VarDeclAST : public BaseAST{
@@ -781,20 +1283,45 @@ class VarDeclAST : public BaseAST{
         assert(b_type == "int");
         for (auto&& var_def : var_def_list) var_def->Dump();
     }
+    void Fingerprint(std::string &fp) const override{
+      fp += "V" + b_type + "(";
+      for (auto&& var_def : var_def_list) var_def->Fingerprint(fp);
+      fp += ")";
+    }
 };
 
 class VarDefAST : public BaseAST{
   public:
     std::string ident;
+    std::vector<int> dims;
     bool ifhavev;
     std::unique_ptr<BaseAST> initval;
     void Dump() const override
     {
+      if(!dims.empty())
+      {
+        std::vector<int> sizes;
+        for (int dim : dims) sizes.push_back(calc_expr(dim));
+        array_tables[level][ident].dims = sizes;
+        std::vector<int> roots;
+        if(ifhavev) roots = flatten_init(initval.get(), sizes);
+        dump_array_def(ident, sizes, roots);
+        return;
+      }
       var_types[level][ident]=1;
       symbol_tables[level][ident]=func_num;
-      if(ifhavev)
+      if(ifhavev&&level==0)
+      {
+        // 全局变量的初值是常量表达式, 直接放进静态数据, 不生成运行时的初始化
+        int value=initval->Calc();
+        global_inits[ident]=std::to_string(value);
+        if(!global_live(ident)) { stat_dead_globals++; return; }
+        std::cout<<" global @"<<ident<<"_"<<func_num<<"_"<<level<<" = alloc i32, ";
+        if(value==0) std::cout<<"zeroinit"<<std::endl;
+        else std::cout<<value<<std::endl;
+      }
+      else if(ifhavev)
       {
-        if(level==0) std::cout<<" global";
         std::cout<<" @"<<ident<<"_"<<func_num<<"_"<<level<<" = alloc i32"<<std::endl;
         initval->Dump();
         std::cout<<" store %"<<nowww-1<<", @"<<ident<<"_"<<func_num<<"_"<<level<<std::endl;
@@ -802,15 +1329,31 @@ class VarDefAST : public BaseAST{
       else
       {
         if(level==0)
+        {
+          if(!global_live(ident)) { stat_dead_globals++; return; }
           std::cout<<" global @"<<ident<<"_"<<func_num<<"_"<<level<<" = alloc i32, zeroinit"<<std::endl;
+        }
         else std::cout<<" @"<<ident<<"_"<<func_num<<"_"<<level<<" = alloc i32"<<std::endl;
       }
     }
+    void Fingerprint(std::string &fp) const override{
+      fp += ident;
+      for (int dim : dims)
+      {
+        fp += "[";
+        fingerprint_expr(dim, fp);
+        fp += "]";
+      }
+      fp += ifhavev ? "=" : ";";
+      if(ifhavev) initval->Fingerprint(fp);
+    }
 };
 
 class InitValAST : public BaseAST{
   public:
+    InitValType type = InitValType::exp;
     std::unique_ptr<BaseAST> exp;
+    std::vector<std::unique_ptr<BaseAST>> list;
     void Dump() const override
     {
       exp->Dump();
@@ -819,58 +1362,935 @@ class InitValAST : public BaseAST{
     {
       return exp->Calc();
     }
+    void Fingerprint(std::string &fp) const override
+    {
+      if(type==InitValType::exp)
+      {
+        exp->Fingerprint(fp);
+        return;
+      }
+      fp += "{";
+      for (auto&& item : list) item->Fingerprint(fp);
+      fp += "}";
+    }
 };
 
 class LValAST : public BaseAST{
   public:
     std::string ident;
+    std::vector<int> indices;
     void Dump()const override
     {
-      for (int i=level;i>=0;--i)
-      {
-        if(var_types[i].count(ident))
-        {
-          if(var_types[i][ident]==0)
-            std::cout<<" %"<<nowww<<" = add "<<"0 ,"<<symbol_tables[i][ident]<<std::endl;
-          else if(var_types[i][ident]==1)
-            std::cout<<" %"<<nowww<<" = load "<<"@"<<ident<<"_"<<symbol_tables[i][ident]<<"_"<<i<<std::endl;
-          else
-            std::cout<<" %"<<nowww<<" = load "<<"%"<<ident<<"_"<<symbol_tables[i][ident]<<"_"<<i<<std::endl;
-          nowww++;
-          break;
-        }
-      }
+      dump_lval_load(ident);
     }
     int Calc() const override
     {
-      int cal;
-      for (int i=level;i>=0;--i)
-      {
-        if(symbol_tables[i].count(ident))
-          { 
-            cal=symbol_tables[i][ident];
-            break;
-          }
-      }
-      return cal;
+      return calc_lval(ident);
+    }
+    std::string get_ident() const override{
+      return ident;
     }
     void dump()const override{
+      if(!indices.empty())
+      {
+        // 要存的值已经在 %(nowww-1) 中, 再求下标和元素地址
+        int value = nowww-1;
+        std::vector<int> idx;
+        for (int index : indices)
+        {
+          dump_expr(index);
+          idx.push_back(nowww-1);
+        }
+        int i = find_level(ident);
+        assert(i >= 0 && var_types[i][ident] >= 3);
+        dump_array_ptr(i, ident, idx.data(), idx.size());
+        std::cout<<" store %"<<value<<", %"<<nowww-1<<std::endl;
+        return;
+      }
       for (int i=level;i>=0;--i)
       {
         if(var_types[i].count(ident))
           { 
             if(var_types[i][ident]!=2)
-              std::cout<<" store %"<<nowww-1<<", @"<<ident<<"_"<<func_num<<"_"<<i<<std::endl;
+              std::cout<<" store %"<<nowww-1<<", @"<<ident<<"_"<<symbol_tables[i][ident]<<"_"<<i<<std::endl;
             else
-              std::cout<<" store %"<<nowww-1<<", %"<<ident<<"_"<<func_num<<"_"<<i<<std::endl;
+              std::cout<<" store %"<<nowww-1<<", %"<<ident<<"_"<<symbol_tables[i][ident]<<"_"<<i<<std::endl;
             break;
           }
       }
     }
+    void Fingerprint(std::string &fp) const override
+    {
+      fingerprint_refs.insert(ident);
+      fp += "$" + ident;
+      for (int index : indices)
+      {
+        fp += "[";
+        fingerprint_expr(index, fp);
+        fp += "]";
+      }
+      fp += ";";
+    }
 };
 
+// 编译期求值纯函数调用
+// 在 AST 上解释执行被调函数, 一旦读写全局变量, 调用库函数, 除零,
+// 或超出步数/递归深度的预算就放弃, 该调用照常在运行时进行
+inline std::set<std::string> impure_funcs;
+inline std::map<std::pair<std::string, std::vector<int>>, std::optional<int>> fold_memo;
+inline long interp_steps = 0;
+inline int interp_depth = 0;
+inline bool interp_failed = false;
+inline bool interp_impure = false;
+const long interp_step_limit = 1000000;
+const int interp_depth_limit = 200;
+// 被解释函数的作用域栈, 为空指针时表示在编译时的上下文中求常量实参
+inline std::vector<std::map<std::string, std::optional<int>>> *interp_env = nullptr;
+
+inline int interp_call(const std::string &ident, const std::vector<int> &args);
+
+inline void interp_fail(bool impure = false)
+{
+  interp_failed = true;
+  interp_impure |= impure;
+}
+
+inline int interp_load(const std::string &ident)
+{
+  if (interp_env)
+  {
+    for (auto it = interp_env->rbegin(); it != interp_env->rend(); ++it)
+    {
+      auto var = it->find(ident);
+      if (var == it->end()) continue;
+      if (!var->second) interp_fail();
+      return var->second.value_or(0);
+    }
+    // 函数内没有定义的名字只可能是全局的, 只允许读全局常量
+    if (var_types[0].count(ident) && var_types[0][ident] == 0)
+      return symbol_tables[0][ident];
+    interp_fail(true);
+    return 0;
+  }
+  for (int i=level;i>=0;--i)
+    if(var_types[i].count(ident))
+    {
+      if(var_types[i][ident]==0) return symbol_tables[i][ident];
+      break;
+    }
+  interp_fail();
+  return 0;
+}
+
+// 读数组元素, 只能以常量下标读全局或编译时上下文中的常量数组
+inline int interp_elem(const std::string &ident, const int *idx, int n)
+{
+  int i = 0;
+  if (interp_env)
+  {
+    // 被解释函数中的局部数组和数组形参都不支持
+    for (auto it = interp_env->rbegin(); it != interp_env->rend(); ++it)
+      if (it->count(ident))
+      {
+        interp_fail();
+        return 0;
+      }
+  }
+  else i = find_level(ident);
+  if (i < 0 || !var_types[i].count(ident) || var_types[i][ident] != 3)
+  {
+    interp_fail(interp_env);
+    return 0;
+  }
+  const ArrayInfo &info = array_tables[i][ident];
+  int offset = info.values.empty() ? -1 : array_offset(info, idx, n);
+  if (offset < 0)
+  {
+    // 读全局变量数组
+    interp_fail(interp_env && info.values.empty());
+    return 0;
+  }
+  return info.values[offset];
+}
+
+inline int interp_expr(int root)
+{
+  std::vector<std::pair<int, int>> stack{{root, 0}};
+  std::vector<int> vals;
+  while (!stack.empty() && !interp_failed)
+  {
+    if (++interp_steps > interp_step_limit)
+    {
+      interp_fail();
+      break;
+    }
+    int id = stack.back().first;
+    int k = stack.back().second++;
+    const ExprNode &e = expr_pool[id];
+    int child = -1;
+    if (e.kind == ExprKind::unary && k == 0) child = e.a;
+    else if (e.kind == ExprKind::binary && k < 2)
+    {
+      child = k == 0 ? e.a : e.b;
+      if (k == 1 && ((e.op == Or && vals.back()) || (e.op == And && !vals.back())))
+        child = -1;
+    }
+    else if ((e.kind == ExprKind::call || e.kind == ExprKind::lval) && k < e.c)
+      child = expr_args[e.b + k];
+    if (child >= 0)
+    {
+      stack.push_back({child, 0});
+      continue;
+    }
+    stack.pop_back();
+    switch (e.kind)
+    {
+      case ExprKind::number: vals.push_back(e.a); break;
+      case ExprKind::lval:
+        if (e.c)
+        {
+          int value = interp_elem(expr_idents[e.a], &vals[vals.size() - e.c], e.c);
+          vals.resize(vals.size() - e.c);
+          vals.push_back(value);
+        }
+        else vals.push_back(interp_load(expr_idents[e.a]));
+        break;
+      case ExprKind::unary:
+        if(e.op==Invert) vals.back() = -vals.back();
+        else if(e.op==EqualZero) vals.back() = !vals.back();
+        break;
+      case ExprKind::binary:
+      {
+        if (k == 1)
+        {
+          // 左操作数已经决定了结果
+          vals.back() = e.op == Or;
+          break;
+        }
+        int r = vals.back();
+        vals.pop_back();
+        int &l = vals.back();
+        if ((e.op == Div || e.op == Mod) && (r == 0 || (l == INT32_MIN && r == -1)))
+        {
+          interp_fail();
+          break;
+        }
+        switch (e.op)
+        {
+          case Add: l = (int)((unsigned)l + (unsigned)r); break;
+          case Sub: l = (int)((unsigned)l - (unsigned)r); break;
+          case Mul: l = (int)((unsigned)l * (unsigned)r); break;
+          case Div: l = l / r; break;
+          case Mod: l = l % r; break;
+          case Less: l = l < r; break;
+          case Greater: l = l > r; break;
+          case LessEq: l = l <= r; break;
+          case GreaterEq: l = l >= r; break;
+          case Equal: l = l == r; break;
+          case NotEqual: l = l != r; break;
+          default: l = r != 0; break;
+        }
+        break;
+      }
+      case ExprKind::call:
+      {
+        std::vector<int> args(vals.end() - e.c, vals.end());
+        vals.resize(vals.size() - e.c);
+        vals.push_back(interp_call(expr_idents[e.a], args));
+        break;
+      }
+    }
+  }
+  return interp_failed ? 0 : vals.back();
+}
+
+// 语句中表达式的根结点
+inline int interp_root(const BaseAST *ast)
+{
+  if (auto exp = dynamic_cast<const ExpAST *>(ast)) return exp->root;
+  if (auto exp = dynamic_cast<const ConstExpAST *>(ast)) return interp_root(exp->exp.get());
+  if (auto exp = dynamic_cast<const ConstInitValAST *>(ast)) return interp_root(exp->c_exp.get());
+  if (auto exp = dynamic_cast<const InitValAST *>(ast)) return interp_root(exp->exp.get());
+  assert(false);
+  return -1;
+}
 
+inline const std::vector<std::unique_ptr<BaseAST>> *init_items(const BaseAST *init)
+{
+  if (auto val = dynamic_cast<const ConstInitValAST *>(init))
+    return val->type == ConstInitValType::list ? &val->list : nullptr;
+  auto val = static_cast<const InitValAST *>(init);
+  return val->type == InitValType::list ? &val->list : nullptr;
+}
 
+inline int array_size(const std::vector<int> &dims, int from = 0)
+{
+  int size = 1;
+  for (int k = from; k < (int)dims.size(); k++) size *= dims[k];
+  return size;
+}
 
+inline std::string array_type(const std::vector<int> &dims)
+{
+  std::string type = "i32";
+  for (int k = dims.size() - 1; k >= 0; k--)
+    type = "[" + type + ", " + std::to_string(dims[k]) + "]";
+  return type;
+}
 
+// 把从 base 开始, 形状为 dims[k..] 的子数组的初始化列表展开到 roots 中
+// 嵌套的列表对齐到当前位置能整除的最大一维, 与 SysY 的规定相同
+inline void flatten_init(const BaseAST *init, const std::vector<int> &dims, int k, int base,
+  std::vector<int> &roots)
+{
+  auto items = init_items(init);
+  if (!items)
+  {
+    roots[base] = interp_root(init);
+    return;
+  }
+  int cur = base, end = base + array_size(dims, k);
+  for (auto&& item : *items)
+  {
+    if (cur >= end) break;
+    if (!init_items(item.get()))
+    {
+      roots[cur++] = interp_root(item.get());
+      continue;
+    }
+    int j = k + 1;
+    while (j < (int)dims.size() && (cur - base) % array_size(dims, j)) j++;
+    flatten_init(item.get(), dims, j, cur, roots);
+    cur += array_size(dims, j);
+  }
+}
+
+// 各元素的初值表达式, 没有给出的元素为 -1, 即 0
+inline std::vector<int> flatten_init(const BaseAST *init, const std::vector<int> &dims)
+{
+  std::vector<int> roots(array_size(dims), -1);
+  flatten_init(init, dims, 0, 0, roots);
+  return roots;
+}
 
+// 全局数组的初值, 全为 0 的子数组写成 zeroinit
+inline std::string aggregate_init(const std::vector<int> &values, const std::vector<int> &dims,
+  int k, int base)
+{
+  if (k == (int)dims.size()) return std::to_string(values[base]);
+  int sub = array_size(dims, k + 1);
+  auto first = values.begin() + base;
+  if (std::all_of(first, first + sub * dims[k], [](int v) { return v == 0; }))
+    return "zeroinit";
+  std::string init = "{";
+  for (int j = 0; j < dims[k]; j++)
+    init += (j ? ", " : "") + aggregate_init(values, dims, k + 1, base + j * sub);
+  return init + "}";
+}
+
+// 局部数组的初始化. 0 较多时先用展开的循环把整个数组清零, 之后只存非零的元素,
+// 初值能在编译期求出的元素直接存立即数. 所有元素的地址都从首元素的指针出发,
+// 后端不在基本块之间保留临时值, 所以循环内外各自重新计算首元素的指针
+const int zero_fill_threshold = 32;
+const int zero_fill_unroll = 16;
+
+inline void dump_local_init(const std::string &name, const std::vector<int> &dims,
+  std::vector<int> roots)
+{
+  int zeros = 0;
+  for (int &root : roots)
+  {
+    if (root >= 0 && expr_pool[root].kind != ExprKind::number)
+    {
+      interp_failed = interp_impure = false;
+      interp_steps = 0;
+      interp_env = nullptr;
+      int value = interp_expr(root);
+      if (!interp_failed) root = expr_node(ExprKind::number, 0, value);
+    }
+    if (root >= 0 && expr_pool[root].kind == ExprKind::number && !expr_pool[root].a) root = -1;
+    zeros += root < 0;
+  }
+  auto first_elem = [&]()
+  {
+    std::string base = name;
+    for (size_t k = 0; k < dims.size(); k++)
+    {
+      std::cout<<" %"<<nowww<<" = getelemptr "<<base<<", 0"<<std::endl;
+      base = "%" + std::to_string(nowww++);
+    }
+    return base;
+  };
+  int filled = 0;
+  if (zeros >= zero_fill_threshold)
+  {
+    filled = roots.size() / zero_fill_unroll * zero_fill_unroll;
+    std::string num = std::to_string(zero_fill_num++);
+    std::string counter = "@zero_i__" + num;
+    std::string loop_label = "\%zero__" + num, end_label = "\%zero_end__" + num;
+    std::cout<<" "<<counter<<" = alloc i32"<<std::endl;
+    std::cout<<" store 0, "<<counter<<std::endl;
+    std::cout<<" jump "<<loop_label<<std::endl;
+    std::cout<<loop_label<<":"<<std::endl;
+    std::string base = first_elem();
+    int index = nowww++;
+    std::cout<<" %"<<index<<" = load "<<counter<<std::endl;
+    int ptr = nowww++;
+    std::cout<<" %"<<ptr<<" = getptr "<<base<<", %"<<index<<std::endl;
+    std::cout<<" store 0, %"<<ptr<<std::endl;
+    for (int j = 1; j < zero_fill_unroll; j++)
+    {
+      std::cout<<" %"<<nowww<<" = getptr %"<<ptr<<", "<<j<<std::endl;
+      std::cout<<" store 0, %"<<nowww++<<std::endl;
+    }
+    std::cout<<" %"<<nowww<<" = add %"<<index<<", "<<zero_fill_unroll<<std::endl;
+    std::cout<<" store %"<<nowww<<", "<<counter<<std::endl;
+    std::cout<<" %"<<nowww+1<<" = lt %"<<nowww<<", "<<filled<<std::endl;
+    std::cout<<" br %"<<nowww+1<<", "<<loop_label<<", "<<end_label<<std::endl;
+    nowww += 2;
+    std::cout<<end_label<<":"<<std::endl;
+  }
+  std::string base;
+  for (int f = 0; f < (int)roots.size(); f++)
+  {
+    if (roots[f] < 0 && f < filled) continue;
+    if (base.empty()) base = first_elem();
+    std::string value = "0";
+    if (roots[f] >= 0 && expr_pool[roots[f]].kind == ExprKind::number)
+      value = std::to_string(expr_pool[roots[f]].a);
+    else if (roots[f] >= 0)
+    {
+      dump_expr(roots[f]);
+      value = "%" + std::to_string(nowww - 1);
+    }
+    std::string ptr = base;
+    if (f)
+    {
+      std::cout<<" %"<<nowww<<" = getptr "<<base<<", "<<f<<std::endl;
+      ptr = "%" + std::to_string(nowww++);
+    }
+    std::cout<<" store "<<value<<", "<<ptr<<std::endl;
+  }
+}
+
+// 定义数组, roots 是展开后各元素的初值表达式, 为空表示没有初值
+inline void dump_array_def(const std::string &ident, const std::vector<int> &dims,
+  const std::vector<int> &roots)
+{
+  var_types[level][ident]=3;
+  symbol_tables[level][ident]=func_num;
+  std::string name = "@"+ident+"_"+std::to_string(func_num)+"_"+std::to_string(level);
+  std::string type = array_type(dims);
+  if(level==0)
+  {
+    if(!global_live(ident))
+    {
+      stat_dead_globals++;
+      return;
+    }
+    std::vector<int> values(array_size(dims), 0);
+    for (size_t f = 0; f < roots.size(); f++)
+      if(roots[f]>=0) values[f] = calc_expr(roots[f]);
+    std::string init = aggregate_init(values, dims, 0, 0);
+    global_inits[ident] = cache_hash(type + "=" + init);
+    std::cout<<" global "<<name<<" = alloc "<<type<<", "<<init<<std::endl;
+    return;
+  }
+  std::cout<<" "<<name<<" = alloc "<<type<<std::endl;
+  if(!roots.empty()) dump_local_init(name, dims, roots);
+}
+
+enum class InterpFlow { normal, break_, continue_, ret };
+
+inline InterpFlow interp_stmt(const BaseAST *ast, int &ret)
+{
+  if (interp_failed || ++interp_steps > interp_step_limit)
+  {
+    interp_fail();
+    return InterpFlow::ret;
+  }
+  if (auto block = dynamic_cast<const BlockAST *>(ast))
+  {
+    interp_env->emplace_back();
+    for (auto&& item : block->block_item_list)
+    {
+      InterpFlow flow = interp_stmt(item.get(), ret);
+      if (flow != InterpFlow::normal)
+      {
+        interp_env->pop_back();
+        return flow;
+      }
+    }
+    interp_env->pop_back();
+    return InterpFlow::normal;
+  }
+  if (auto item = dynamic_cast<const BlockItemAST *>(ast))
+    return interp_stmt(item->content.get(), ret);
+  if (auto decl = dynamic_cast<const DeclAST *>(ast))
+    return interp_stmt(decl->decl.get(), ret);
+  if (auto decl = dynamic_cast<const ConstDeclAST *>(ast))
+  {
+    for (auto&& def : decl->const_def_list)
+    {
+      auto const_def = static_cast<const ConstDefAST *>(def.get());
+      // 局部数组不解释执行
+      if (!const_def->dims.empty())
+      {
+        interp_fail();
+        return InterpFlow::ret;
+      }
+      interp_env->back()[const_def->ident] = interp_expr(interp_root(const_def->c_initval.get()));
+    }
+    return InterpFlow::normal;
+  }
+  if (auto decl = dynamic_cast<const VarDeclAST *>(ast))
+  {
+    for (auto&& def : decl->var_def_list)
+    {
+      auto var_def = static_cast<const VarDefAST *>(def.get());
+      if (!var_def->dims.empty())
+      {
+        interp_fail();
+        return InterpFlow::ret;
+      }
+      std::optional<int> value;
+      if (var_def->ifhavev) value = interp_expr(interp_root(var_def->initval.get()));
+      interp_env->back()[var_def->ident] = value;
+    }
+    return InterpFlow::normal;
+  }
+  if (auto stmt = dynamic_cast<const ComplexStmtAST *>(ast))
+  {
+    if (stmt->type == StmtType::simple) return interp_stmt(stmt->exp.get(), ret);
+    if (stmt->type == StmtType::while_)
+    {
+      while (interp_expr(interp_root(stmt->exp.get())) && !interp_failed)
+      {
+        InterpFlow flow = interp_stmt(stmt->while_stmt.get(), ret);
+        if (flow == InterpFlow::break_) break;
+        if (flow == InterpFlow::ret) return flow;
+      }
+      return InterpFlow::normal;
+    }
+    if (interp_expr(interp_root(stmt->exp.get())))
+      return interp_stmt(stmt->if_stmt.get(), ret);
+    if (stmt->type == StmtType::ifelse)
+      return interp_stmt(stmt->else_stmt.get(), ret);
+    return InterpFlow::normal;
+  }
+  if (auto stmt = dynamic_cast<const StmtAST *>(ast))
+  {
+    switch (stmt->type)
+    {
+      case SimpleStmtType::ret:
+        if (stmt->exp) ret = interp_expr(interp_root(stmt->exp.get()));
+        return InterpFlow::ret;
+      case SimpleStmtType::lval:
+      {
+        int value = interp_expr(interp_root(stmt->exp.get()));
+        std::string ident = stmt->lval->get_ident();
+        bool elem = !static_cast<const LValAST *>(stmt->lval.get())->indices.empty();
+        for (auto it = interp_env->rbegin(); it != interp_env->rend(); ++it)
+        {
+          auto var = it->find(ident);
+          if (var == it->end()) continue;
+          // 写数组形参会改动调用者的数组
+          if (elem) interp_fail(true);
+          var->second = value;
+          return InterpFlow::normal;
+        }
+        // 写全局变量
+        interp_fail(true);
+        return InterpFlow::ret;
+      }
+      case SimpleStmtType::exp:
+        interp_expr(interp_root(stmt->exp.get()));
+        return InterpFlow::normal;
+      case SimpleStmtType::block: return interp_stmt(stmt->block.get(), ret);
+      case SimpleStmtType::break_: return InterpFlow::break_;
+      case SimpleStmtType::continue_: return InterpFlow::continue_;
+      case SimpleStmtType::null: return InterpFlow::normal;
+      default: break;
+    }
+  }
+  interp_fail();
+  return InterpFlow::ret;
+}
+
+inline int interp_call(const std::string &ident, const std::vector<int> &args)
+{
+  auto def_it = func_defs.find(ident);
+  // 库函数有输入输出, 不能在编译期执行
+  if (def_it == func_defs.end() || impure_funcs.count(ident))
+  {
+    interp_fail(true);
+    return 0;
+  }
+  auto memo = fold_memo.find({ident, args});
+  if (memo != fold_memo.end() && memo->second) return *memo->second;
+  if (interp_depth >= interp_depth_limit)
+  {
+    interp_fail();
+    return 0;
+  }
+  auto def = static_cast<const FuncDefAST *>(def_it->second);
+  std::vector<std::map<std::string, std::optional<int>>> env(1);
+  for (size_t i = 0; i < def->params.size(); i++)
+    env[0][def->params[i]->get_ident()] = args[i];
+  auto old_env = interp_env;
+  interp_env = &env;
+  interp_depth++;
+  // 没有执行到 return 时与生成的代码一样返回 0
+  int ret = 0;
+  interp_stmt(def->block.get(), ret);
+  interp_depth--;
+  interp_env = old_env;
+  if (interp_failed)
+  {
+    if (interp_impure) impure_funcs.insert(ident);
+    return 0;
+  }
+  fold_memo[{ident, args}] = ret;
+  return ret;
+}
+
+// 实参都是编译期常量且被调函数是纯函数时, 在编译期求出调用的结果
+inline bool fold_call(const ExprNode &e, int &value)
+{
+  const std::string &ident = expr_idents[e.a];
+  if (!func_defs.count(ident) || impure_funcs.count(ident)) return false;
+  auto def = static_cast<const FuncDefAST *>(func_defs[ident]);
+  if (def->func_type != "int" || (int)def->params.size() != e.c) return false;
+  interp_failed = interp_impure = false;
+  interp_steps = 0;
+  interp_env = nullptr;
+  std::vector<int> args;
+  for (int i = 0; i < e.c && !interp_failed; i++)
+    args.push_back(interp_expr(expr_args[e.b + i]));
+  if (interp_failed) return false;
+  auto memo = fold_memo.find({ident, args});
+  if (memo != fold_memo.end())
+  {
+    if (memo->second) value = *memo->second;
+    return memo->second.has_value();
+  }
+  interp_steps = 0;
+  value = interp_call(ident, args);
+  // 失败的结果也记下来, 相同的调用不再重复尝试
+  if (interp_failed) fold_memo[{ident, args}] = std::nullopt;
+  return !interp_failed;
+}
+
+// 以编译期常量为下标读常量数组
+inline bool fold_elem(int id, int &value)
+{
+  const std::string &ident = expr_idents[expr_pool[id].a];
+  int i = find_level(ident);
+  if (i < 0 || var_types[i][ident] != 3 || array_tables[i][ident].values.empty()) return false;
+  interp_failed = interp_impure = false;
+  interp_steps = 0;
+  interp_env = nullptr;
+  value = interp_expr(id);
+  return !interp_failed;
+}
+
+// 过程间常量传播与死参数/死返回值消除
+// 在生成代码之前遍历整个程序, 收集每个函数的所有调用点. main 之外的函数
+// 只要所有调用点都在程序中可见, 就可以按调用点的情况改写签名
+struct CallSite
+{
+  int node;
+  std::string caller;
+  bool in_loop;
+  bool value_used;
+  std::vector<std::optional<int>> args = {};   // 编译期可以求出的实参值
+  std::vector<bool> pure_args = {};            // 实参中没有函数调用, 不求值也没有影响
+};
+inline std::map<std::string, std::vector<CallSite>> call_sites;
+inline std::map<std::string, std::set<std::string>> assigned_idents;
+inline std::vector<std::map<std::string, std::optional<int>>> plan_scopes;
+inline std::string plan_caller;
+const int clone_limit_per_func = 4;
+const int clone_limit = 16;
+const int clone_size_limit = 4000;     // 只特化指纹不超过这个长度的小函数
+
+inline std::optional<int> plan_eval(int root)
+{
+  interp_failed = interp_impure = false;
+  interp_steps = 0;
+  interp_env = &plan_scopes;
+  int value = interp_expr(root);
+  interp_env = nullptr;
+  if (interp_failed) return std::nullopt;
+  return value;
+}
+
+inline bool expr_has_call(int root)
+{
+  std::vector<int> stack{root};
+  while (!stack.empty())
+  {
+    const ExprNode &e = expr_pool[stack.back()];
+    stack.pop_back();
+    if (e.kind == ExprKind::call) return true;
+    for (int k = 0, child; (child = expr_child(e, k)) >= 0; k++) stack.push_back(child);
+  }
+  return false;
+}
+
+// 记录表达式中对用户函数的调用, 作为表达式语句的根时调用结果没有被使用
+inline void plan_expr(int root, bool stmt_root, bool in_loop)
+{
+  std::vector<int> stack{root};
+  while (!stack.empty())
+  {
+    int id = stack.back();
+    stack.pop_back();
+    const ExprNode &e = expr_pool[id];
+    for (int k = 0, child; (child = expr_child(e, k)) >= 0; k++) stack.push_back(child);
+    if (e.kind != ExprKind::call) continue;
+    // 传给函数的全局数组可能被改写
+    for (int i = 0; i < e.c; i++)
+    {
+      const ExprNode &arg = expr_pool[expr_args[e.b + i]];
+      if (arg.kind == ExprKind::lval && var_types[0].count(expr_idents[arg.a]) &&
+        var_types[0][expr_idents[arg.a]] == 3)
+        assigned_idents[plan_caller].insert(expr_idents[arg.a]);
+    }
+    if (!func_defs.count(expr_idents[e.a])) continue;
+    CallSite site{id, plan_caller, in_loop, !(stmt_root && id == root)};
+    for (int i = 0; i < e.c; i++)
+    {
+      int arg = expr_args[e.b + i];
+      bool pure = !expr_has_call(arg);
+      site.pure_args.push_back(pure);
+      site.args.push_back(pure ? plan_eval(arg) : std::nullopt);
+    }
+    call_sites[expr_idents[e.a]].push_back(std::move(site));
+  }
+}
+
+// 初始化列表中的每个表达式
+inline void plan_init(const BaseAST *init, bool in_loop)
+{
+  auto items = init_items(init);
+  if (!items) plan_expr(interp_root(init), false, in_loop);
+  else for (auto&& item : *items) plan_init(item.get(), in_loop);
+}
+
+inline void plan_stmt(const BaseAST *ast, bool in_loop)
+{
+  if (!ast) return;
+  if (auto block = dynamic_cast<const BlockAST *>(ast))
+  {
+    plan_scopes.emplace_back();
+    for (auto&& item : block->block_item_list) plan_stmt(item.get(), in_loop);
+    plan_scopes.pop_back();
+  }
+  else if (auto item = dynamic_cast<const BlockItemAST *>(ast))
+    plan_stmt(item->content.get(), in_loop);
+  else if (auto decl = dynamic_cast<const DeclAST *>(ast))
+    plan_stmt(decl->decl.get(), in_loop);
+  else if (auto decl = dynamic_cast<const ConstDeclAST *>(ast))
+    for (auto&& def : decl->const_def_list)
+    {
+      auto const_def = static_cast<const ConstDefAST *>(def.get());
+      if (!const_def->dims.empty())
+      {
+        plan_scopes.back()[const_def->ident] = std::nullopt;
+        continue;
+      }
+      int root = interp_root(const_def->c_initval.get());
+      plan_expr(root, false, in_loop);
+      plan_scopes.back()[const_def->ident] = plan_eval(root);
+    }
+  else if (auto decl = dynamic_cast<const VarDeclAST *>(ast))
+    for (auto&& def : decl->var_def_list)
+    {
+      auto var_def = static_cast<const VarDefAST *>(def.get());
+      if (var_def->ifhavev) plan_init(var_def->initval.get(), in_loop);
+      plan_scopes.back()[var_def->ident] = std::nullopt;
+    }
+  else if (auto stmt = dynamic_cast<const ComplexStmtAST *>(ast))
+  {
+    if (stmt->type == StmtType::simple)
+    {
+      plan_stmt(stmt->exp.get(), in_loop);
+      return;
+    }
+    bool loop = in_loop || stmt->type == StmtType::while_;
+    plan_expr(interp_root(stmt->exp.get()), false, loop);
+    plan_stmt(stmt->if_stmt.get(), in_loop);
+    plan_stmt(stmt->else_stmt.get(), in_loop);
+    plan_stmt(stmt->while_stmt.get(), loop);
+  }
+  else if (auto stmt = dynamic_cast<const StmtAST *>(ast))
+  {
+    if (stmt->type == SimpleStmtType::lval)
+      assigned_idents[plan_caller].insert(stmt->lval->get_ident());
+    if (stmt->exp)
+      plan_expr(interp_root(stmt->exp.get()), stmt->type == SimpleStmtType::exp, in_loop);
+    // 被赋值的数组元素的下标与右值一样求值, 其中的调用同样要记录
+    if (stmt->type == SimpleStmtType::lval)
+      for (int index : static_cast<const LValAST *>(stmt->lval.get())->indices)
+        plan_expr(index, false, in_loop);
+    plan_stmt(stmt->block.get(), in_loop);
+  }
+}
+
+inline void plan_functions(const std::vector<std::unique_ptr<BaseAST>> &func_def_list,
+  const std::vector<std::unique_ptr<BaseAST>> &decl_list)
+{
+  plan_scopes.assign(1, {});
+  for (auto&& decl : decl_list) plan_stmt(decl.get(), false);
+  for (auto&& func_def : func_def_list)
+  {
+    auto def = static_cast<const FuncDefAST *>(func_def.get());
+    // 不可达函数中的调用点不影响被调函数的改写
+    if (!func_reachable(def->ident)) continue;
+    plan_caller = def->ident;
+    plan_scopes.assign(1, {});
+    for (auto&& param : def->params) plan_scopes[0][param->get_ident()] = std::nullopt;
+    plan_stmt(def->block.get(), false);
+  }
+  plan_scopes.clear();
+
+  int clones = 0;
+  for (auto&& func_def : func_def_list)
+  {
+    auto def = static_cast<const FuncDefAST *>(func_def.get());
+    auto &sites = call_sites[def->ident];
+    if (def->ident == "main" || sites.empty()) continue;
+    int n = def->params.size();
+    bool arity_ok = true;
+    for (auto&& site : sites) arity_ok &= (int)site.args.size() == n;
+    if (!arity_ok) continue;
+    fingerprint_refs.clear();
+    std::string fp;
+    def->Fingerprint(fp);
+    auto &assigned = assigned_idents[def->ident];
+
+    FuncPlan plan{def->ident, std::vector<ParamPlan>(n), def->func_type == "int"};
+    bool changed = false;
+    for (int i = 0; i < n; i++)
+    {
+      std::string ident = def->params[i]->get_ident();
+      bool pure = true, same = true;
+      for (auto&& site : sites)
+      {
+        pure &= site.pure_args[i];
+        same &= site.args[i].has_value() && *site.args[i] == *sites[0].args[i];
+      }
+      if (!pure) continue;
+      if (!fingerprint_refs.count(ident)) plan.params[i].kind = ParamKind::drop;
+      else if (same) plan.params[i] = {ParamKind::constant, *sites[0].args[i], (bool)assigned.count(ident)};
+      changed |= plan.params[i].kind != ParamKind::pass;
+    }
+    for (auto&& site : sites) plan.drop_ret &= !site.value_used;
+    changed |= plan.drop_ret;
+
+    // 循环中以常量实参调用的小函数按实参的组合特化, 出现次数多的组合优先
+    // 有 profile 时改为看函数 (连同上次生成的副本) 实际被调用的次数,
+    // 调用次数超过调用点个数说明有调用点被反复执行, 相当于在循环中
+    long long calls = -1;
+    if (!profile_counts.empty())
+    {
+      calls = std::max(profile_count(def->ident, "%entry"), 0ll);
+      for (int k = 0; k < clone_limit_per_func; k++)
+        calls += std::max(profile_count(def->ident + "_spec" + std::to_string(k), "%entry"), 0ll);
+    }
+    std::map<std::vector<std::optional<int>>, int> counts;
+    std::vector<std::vector<std::optional<int>>> site_keys(sites.size());
+    if (fp.size() <= clone_size_limit)
+      for (size_t s = 0; s < sites.size(); s++)
+      {
+        if (calls >= 0 ? calls <= (long long)sites.size() : !sites[s].in_loop) continue;
+        if (sites[s].caller == def->ident) continue;
+        std::vector<std::optional<int>> key(n);
+        bool any = false;
+        for (int i = 0; i < n; i++)
+          if (plan.params[i].kind == ParamKind::pass &&
+            fingerprint_refs.count(def->params[i]->get_ident()) && sites[s].args[i])
+          {
+            key[i] = sites[s].args[i];
+            any = true;
+          }
+        if (!any) continue;
+        site_keys[s] = key;
+        counts[key]++;
+      }
+    std::vector<std::pair<int, std::vector<std::optional<int>>>> order;
+    for (auto&& entry : counts) order.push_back({-entry.second, entry.first});
+    std::sort(order.begin(), order.end());
+    std::map<std::vector<std::optional<int>>, int> chosen;
+    for (auto&& entry : order)
+    {
+      if (chosen.size() >= clone_limit_per_func || clones >= clone_limit) break;
+      FuncPlan clone = plan;
+      std::string name;
+      for (int k = 0; name.empty() || func_defs.count(name) || function_table.count(name); k++)
+        name = def->ident + "_spec" + std::to_string(k);
+      // 同名检查要看到之前生成的副本
+      function_table[name] = "@" + name;
+      clone.name = name;
+      for (int i = 0; i < n; i++)
+        if (entry.second[i])
+          clone.params[i] = {ParamKind::constant, *entry.second[i],
+            (bool)assigned.count(def->params[i]->get_ident())};
+      chosen[entry.second] = func_clones[def->ident].size();
+      func_clones[def->ident].push_back(std::move(clone));
+      clones++;
+    }
+
+    if (changed) func_plans[def->ident] = plan;
+    for (size_t s = 0; s < sites.size(); s++)
+    {
+      const FuncPlan *target = changed ? &func_plans[def->ident] : nullptr;
+      auto it = site_keys[s].empty() ? chosen.end() : chosen.find(site_keys[s]);
+      if (it != chosen.end()) target = &func_clones[def->ident][it->second];
+      if (!target) continue;
+      CallPlan call{target->name};
+      for (int i = 0; i < n; i++)
+        if (target->params[i].kind == ParamKind::pass) call.args.push_back(i);
+      call_plans[sites[s].node] = std::move(call);
+    }
+  }
+  for (auto&& func : assigned_idents)
+    assigned_anywhere.insert(func.second.begin(), func.second.end());
+  call_sites.clear();
+  assigned_idents.clear();
+}
+
+// 在原函数之后输出它的特化副本
+inline void dump_func_clones(const BaseAST *func_def)
+{
+  auto def = static_cast<const FuncDefAST *>(func_def);
+  auto it = func_clones.find(def->ident);
+  if (it == func_clones.end()) return;
+  for (auto&& clone : it->second)
+  {
+    dump_plan = &clone;
+    def->Dump();
+    dump_plan = nullptr;
+  }
+}
+
+// 函数签名的改写方案, 加入缓存的键
+inline std::string plan_descriptor(const std::string &ident)
+{
+  std::string desc;
+  auto describe = [&](const FuncPlan &plan)
+  {
+    desc += plan.name + (plan.drop_ret ? "!(" : "(");
+    for (auto&& param : plan.params)
+      desc += std::to_string((int)param.kind) + ":" + std::to_string(param.value) +
+        (param.assigned ? "=," : ",");
+    desc += ")";
+  };
+  auto it = func_plans.find(ident);
+  if (it != func_plans.end()) describe(it->second);
+  auto clones = func_clones.find(ident);
+  if (clones != func_clones.end())
+    for (auto&& clone : clones->second) describe(clone);
+  return desc;
+}
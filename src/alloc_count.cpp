@@ -0,0 +1,39 @@
+// 替换全局 operator new/delete, 统计动态内存分配次数
+// 单独放在一个编译单元: 其余代码看不到这里的 malloc/free, new 与 delete
+// 始终成对出现, 不会被内联成 malloc 后与 delete 配对 (-Wmismatched-new-delete)
+#include <cstdlib>
+#include <new>
+
+#include "stats.hpp"
+
+static void *counted_alloc(std::size_t size)
+{
+  if (count_allocs) ++stat_allocs;
+  if (void *ptr = std::malloc(size ? size : 1)) return ptr;
+  throw std::bad_alloc();
+}
+
+static void *counted_alloc(std::size_t size, std::align_val_t align)
+{
+  if (count_allocs) ++stat_allocs;
+  // aligned_alloc 要求大小是对齐的整数倍
+  std::size_t alignment = static_cast<std::size_t>(align);
+  std::size_t bytes = size ? (size + alignment - 1) / alignment * alignment : alignment;
+  if (void *ptr = std::aligned_alloc(alignment, bytes)) return ptr;
+  throw std::bad_alloc();
+}
+
+// nothrow 版本由标准库转发到下面的函数, 不必另外替换
+void *operator new(std::size_t size) { return counted_alloc(size); }
+void *operator new[](std::size_t size) { return counted_alloc(size); }
+void *operator new(std::size_t size, std::align_val_t align) { return counted_alloc(size, align); }
+void *operator new[](std::size_t size, std::align_val_t align) { return counted_alloc(size, align); }
+
+void operator delete(void *ptr) noexcept { std::free(ptr); }
+void operator delete[](void *ptr) noexcept { std::free(ptr); }
+void operator delete(void *ptr, std::size_t) noexcept { std::free(ptr); }
+void operator delete[](void *ptr, std::size_t) noexcept { std::free(ptr); }
+void operator delete(void *ptr, std::align_val_t) noexcept { std::free(ptr); }
+void operator delete[](void *ptr, std::align_val_t) noexcept { std::free(ptr); }
+void operator delete(void *ptr, std::size_t, std::align_val_t) noexcept { std::free(ptr); }
+void operator delete[](void *ptr, std::size_t, std::align_val_t) noexcept { std::free(ptr); }
@@ -0,0 +1,96 @@
+#pragma once
+#include <string>
+#include <map>
+#include <vector>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include <filesystem>
+#include <cstdint>
+#include <cstdio>
+#include <unistd.h>
+
+// 按函数划分的磁盘编译缓存
+// 键由函数子树的指纹, 函数引用到的全局声明/函数签名以及编译选项共同决定,
+// 每个键对应 <键>.koopa (Koopa IR) 和 <键>.S (RISC-V 汇编) 两个文件,
+// 命中时更新文件修改时间, 超出容量时按修改时间淘汰最久未用的条目 (LRU)
+
+inline std::string cache_dir;              // 为空表示不启用缓存
+inline size_t cache_capacity = 4096;       // 缓存目录中最多保留的文件数
+inline std::string cache_flags;            // 影响生成代码的编译选项, 参与键的计算
+inline bool cache_riscv = false;           // 本次编译是否生成 RISC-V
+inline std::map<std::string, std::string> cache_keys;   // 函数名 -> 键
+inline std::map<std::string, std::string> cached_asm;   // 命中汇编缓存的函数名 -> 汇编
+
+inline std::string cache_hash(const std::string &text)
+{
+  // 两路独立的 64 位散列拼成 128 位, 避免误命中
+  uint64_t h1 = 14695981039346656037ull, h2 = 0x9e3779b97f4a7c15ull;
+  for (unsigned char c : text)
+  {
+    h1 = (h1 ^ c) * 1099511628211ull;
+    h2 = (h2 + c) * 0xff51afd7ed558ccdull;
+    h2 ^= h2 >> 29;
+  }
+  char buf[33];
+  snprintf(buf, sizeof(buf), "%016llx%016llx", (unsigned long long)h1,
+    (unsigned long long)h2);
+  return buf;
+}
+
+inline bool cache_open(const std::string &dir)
+{
+  std::error_code ec;
+  std::filesystem::create_directories(dir, ec);
+  if (!std::filesystem::is_directory(dir, ec)) return false;
+  cache_dir = dir;
+  return true;
+}
+
+inline std::string cache_path(const std::string &key, const char *ext)
+{
+  return cache_dir + "/" + key + ext;
+}
+
+inline bool cache_load(const std::string &key, const char *ext, std::string &text)
+{
+  std::string path = cache_path(key, ext);
+  std::ifstream in(path, std::ios::binary);
+  if (!in) return false;
+  std::ostringstream buf;
+  buf << in.rdbuf();
+  text = buf.str();
+  std::error_code ec;
+  std::filesystem::last_write_time(path,
+    std::filesystem::file_time_type::clock::now(), ec);
+  return true;
+}
+
+inline void cache_store(const std::string &key, const char *ext, const std::string &text)
+{
+  // 先写临时文件再改名, 并发编译时不会读到写了一半的条目
+  std::string path = cache_path(key, ext);
+  std::string tmp = path + ".tmp" + std::to_string(getpid());
+  {
+    std::ofstream out(tmp, std::ios::binary);
+    out << text;
+    if (!out) return;
+  }
+  std::error_code ec;
+  std::filesystem::rename(tmp, path, ec);
+  if (ec) std::filesystem::remove(tmp, ec);
+}
+
+inline void cache_evict()
+{
+  namespace fs = std::filesystem;
+  std::error_code ec;
+  std::vector<std::pair<fs::file_time_type, fs::path>> entries;
+  for (auto &entry : fs::directory_iterator(cache_dir, ec))
+    if (entry.is_regular_file(ec))
+      entries.push_back({entry.last_write_time(ec), entry.path()});
+  if (entries.size() <= cache_capacity) return;
+  std::sort(entries.begin(), entries.end());
+  for (size_t i = 0; i < entries.size() - cache_capacity; i++)
+    fs::remove(entries[i].second, ec);
+}
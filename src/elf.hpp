@@ -0,0 +1,1063 @@
+#pragma once
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <iostream>
+#include <map>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+#include "sched.hpp"
+#include "rvc.hpp"
+
+// 直接生成 ELF 目标文件
+// -emit-obj 时后端产生的汇编留在内存里, 由这里编码成 RV32IM 机器码, 写出带 .text, .data,
+// .rodata, .bss 段, 符号表和重定位的 ELF32 可重定位文件, 不再经过外部汇编器
+// 本文件内的跳转和分支直接回填偏移, 超出 ±4KiB 的条件分支改写成反向分支加 jal;
+// call 生成 R_RISCV_CALL_PLT, la 生成 R_RISCV_PCREL_HI20 与 R_RISCV_PCREL_LO12_I,
+// 目标不在本文件中的跳转和分支生成 R_RISCV_JAL 与 R_RISCV_BRANCH,
+// 数据段中以标号为值的 .word (跳转表) 生成 R_RISCV_32
+// -march=rv32imc 时 c.* 指令编码为 16 位, 本文件内目标够近的 j, beqz, bnez 也压缩,
+// ELF 头的 e_flags 置上 EF_RISCV_RVC
+// -verify-obj 用内置的解码器反汇编生成的目标文件, 与汇编文本逐条比较
+
+inline bool emit_obj = false;     // -emit-obj
+inline bool verify_obj = false;   // -verify-obj
+
+enum ObjSection { OBJ_TEXT, OBJ_DATA, OBJ_RODATA, OBJ_BSS, OBJ_SECTIONS };
+
+enum ObjRelocType
+{
+  R_RISCV_32 = 1,
+  R_RISCV_BRANCH = 16,
+  R_RISCV_JAL = 17,
+  R_RISCV_CALL_PLT = 19,
+  R_RISCV_PCREL_HI20 = 23,
+  R_RISCV_PCREL_LO12_I = 24,
+};
+
+inline const char *obj_reg_names[32] = {"x0", "ra", "sp", "gp", "tp", "t0", "t1", "t2",
+  "s0", "s1", "a0", "a1", "a2", "a3", "a4", "a5", "a6", "a7", "s2", "s3", "s4", "s5",
+  "s6", "s7", "s8", "s9", "s10", "s11", "t3", "t4", "t5", "t6"};
+
+// 解析十进制或十六进制整数, 格式不对时 ok 置为 false
+inline long obj_int(std::string_view s, bool &ok)
+{
+  bool neg = !s.empty() && s[0] == '-';
+  if (neg || (!s.empty() && s[0] == '+')) s.remove_prefix(1);
+  int base = 10;
+  if (s.size() > 2 && s[0] == '0' && (s[1] == 'x' || s[1] == 'X'))
+  {
+    base = 16;
+    s.remove_prefix(2);
+  }
+  if (s.empty()) ok = false;
+  long value = 0;
+  for (char c : s)
+  {
+    int digit = c >= '0' && c <= '9' ? c - '0' : c >= 'a' && c <= 'f' ? c - 'a' + 10 :
+      c >= 'A' && c <= 'F' ? c - 'A' + 10 : 99;
+    if (digit >= base)
+    {
+      ok = false;
+      return 0;
+    }
+    value = value * base + digit;
+  }
+  return neg ? -value : value;
+}
+
+inline bool obj_fits(long value, int bits)
+{
+  return value >= -(1L << (bits - 1)) && value < (1L << (bits - 1));
+}
+
+// 各种指令格式的编码
+inline uint32_t obj_r(int f7, int rs2, int rs1, int f3, int rd, int opcode)
+{
+  return f7 << 25 | rs2 << 20 | rs1 << 15 | f3 << 12 | rd << 7 | opcode;
+}
+
+inline uint32_t obj_i(int imm, int rs1, int f3, int rd, int opcode)
+{
+  return (uint32_t)(imm & 0xfff) << 20 | rs1 << 15 | f3 << 12 | rd << 7 | opcode;
+}
+
+inline uint32_t obj_s(int imm, int rs2, int rs1, int f3, int opcode)
+{
+  return (uint32_t)(imm >> 5 & 0x7f) << 25 | rs2 << 20 | rs1 << 15 | f3 << 12 |
+    (imm & 0x1f) << 7 | opcode;
+}
+
+inline uint32_t obj_b(int imm, int rs2, int rs1, int f3)
+{
+  return (uint32_t)(imm >> 12 & 1) << 31 | (imm >> 5 & 0x3f) << 25 | rs2 << 20 |
+    rs1 << 15 | f3 << 12 | (imm >> 1 & 0xf) << 8 | (imm >> 11 & 1) << 7 | 0x63;
+}
+
+inline uint32_t obj_u(int imm20, int rd, int opcode)
+{
+  return (uint32_t)(imm20 & 0xfffff) << 12 | rd << 7 | opcode;
+}
+
+inline uint32_t obj_j(int imm, int rd)
+{
+  return (uint32_t)(imm >> 20 & 1) << 31 | (imm >> 1 & 0x3ff) << 21 |
+    (imm >> 11 & 1) << 20 | (imm >> 12 & 0xff) << 12 | rd << 7 | 0x6f;
+}
+
+// 把 32 位常数拆成 lui 的高 20 位和 addi 的低 12 位
+inline void obj_split(long value, int &hi, int &lo)
+{
+  lo = (int)((value & 0xfff) ^ 0x800) - 0x800;
+  hi = (int)(((uint32_t)value - (uint32_t)lo) >> 12 & 0xfffff);
+}
+
+// R 型运算的 funct7 和 funct3, 不是 R 型时返回 false
+inline bool obj_r_op(std::string_view op, int &f7, int &f3)
+{
+  static const std::pair<const char *, int> ops[] = {{"add", 0x000}, {"sub", 0x200},
+    {"sll", 0x001}, {"slt", 0x002}, {"sltu", 0x003}, {"xor", 0x004}, {"srl", 0x005},
+    {"sra", 0x205}, {"or", 0x006}, {"and", 0x007}, {"mul", 0x010}, {"mulh", 0x011},
+    {"mulhsu", 0x012}, {"mulhu", 0x013}, {"div", 0x014}, {"divu", 0x015},
+    {"rem", 0x016}, {"remu", 0x017}};
+  for (auto &entry : ops)
+    if (op == entry.first)
+    {
+      f7 = entry.second >> 4;
+      f3 = entry.second & 7;
+      return true;
+    }
+  return false;
+}
+
+// I 型运算的 funct3, 移位指令的高位放在 f7 中
+inline bool obj_i_op(std::string_view op, int &f3, int &f7)
+{
+  static const std::pair<const char *, int> ops[] = {{"addi", 0x000}, {"slti", 0x002},
+    {"sltiu", 0x003}, {"xori", 0x004}, {"ori", 0x006}, {"andi", 0x007},
+    {"slli", 0x001}, {"srli", 0x005}, {"srai", 0x205}};
+  for (auto &entry : ops)
+    if (op == entry.first)
+    {
+      f7 = entry.second >> 4;
+      f3 = entry.second & 7;
+      return true;
+    }
+  return false;
+}
+
+// 条件分支的 funct3, swap 表示 bgt/ble 这类需要交换操作数的伪指令
+inline bool obj_branch_op(std::string_view op, int &f3, bool &swap, bool &zero)
+{
+  static const std::pair<const char *, int> ops[] = {{"beq", 0}, {"bne", 1}, {"blt", 4},
+    {"bge", 5}, {"bltu", 6}, {"bgeu", 7}, {"bgt", 0x14}, {"ble", 0x15}, {"bgtu", 0x16},
+    {"bleu", 0x17}, {"beqz", 0x20}, {"bnez", 0x21}, {"bltz", 0x24}, {"bgez", 0x25}};
+  for (auto &entry : ops)
+    if (op == entry.first)
+    {
+      f3 = entry.second & 7;
+      swap = entry.second & 0x10;
+      zero = entry.second & 0x20;
+      return true;
+    }
+  return false;
+}
+
+// imm 的第 hi 到 lo 位放到从 at 开始的位置
+inline uint32_t obj_bits(long imm, int hi, int lo, int at)
+{
+  return (uint32_t)(imm >> lo & ((1 << (hi - lo + 1)) - 1)) << at;
+}
+
+// 16 位压缩指令的编码, rd 是第一个寄存器, rs 是第二个寄存器或访存的基址,
+// 操作数超出压缩指令的限制时返回 false
+inline bool obj_rvc(std::string_view op, int rd, int rs, long imm, uint32_t &half)
+{
+  bool c_rd = rvc_reg(rd), c_rs = rvc_reg(rs), small = imm >= -32 && imm < 32;
+  int rd3 = (rd - 8) & 7, rs3 = (rs - 8) & 7;
+  if (op == "c.addi4spn" && c_rd && rs == 2 && imm > 0 && imm < 1024 && imm % 4 == 0)
+    half = obj_bits(imm, 5, 4, 11) | obj_bits(imm, 9, 6, 7) | obj_bits(imm, 2, 2, 6) |
+      obj_bits(imm, 3, 3, 5) | rd3 << 2;
+  else if ((op == "c.lw" || op == "c.sw") && c_rd && c_rs && imm >= 0 && imm < 128 &&
+    imm % 4 == 0)
+    half = (op == "c.lw" ? 2 : 6) << 13 | obj_bits(imm, 5, 3, 10) | rs3 << 7 |
+      obj_bits(imm, 2, 2, 6) | obj_bits(imm, 6, 6, 5) | rd3 << 2;
+  else if ((op == "c.addi" || op == "c.li") && rd > 0 && rs < 0 && small &&
+    (op == "c.li" || imm))
+    half = (op == "c.li" ? 2 : 0) << 13 | obj_bits(imm, 5, 5, 12) | rd << 7 |
+      obj_bits(imm, 4, 0, 2) | 1;
+  else if (op == "c.addi16sp" && rd == 2 && imm && imm % 16 == 0 && imm >= -512 && imm < 512)
+    half = 3 << 13 | obj_bits(imm, 9, 9, 12) | 2 << 7 | obj_bits(imm, 4, 4, 6) |
+      obj_bits(imm, 6, 6, 5) | obj_bits(imm, 8, 7, 3) | obj_bits(imm, 5, 5, 2) | 1;
+  else if ((op == "c.srli" || op == "c.srai") && c_rd && imm > 0 && imm < 32)
+    half = 4 << 13 | (op == "c.srai") << 10 | rd3 << 7 | obj_bits(imm, 4, 0, 2) | 1;
+  else if (op == "c.andi" && c_rd && rs < 0 && small)
+    half = 4 << 13 | obj_bits(imm, 5, 5, 12) | 2 << 10 | rd3 << 7 | obj_bits(imm, 4, 0, 2) | 1;
+  else if ((op == "c.sub" || op == "c.xor" || op == "c.or" || op == "c.and") && c_rd && c_rs)
+    half = 4 << 13 | 3 << 10 | rd3 << 7 |
+      (op == "c.sub" ? 0 : op == "c.xor" ? 1 : op == "c.or" ? 2 : 3) << 5 | rs3 << 2 | 1;
+  else if (op == "c.j" && imm % 2 == 0 && obj_fits(imm, 12))
+    half = 5 << 13 | obj_bits(imm, 11, 11, 12) | obj_bits(imm, 4, 4, 11) |
+      obj_bits(imm, 9, 8, 9) | obj_bits(imm, 10, 10, 8) | obj_bits(imm, 6, 6, 7) |
+      obj_bits(imm, 7, 7, 6) | obj_bits(imm, 3, 1, 3) | obj_bits(imm, 5, 5, 2) | 1;
+  else if ((op == "c.beqz" || op == "c.bnez") && c_rd && imm % 2 == 0 && obj_fits(imm, 9))
+    half = (op == "c.beqz" ? 6 : 7) << 13 | obj_bits(imm, 8, 8, 12) |
+      obj_bits(imm, 4, 3, 10) | rd3 << 7 | obj_bits(imm, 7, 6, 5) | obj_bits(imm, 2, 1, 3) |
+      obj_bits(imm, 5, 5, 2) | 1;
+  else if (op == "c.slli" && rd > 0 && imm > 0 && imm < 32)
+    half = rd << 7 | obj_bits(imm, 4, 0, 2) | 2;
+  else if (op == "c.lwsp" && rd > 0 && rs == 2 && imm >= 0 && imm < 256 && imm % 4 == 0)
+    half = 2 << 13 | obj_bits(imm, 5, 5, 12) | rd << 7 | obj_bits(imm, 4, 2, 4) |
+      obj_bits(imm, 7, 6, 2) | 2;
+  else if (op == "c.swsp" && rd >= 0 && rs == 2 && imm >= 0 && imm < 256 && imm % 4 == 0)
+    half = 6 << 13 | obj_bits(imm, 5, 2, 9) | obj_bits(imm, 7, 6, 7) | rd << 2 | 2;
+  else if (op == "c.jr" && rd > 0 && rs < 0) half = 4 << 13 | rd << 7 | 2;
+  else if ((op == "c.mv" || op == "c.add") && rd > 0 && rs > 0)
+    half = 4 << 13 | (op == "c.add") << 12 | rd << 7 | rs << 2 | 2;
+  else return false;
+  return true;
+}
+
+// 汇编文本到 ELF 的转换
+class ObjAssembler
+{
+ public:
+  // 汇编整个文本, 出错时在标准错误输出原因并返回 false
+  bool assemble(std::string_view text)
+  {
+    if (!parse(text)) return false;
+    layout();
+    return encode();
+  }
+
+  std::string elf() const;
+
+ private:
+  // 只保存行的位置, 操作数在用到时再拆分, 大程序的汇编也只占很少的额外内存
+  struct Line
+  {
+    std::string_view text;        // 去掉首尾空白的一行, 标号不含冒号
+    uint32_t offset, size;        // 段内偏移和编码后的字节数
+    int number;                   // 行号
+    int symbol;                   // 标号对应的符号
+    int section;
+    char kind;                    // 'i' 指令, 'l' 标号, 'w' .word, 'z' .zero
+  };
+  struct Symbol
+  {
+    std::string_view name;
+    int section = -1;             // -1 表示未定义
+    uint32_t value = 0;
+    bool global = false;
+  };
+  struct Reloc
+  {
+    uint32_t offset;
+    int symbol, type;
+    int32_t addend;
+    int section = OBJ_TEXT;       // 被修改的段
+  };
+
+  std::vector<Line> lines;
+  std::vector<Symbol> symbols;
+  std::unordered_map<std::string_view, int> symbol_index;
+  std::deque<std::string> pcrel_names;
+  std::string data[OBJ_SECTIONS];
+  uint32_t section_size[OBJ_SECTIONS] = {0};
+  std::vector<Reloc> relocs;
+
+  // 名字指向汇编文本, 文本在生成 ELF 之前必须保持有效
+  int symbol(std::string_view name)
+  {
+    auto found = symbol_index.emplace(name, symbols.size());
+    if (found.second) symbols.push_back({name});
+    return found.first->second;
+  }
+
+  // 拆出操作码和最多三个操作数, 返回操作数个数
+  static int split(std::string_view line, std::string_view &op, std::string_view *args)
+  {
+    size_t op_end = line.find_first_of(" \t");
+    op = line.substr(0, op_end);
+    std::string_view rest = op_end == std::string_view::npos ? "" : line.substr(op_end);
+    int argc = 0;
+    while (!sched_trim(rest).empty() && argc < 3)
+    {
+      size_t comma = rest.find(',');
+      args[argc++] = sched_trim(rest.substr(0, comma));
+      rest.remove_prefix(comma == std::string_view::npos ? rest.size() : comma + 1);
+    }
+    return argc;
+  }
+
+  bool error(const Line &line, const char *what)
+  {
+    std::cerr << "error: line " << line.number << ": " << what << ": " << line.text <<
+      std::endl;
+    return false;
+  }
+
+  bool parse(std::string_view text);
+  void layout();
+  bool encode();
+  void put(std::string &out, uint32_t word)
+  {
+    for (int i = 0; i < 4; i++) out += (char)(word >> 8 * i);
+  }
+  void put16(std::string &out, uint32_t half)
+  {
+    out += (char)half;
+    out += (char)(half >> 8);
+  }
+};
+
+inline bool ObjAssembler::parse(std::string_view text)
+{
+  int section = OBJ_TEXT, number = 0;
+  while (!text.empty())
+  {
+    size_t end = text.find('\n');
+    std::string_view line = sched_trim(text.substr(0, end));
+    text.remove_prefix(end == std::string_view::npos ? text.size() : end + 1);
+    number++;
+    if (line.empty()) continue;
+    Line item = {line, 0, 0, number, -1, section, 'i'};
+    if (line.back() == ':')
+    {
+      item.kind = 'l';
+      item.text = line.substr(0, line.size() - 1);
+      item.symbol = symbol(item.text);
+      lines.push_back(item);
+      continue;
+    }
+    std::string_view op, args[3];
+    int argc = split(line, op, args);
+    if (op[0] != '.')
+    {
+      if (section != OBJ_TEXT) return error(item, "instruction outside .text");
+      lines.push_back(item);
+      continue;
+    }
+    if (op == ".text") section = OBJ_TEXT;
+    else if (op == ".data") section = OBJ_DATA;
+    else if (op == ".bss") section = OBJ_BSS;
+    else if (op == ".section" && argc == 1 && args[0] == ".rodata") section = OBJ_RODATA;
+    else if (op == ".globl" && argc == 1) symbols[symbol(args[0])].global = true;
+    else if ((op == ".word" || op == ".zero") && argc == 1)
+    {
+      item.kind = op == ".word" ? 'w' : 'z';
+      lines.push_back(item);
+    }
+    else return error(item, "unsupported directive");
+  }
+  return true;
+}
+
+// 确定每条指令的长度和每个标号的位置, 超出范围的分支加长后重新布局
+inline void ObjAssembler::layout()
+{
+  std::vector<std::pair<int, int>> branches;   // 以 .text 中标号为目标的分支和目标符号
+  for (size_t i = 0; i < lines.size(); i++)
+  {
+    auto &line = lines[i];
+    std::string_view op, args[3];
+    int argc = line.kind == 'l' ? 0 : split(line.text, op, args);
+    bool ok = true;
+    int f3;
+    bool swap, zero;
+    if (line.kind == 'w') line.size = 4;
+    else if (line.kind == 'z') line.size = obj_int(args[0], ok);
+    else if (line.kind == 'i')
+    {
+      line.size = op.substr(0, 2) == "c." ? 2 : 4;
+      if (op == "la" || op == "call") line.size = 8;
+      else if (op == "li" && argc == 2)
+      {
+        long value = obj_int(args[1], ok);
+        int hi, lo;
+        obj_split(value, hi, lo);
+        if (!obj_fits(value, 12) && lo) line.size = 8;
+      }
+      else if (argc && obj_branch_op(op, f3, swap, zero))
+      {
+        branches.push_back({i, symbol(args[argc - 1])});
+        // 先按压缩的 2 字节布局, 目标不在本文件或者够不到时再加长
+        if (rvc && zero && f3 < 2 && rvc_reg(sched_reg(args[0]))) line.size = 2;
+      }
+      else if (rvc && op == "j" && argc == 1)
+      {
+        branches.push_back({i, symbol(args[0])});
+        line.size = 2;
+      }
+    }
+  }
+  for (bool changed = true; changed;)
+  {
+    changed = false;
+    uint32_t offset[OBJ_SECTIONS] = {0};
+    for (auto &line : lines)
+    {
+      line.offset = offset[line.section];
+      offset[line.section] += line.size;
+      if (line.kind == 'l')
+      {
+        symbols[line.symbol].section = line.section;
+        symbols[line.symbol].value = line.offset;
+      }
+    }
+    for (auto &branch : branches)
+    {
+      auto &line = lines[branch.first];
+      auto &target = symbols[branch.second];
+      bool local = target.section == OBJ_TEXT, jump = line.text[0] == 'j';
+      long distance = (long)target.value - line.offset;
+      if (line.size == 2 && (!local || !obj_fits(distance, jump ? 12 : 9)))
+      {
+        line.size = 4;
+        changed = true;
+      }
+      else if (line.size == 4 && !jump && local && !obj_fits(distance, 13))
+      {
+        line.size = 8;
+        changed = true;
+      }
+    }
+    std::copy(offset, offset + OBJ_SECTIONS, section_size);
+  }
+}
+
+inline bool ObjAssembler::encode()
+{
+  std::string &text = data[OBJ_TEXT];
+  for (auto &line : lines)
+  {
+    std::string &out = data[line.section];
+    if (line.kind == 'l') continue;
+    std::string_view op, args[3];
+    int argc = split(line.text, op, args);
+    bool ok = true;
+    if (line.kind == 'w')
+    {
+      long value = obj_int(args[0], ok);
+      if (!ok && line.section != OBJ_BSS && sched_reg(args[0]) < 0)
+      {
+        // 以标号为值, 由链接器填入地址
+        relocs.push_back({line.offset, symbol(args[0]), R_RISCV_32, 0, line.section});
+        value = 0;
+        ok = true;
+      }
+      if (!ok) return error(line, "bad .word");
+      if (line.section != OBJ_BSS) put(out, value);
+      continue;
+    }
+    if (line.kind == 'z')
+    {
+      if (line.section != OBJ_BSS) out.append(line.size, '\0');
+      continue;
+    }
+    int reg[3];
+    for (int i = 0; i < argc; i++) reg[i] = sched_reg(args[i]);
+    auto regs = [&](int n) {
+      for (int i = 0; i < n; i++)
+        if (reg[i] < 0) return false;
+      return argc == n;
+    };
+    uint32_t pc = line.offset;
+    // 本文件 .text 中的标号返回到它的距离, 否则生成重定位并返回 0
+    auto target = [&](std::string_view name, int type) -> long {
+      int index = symbol(name);
+      if (symbols[index].section == OBJ_TEXT) return (long)symbols[index].value - pc;
+      relocs.push_back({pc, index, type, 0});
+      return 0;
+    };
+    int f3, f7;
+    bool swap, zero;
+    uint32_t half;
+    if (op.substr(0, 2) == "c.")
+    {
+      // 第二个操作数是寄存器, 访存的 "偏移(基址)" 或立即数
+      int rs = argc > 1 ? reg[1] : -1;
+      long imm = 0;
+      std::string_view last = argc ? args[argc - 1] : "";
+      size_t paren = argc > 1 ? last.find('(') : std::string_view::npos;
+      if (paren != std::string_view::npos && last.back() == ')')
+      {
+        rs = sched_reg(last.substr(paren + 1, last.size() - paren - 2));
+        if (paren) imm = obj_int(last.substr(0, paren), ok);
+      }
+      else if (argc > 1 && reg[argc - 1] < 0) imm = obj_int(last, ok);
+      if (!argc || reg[0] < 0 || !ok || !obj_rvc(op, reg[0], rs, imm, half))
+        return error(line, "bad operands");
+      put16(text, half);
+    }
+    else if (obj_r_op(op, f7, f3))
+    {
+      if (!regs(3)) return error(line, "bad operands");
+      put(text, obj_r(f7, reg[2], reg[1], f3, reg[0], 0x33));
+    }
+    else if (obj_i_op(op, f3, f7))
+    {
+      long imm = argc == 3 ? obj_int(args[2], ok) : 0;
+      if (argc != 3 || reg[0] < 0 || reg[1] < 0 || !ok || !obj_fits(imm, 12))
+        return error(line, "bad operands");
+      put(text, obj_i((int)imm | f7 << 5, reg[1], f3, reg[0], 0x13));
+    }
+    else if (op == "lw" || op == "sw")
+    {
+      size_t paren = argc == 2 ? args[1].find('(') : std::string_view::npos;
+      if (paren == std::string_view::npos || args[1].back() != ')' || reg[0] < 0)
+        return error(line, "bad operands");
+      int base = sched_reg(args[1].substr(paren + 1, args[1].size() - paren - 2));
+      long imm = paren ? obj_int(args[1].substr(0, paren), ok) : 0;
+      if (base < 0 || !ok || !obj_fits(imm, 12)) return error(line, "bad operands");
+      if (op == "lw") put(text, obj_i((int)imm, base, 2, reg[0], 0x03));
+      else put(text, obj_s((int)imm, reg[0], base, 2, 0x23));
+    }
+    else if (op == "li")
+    {
+      long value = argc == 2 ? obj_int(args[1], ok) : 0;
+      if (argc != 2 || reg[0] < 0 || !ok || !obj_fits(value, 33))
+        return error(line, "bad operands");
+      int hi, lo;
+      obj_split(value, hi, lo);
+      if (obj_fits(value, 12)) put(text, obj_i((int)value, 0, 0, reg[0], 0x13));
+      else
+      {
+        put(text, obj_u(hi, reg[0], 0x37));
+        if (lo) put(text, obj_i(lo, reg[0], 0, reg[0], 0x13));
+      }
+    }
+    else if (op == "mv" || op == "seqz" || op == "snez" || op == "neg" || op == "not")
+    {
+      if (!regs(2)) return error(line, "bad operands");
+      if (op == "mv") put(text, obj_i(0, reg[1], 0, reg[0], 0x13));
+      else if (op == "seqz") put(text, obj_i(1, reg[1], 3, reg[0], 0x13));
+      else if (op == "snez") put(text, obj_r(0, reg[1], 0, 3, reg[0], 0x33));
+      else if (op == "neg") put(text, obj_r(0x20, reg[1], 0, 0, reg[0], 0x33));
+      else put(text, obj_i(-1, reg[1], 4, reg[0], 0x13));
+    }
+    else if (op == "sgt" || op == "sgtu")
+    {
+      if (!regs(3)) return error(line, "bad operands");
+      put(text, obj_r(0, reg[1], reg[2], op == "sgt" ? 2 : 3, reg[0], 0x33));
+    }
+    else if (op == "la")
+    {
+      if (argc != 2 || reg[0] < 0) return error(line, "bad operands");
+      size_t plus = args[1].find_first_of("+-");
+      long addend = plus == std::string_view::npos ? 0 : obj_int(args[1].substr(plus), ok);
+      if (!ok) return error(line, "bad operands");
+      // %pcrel_lo 指向 auipc 处的局部标号
+      pcrel_names.push_back(".Lpcrel_hi" + std::to_string(pcrel_names.size()));
+      int hi_label = symbols.size();
+      symbols.push_back({pcrel_names.back(), OBJ_TEXT, pc});
+      relocs.push_back({pc, symbol(args[1].substr(0, plus)), R_RISCV_PCREL_HI20,
+        (int32_t)addend});
+      relocs.push_back({pc + 4, hi_label, R_RISCV_PCREL_LO12_I, 0});
+      put(text, obj_u(0, reg[0], 0x17));
+      put(text, obj_i(0, reg[0], 0, reg[0], 0x13));
+    }
+    else if (op == "call")
+    {
+      if (argc != 1) return error(line, "bad operands");
+      relocs.push_back({pc, symbol(args[0]), R_RISCV_CALL_PLT, 0});
+      put(text, obj_u(0, 1, 0x17));
+      put(text, obj_i(0, 1, 0, 1, 0x67));
+    }
+    else if (op == "ret")
+      put(text, obj_i(0, 1, 0, 0, 0x67));
+    else if (op == "jr")
+    {
+      if (!regs(1)) return error(line, "bad operands");
+      put(text, obj_i(0, reg[0], 0, 0, 0x67));
+    }
+    else if (op == "j")
+    {
+      if (argc != 1) return error(line, "bad operands");
+      long offset = target(args[0], R_RISCV_JAL);
+      if (!obj_fits(offset, 21)) return error(line, "jump out of range");
+      if (line.size == 2 && obj_rvc("c.j", -1, -1, offset, half)) put16(text, half);
+      else put(text, obj_j((int)offset, 0));
+    }
+    else if (obj_branch_op(op, f3, swap, zero))
+    {
+      int rs1 = reg[0], rs2 = zero ? 0 : reg[1];
+      if (argc != (zero ? 2 : 3) || rs1 < 0 || rs2 < 0) return error(line, "bad operands");
+      if (swap) std::swap(rs1, rs2);
+      if (line.size == 8)
+      {
+        // 反转条件跳过下一条 jal
+        put(text, obj_b(8, rs2, rs1, f3 ^ 1));
+        pc += 4;
+        put(text, obj_j((int)target(args[argc - 1], R_RISCV_JAL), 0));
+      }
+      else if (line.size == 2)
+      {
+        obj_rvc(f3 ? "c.bnez" : "c.beqz", rs1, -1, target(args[argc - 1], R_RISCV_BRANCH),
+          half);
+        put16(text, half);
+      }
+      else put(text, obj_b((int)target(args[argc - 1], R_RISCV_BRANCH), rs2, rs1, f3));
+    }
+    else return error(line, "unsupported instruction");
+  }
+  return true;
+}
+
+// 写出 ELF32 可重定位文件
+inline std::string ObjAssembler::elf() const
+{
+  static const char *names[] = {"", ".text", ".rela.text", ".data", ".rela.data",
+    ".rodata", ".rela.rodata", ".bss", ".symtab", ".strtab", ".shstrtab"};
+  const int section_index[OBJ_SECTIONS] = {1, 3, 5, 7};
+  std::string out, shstrtab, strtab(1, '\0'), symtab(16, '\0'), rela[OBJ_SECTIONS];
+  auto put16 = [](std::string &s, uint32_t v) { s += (char)v; s += (char)(v >> 8); };
+  auto put32 = [&](std::string &s, uint32_t v) { put16(s, v); put16(s, v >> 16); };
+  // 局部符号在前, 全局符号在后
+  std::vector<int> order, final_index(symbols.size());
+  for (int pass = 0; pass < 2; pass++)
+    for (size_t i = 0; i < symbols.size(); i++)
+      if ((symbols[i].global || symbols[i].section < 0) == (pass == 1))
+        order.push_back(i);
+  int first_global = 1;
+  for (size_t i = 0; i < order.size(); i++)
+  {
+    auto &sym = symbols[order[i]];
+    final_index[order[i]] = i + 1;
+    bool global = sym.global || sym.section < 0;
+    if (!global) first_global = i + 2;
+    put32(symtab, strtab.size());
+    strtab += sym.name;
+    strtab += '\0';
+    put32(symtab, sym.value);
+    put32(symtab, 0);
+    symtab += (char)(global ? 0x10 : 0x00);   // STB_GLOBAL / STB_LOCAL, STT_NOTYPE
+    symtab += '\0';
+    put16(symtab, sym.section < 0 ? 0 : section_index[sym.section]);
+  }
+  for (auto &reloc : relocs)
+  {
+    put32(rela[reloc.section], reloc.offset);
+    put32(rela[reloc.section], final_index[reloc.symbol] << 8 | reloc.type);
+    put32(rela[reloc.section], reloc.addend);
+  }
+  std::vector<uint32_t> name_offset;
+  for (auto name : names)
+  {
+    name_offset.push_back(shstrtab.size());
+    shstrtab += name;
+    shstrtab += '\0';
+  }
+  // 段内容依次排在 52 字节的文件头之后, 按 4 字节对齐
+  const std::string *contents[] = {nullptr, &data[OBJ_TEXT], &rela[OBJ_TEXT],
+    &data[OBJ_DATA], &rela[OBJ_DATA], &data[OBJ_RODATA], &rela[OBJ_RODATA], nullptr, &symtab,
+    &strtab, &shstrtab};
+  std::vector<uint32_t> file_offset(11, 0);
+  std::string body;
+  for (int i = 1; i < 11; i++)
+  {
+    while ((52 + body.size()) % 4) body += '\0';
+    file_offset[i] = 52 + body.size();
+    if (contents[i]) body += *contents[i];
+  }
+  while ((52 + body.size()) % 4) body += '\0';
+  uint32_t shoff = 52 + body.size();
+
+  out += "\x7f" "ELF";
+  out += (char)1;   // ELFCLASS32
+  out += (char)1;   // ELFDATA2LSB
+  out += (char)1;   // EV_CURRENT
+  out.append(9, '\0');
+  put16(out, 1);    // ET_REL
+  put16(out, 243);  // EM_RISCV
+  put32(out, 1);
+  put32(out, 0);    // e_entry
+  put32(out, 0);    // e_phoff
+  put32(out, shoff);
+  put32(out, rvc ? 1 : 0);    // e_flags: 软浮点 ABI, 有压缩指令时为 EF_RISCV_RVC
+  put16(out, 52);
+  put16(out, 0);
+  put16(out, 0);
+  put16(out, 40);
+  put16(out, 11);
+  put16(out, 10);   // e_shstrndx
+  out += body;
+
+  struct Header { uint32_t type, flags, size, link, info, align, entsize; };
+  const Header headers[] = {
+    {0, 0, 0, 0, 0, 0, 0},
+    {1, 0x6, (uint32_t)data[OBJ_TEXT].size(), 0, 0, 4, 0},         // AX
+    {4, 0x40, (uint32_t)rela[OBJ_TEXT].size(), 8, 1, 4, 12},        // INFO_LINK
+    {1, 0x3, (uint32_t)data[OBJ_DATA].size(), 0, 0, 4, 0},          // WA
+    {4, 0x40, (uint32_t)rela[OBJ_DATA].size(), 8, 3, 4, 12},
+    {1, 0x2, (uint32_t)data[OBJ_RODATA].size(), 0, 0, 4, 0},        // A
+    {4, 0x40, (uint32_t)rela[OBJ_RODATA].size(), 8, 5, 4, 12},
+    {8, 0x3, section_size[OBJ_BSS], 0, 0, 4, 0},
+    {2, 0, (uint32_t)symtab.size(), 9, (uint32_t)first_global, 4, 16},
+    {3, 0, (uint32_t)strtab.size(), 0, 0, 1, 0},
+    {3, 0, (uint32_t)shstrtab.size(), 0, 0, 1, 0},
+  };
+  for (int i = 0; i < 11; i++)
+  {
+    put32(out, name_offset[i]);
+    put32(out, headers[i].type);
+    put32(out, headers[i].flags);
+    put32(out, 0);
+    put32(out, file_offset[i]);
+    put32(out, headers[i].size);
+    put32(out, headers[i].link);
+    put32(out, headers[i].info);
+    put32(out, headers[i].align);
+    put32(out, headers[i].entsize);
+  }
+  return out;
+}
+
+// 16 位压缩指令还原成与汇编文本相同的 c.* 形式, 压缩的跳转和分支写成 j, beqz, bnez
+inline std::string obj_rvc_text(uint32_t h, uint32_t pc)
+{
+  auto bit = [&](int from, int to) { return (int32_t)(h >> from & 1) << to; };
+  auto sext = [](int32_t value, int bits) { return value << (32 - bits) >> (32 - bits); };
+  auto num = [](long value) { return std::to_string(value); };
+  int quadrant = h & 3, f3 = h >> 13;
+  std::string rd = obj_reg_names[h >> 7 & 31], rs2 = obj_reg_names[h >> 2 & 31];
+  std::string rd3 = obj_reg_names[8 + (h >> 7 & 7)], rs3 = obj_reg_names[8 + (h >> 2 & 7)];
+  int32_t imm6 = sext(bit(12, 5) | (h >> 2 & 31), 6), shamt = h >> 2 & 31;
+  if (quadrant == 0 && f3 == 0 && h)
+    return "c.addi4spn " + rs3 + ",sp," + num((h >> 11 & 3) << 4 | (h >> 7 & 15) << 6 |
+      bit(6, 2) | bit(5, 3));
+  if (quadrant == 0 && (f3 == 2 || f3 == 6))
+    return (f3 == 2 ? "c.lw " : "c.sw ") + rs3 + "," +
+      num((h >> 10 & 7) << 3 | bit(6, 2) | bit(5, 6)) + "(" + rd3 + ")";
+  if (quadrant == 1 && (f3 == 0 || f3 == 2) && (h >> 7 & 31))
+    return (f3 ? "c.li " : "c.addi ") + rd + "," + num(imm6);
+  if (quadrant == 1 && f3 == 3 && (h >> 7 & 31) == 2)
+    return "c.addi16sp sp," + num(sext(bit(12, 9) | bit(6, 4) | bit(5, 6) |
+      (h >> 3 & 3) << 7 | bit(2, 5), 10));
+  if (quadrant == 1 && f3 == 4)
+  {
+    static const char *names[] = {"c.sub ", "c.xor ", "c.or ", "c.and "};
+    switch (h >> 10 & 3)
+    {
+      case 0: return "c.srli " + rd3 + "," + num(shamt);
+      case 1: return "c.srai " + rd3 + "," + num(shamt);
+      case 2: return "c.andi " + rd3 + "," + num(imm6);
+      default: return names[h >> 5 & 3] + rd3 + "," + rs3;
+    }
+  }
+  if (quadrant == 1 && f3 == 5)
+    return "j @" + num(pc + sext(bit(12, 11) | bit(11, 4) | (h >> 9 & 3) << 8 | bit(8, 10) |
+      bit(7, 6) | bit(6, 7) | (h >> 3 & 7) << 1 | bit(2, 5), 12));
+  if (quadrant == 1 && f3 >= 6)
+    return (f3 == 6 ? "beqz " : "bnez ") + rd3 + ",@" + num(pc + sext(bit(12, 8) |
+      (h >> 10 & 3) << 3 | (h >> 5 & 3) << 6 | (h >> 3 & 3) << 1 | bit(2, 5), 9));
+  if (quadrant == 2 && f3 == 0) return "c.slli " + rd + "," + num(shamt);
+  if (quadrant == 2 && f3 == 2)
+    return "c.lwsp " + rd + "," + num(bit(12, 5) | (h >> 4 & 7) << 2 | (h >> 2 & 3) << 6) +
+      "(sp)";
+  if (quadrant == 2 && f3 == 4 && (h >> 7 & 31))
+  {
+    if (!(h >> 12 & 1)) return shamt ? "c.mv " + rd + "," + rs2 : "c.jr " + rd;
+    if (shamt) return "c.add " + rd + "," + rs2;
+  }
+  if (quadrant == 2 && f3 == 6)
+    return "c.swsp " + rs2 + "," + num((h >> 9 & 15) << 2 | (h >> 7 & 3) << 6) + "(sp)";
+  return ".half " + num(h);
+}
+
+// 内置解码器: 把 .text 中的机器码还原成规范形式的汇编, 能识别的指令对合并回伪指令
+// 跳转目标在有重定位时写成符号名, 否则写成 "@地址"
+inline std::vector<std::string> obj_disassemble(const std::string &code,
+  const std::map<uint32_t, std::pair<int, std::string>> &relocs)
+{
+  static const char *r_names[2][8] = {
+    {"add", "sll", "slt", "sltu", "xor", "srl", "or", "and"},
+    {"mul", "mulh", "mulhsu", "mulhu", "div", "divu", "rem", "remu"}};
+  static const char *i_names[8] = {"addi", "slli", "slti", "sltiu", "xori", "srli", "ori",
+    "andi"};
+  static const char *b_names[8] = {"beq", "bne", "?", "?", "blt", "bge", "bltu", "bgeu"};
+  auto word = [&](size_t pc) -> uint32_t {
+    if (pc + 4 > code.size()) return 0;
+    uint32_t w = 0;
+    for (int i = 0; i < 4; i++) w |= (uint32_t)(uint8_t)code[pc + i] << 8 * i;
+    return w;
+  };
+  auto reg = [](uint32_t w, int shift) { return std::string(obj_reg_names[w >> shift & 31]); };
+  auto imm_i = [](uint32_t w) { return (int32_t)w >> 20; };
+  auto imm_b = [](uint32_t w) {
+    return (int32_t)((w >> 31) << 12 | (w >> 7 & 1) << 11 | (w >> 25 & 0x3f) << 5 |
+      (w >> 8 & 0xf) << 1) << 19 >> 19;
+  };
+  auto imm_j = [](uint32_t w) {
+    return (int32_t)((w >> 31) << 20 | (w >> 12 & 0xff) << 12 | (w >> 20 & 1) << 11 |
+      (w >> 21 & 0x3ff) << 1) << 11 >> 11;
+  };
+  auto reloc = [&](size_t pc, int type) -> const std::string * {
+    auto found = relocs.find(pc);
+    return found != relocs.end() && found->second.first == type ? &found->second.second :
+      nullptr;
+  };
+  auto target = [&](size_t pc, int offset, int type) {
+    if (auto name = reloc(pc, type)) return *name;
+    return "@" + std::to_string(pc + offset);
+  };
+  std::vector<std::string> out;
+  for (size_t pc = 0, size = 4; pc < code.size(); pc += size)
+  {
+    uint32_t h = (uint8_t)code[pc] | (pc + 1 < code.size() ? (uint8_t)code[pc + 1] << 8 : 0);
+    size = (h & 3) == 3 ? 4 : 2;
+    if (size == 2)
+    {
+      out.push_back(obj_rvc_text(h, pc));
+      continue;
+    }
+    uint32_t w = word(pc), next = word(pc + 4);
+    int opcode = w & 0x7f, f3 = w >> 12 & 7, f7 = w >> 25;
+    std::string rd = reg(w, 7), rs1 = reg(w, 15), rs2 = reg(w, 20);
+    bool pair_addi = (next & 0x707f) == 0x13 && (next >> 7 & 31) == (w >> 7 & 31) &&
+      (next >> 15 & 31) == (w >> 7 & 31);
+    if (opcode == 0x37)
+    {
+      uint32_t value = w & 0xfffff000;
+      if (pair_addi)
+      {
+        value += imm_i(next);
+        pc += 4;
+      }
+      out.push_back("li " + rd + "," + std::to_string((int32_t)value));
+    }
+    else if (opcode == 0x17 && reloc(pc, R_RISCV_CALL_PLT))
+    {
+      out.push_back("call " + *reloc(pc, R_RISCV_CALL_PLT));
+      pc += 4;
+    }
+    else if (opcode == 0x17 && reloc(pc, R_RISCV_PCREL_HI20) && pair_addi)
+    {
+      auto &found = relocs.at(pc).second;
+      out.push_back("la " + rd + "," + found);
+      pc += 4;
+    }
+    else if (opcode == 0x13)
+    {
+      int imm = imm_i(w);
+      if (f3 == 0 && (w >> 15 & 31) == 0) out.push_back("li " + rd + "," + std::to_string(imm));
+      else if (f3 == 0 && imm == 0) out.push_back("mv " + rd + "," + rs1);
+      else if (f3 == 3 && imm == 1) out.push_back("seqz " + rd + "," + rs1);
+      else if (f3 == 4 && imm == -1) out.push_back("not " + rd + "," + rs1);
+      else if (f3 == 1 || f3 == 5)
+        out.push_back(std::string(f3 == 5 && f7 == 0x20 ? "srai" : i_names[f3]) + " " + rd +
+          "," + rs1 + "," + std::to_string(w >> 20 & 31));
+      else out.push_back(std::string(i_names[f3]) + " " + rd + "," + rs1 + "," +
+        std::to_string(imm));
+    }
+    else if (opcode == 0x33 && (f7 == 0 || f7 == 1 || f7 == 0x20))
+    {
+      if (f7 == 0 && f3 == 3 && (w >> 15 & 31) == 0) out.push_back("snez " + rd + "," + rs2);
+      else if (f7 == 0x20 && f3 == 0 && (w >> 15 & 31) == 0)
+        out.push_back("neg " + rd + "," + rs2);
+      else
+      {
+        std::string name = f7 == 0x20 ? (f3 == 0 ? "sub" : f3 == 5 ? "sra" : "?") :
+          r_names[f7][f3];
+        out.push_back(name + " " + rd + "," + rs1 + "," + rs2);
+      }
+    }
+    else if (opcode == 0x03 && f3 == 2)
+      out.push_back("lw " + rd + "," + std::to_string(imm_i(w)) + "(" + rs1 + ")");
+    else if (opcode == 0x23 && f3 == 2)
+    {
+      int imm = (int32_t)((w >> 25) << 5 | (w >> 7 & 31)) << 20 >> 20;
+      out.push_back("sw " + rs2 + "," + std::to_string(imm) + "(" + rs1 + ")");
+    }
+    else if (opcode == 0x6f && (w >> 7 & 31) == 0)
+      out.push_back("j " + target(pc, imm_j(w), R_RISCV_JAL));
+    else if (opcode == 0x67 && w == 0x00008067) out.push_back("ret");
+    else if (opcode == 0x67 && (w & 0xfff07fff) == 0x67) out.push_back("jr " + rs1);
+    else if (opcode == 0x63)
+    {
+      std::string dest = target(pc, imm_b(w), R_RISCV_BRANCH);
+      if ((w >> 20 & 31) == 0 && f3 < 2)
+        out.push_back(std::string(f3 ? "bnez " : "beqz ") + rs1 + "," + dest);
+      else out.push_back(std::string(b_names[f3]) + " " + rs1 + "," + rs2 + "," + dest);
+    }
+    else out.push_back(".word " + std::to_string(w));
+  }
+  return out;
+}
+
+// 把汇编文本中 .text 的指令改写成与 obj_disassemble 相同的规范形式
+// labels 给出 .text 中标号的地址, 用来把跳转目标写成 "@地址";
+// 据此可以独立算出每条指令的地址, 目标超出范围的分支展开成反向分支加 j
+inline std::vector<std::string> obj_canonical(std::string_view text,
+  const std::map<std::string, uint32_t> &labels)
+{
+  std::vector<std::string> out;
+  bool in_text = true;
+  uint32_t pc = 0;
+  while (!text.empty())
+  {
+    size_t end = text.find('\n');
+    std::string_view line = sched_trim(text.substr(0, end));
+    text.remove_prefix(end == std::string_view::npos ? text.size() : end + 1);
+    if (line.empty() || line.back() == ':') continue;
+    size_t op_end = line.find_first_of(" \t");
+    std::string op(line.substr(0, op_end));
+    if (op[0] == '.')
+    {
+      if (op == ".text") in_text = true;
+      else if (op == ".data" || op == ".bss" || op == ".section") in_text = false;
+      continue;
+    }
+    if (!in_text) continue;
+    std::vector<std::string> args;
+    std::string_view rest = op_end == std::string_view::npos ? "" : line.substr(op_end);
+    while (!sched_trim(rest).empty())
+    {
+      size_t comma = rest.find(',');
+      std::string arg(sched_trim(rest.substr(0, comma)));
+      int r = sched_reg(arg);
+      if (r >= 0) arg = obj_reg_names[r];
+      args.push_back(arg);
+      rest.remove_prefix(comma == std::string_view::npos ? rest.size() : comma + 1);
+    }
+    auto dest = [&](const std::string &label) {
+      auto found = labels.find(label);
+      return found == labels.end() ? label : "@" + std::to_string(found->second);
+    };
+    auto join = [](const std::string &op, const std::vector<std::string> &args) {
+      std::string s = op;
+      for (size_t i = 0; i < args.size(); i++) s += (i ? "," : " ") + args[i];
+      return s;
+    };
+    bool ok = true;
+    uint32_t size = op.compare(0, 2, "c.") ? 4 : 2;
+    // ObjAssembler 只压缩文本中写成 j, beqz, bnez 且目标在本文件中足够近的指令
+    auto compressed = [&](const std::string &label, int bits) {
+      auto found = labels.find(label);
+      return rvc && found != labels.end() && obj_fits((long)found->second - pc, bits);
+    };
+    bool zero_form = (op == "beqz" || op == "bnez") && rvc_reg(sched_reg(args[0]));
+    if (op == "sgt" || op == "sgtu")
+    {
+      op = op == "sgt" ? "slt" : "sltu";
+      std::swap(args[1], args[2]);
+    }
+    if (op == "addi" && args[1] == "x0") op = "li", args.erase(args.begin() + 1);
+    else if (op == "addi" && args[2] == "0") op = "mv", args.pop_back();
+    else if (op == "mv" && args[1] == "x0") op = "li", args[1] = "0";
+    else if (op == "sltiu" && args[2] == "1") op = "seqz", args.pop_back();
+    else if (op == "xori" && args[2] == "-1") op = "not", args.pop_back();
+    else if (op == "sltu" && args[1] == "x0") op = "snez", args.erase(args.begin() + 1);
+    else if (op == "sub" && args[1] == "x0") op = "neg", args.erase(args.begin() + 1);
+    if (op == "li")
+    {
+      long value = obj_int(args[1], ok);
+      int hi, lo;
+      obj_split(value, hi, lo);
+      if (!obj_fits(value, 12) && lo) size = 8;
+      args[1] = std::to_string((int32_t)value);
+    }
+    else if ((op == "lw" || op == "sw") && args[1][0] == '(') args[1] = "0" + args[1];
+    else if (op == "call") size = 8;
+    else if (op == "la")
+    {
+      size = 8;
+      size_t plus = args[1].find_first_of("+-");
+      if (plus != std::string::npos && obj_int(args[1].substr(plus), ok) == 0)
+        args[1].erase(plus);
+    }
+    else if (op == "j")
+    {
+      if (compressed(args[0], 12)) size = 2;
+      args[0] = dest(args[0]);
+    }
+    else if (op[0] == 'b')
+    {
+      static const std::map<std::string, std::string> swapped = {{"bgt", "blt"},
+        {"ble", "bge"}, {"bgtu", "bltu"}, {"bleu", "bgeu"}};
+      if (op == "bltz" || op == "bgez")
+        op.pop_back(), args.insert(args.begin() + 1, "x0");
+      auto found = swapped.find(op);
+      if (found != swapped.end()) op = found->second, std::swap(args[0], args[1]);
+      if ((op == "beq" || op == "bne") && args[1] == "x0")
+        op += "z", args.erase(args.begin() + 1);
+      auto found_label = labels.find(args.back());
+      if (found_label != labels.end() && !obj_fits((long)found_label->second - pc, 13))
+      {
+        static const std::map<std::string, std::string> inverse = {{"beqz", "bnez"},
+          {"bnez", "beqz"}, {"beq", "bne"}, {"bne", "beq"}, {"blt", "bge"},
+          {"bge", "blt"}, {"bltu", "bgeu"}, {"bgeu", "bltu"}};
+        std::string label = dest(args.back());
+        args.back() = "@" + std::to_string(pc + 8);
+        out.push_back(join(inverse.at(op), args));
+        op = "j";
+        args = {label};
+        pc += 4;
+      }
+      else
+      {
+        if (zero_form && compressed(args.back(), 9)) size = 2;
+        args.back() = dest(args.back());
+      }
+    }
+    out.push_back(join(op, args));
+    pc += size;
+  }
+  return out;
+}
+
+// 读回生成的 ELF, 反汇编 .text 并与汇编文本比较, 不一致时输出前几处差异并返回 false
+inline bool obj_verify(std::string_view text, const std::string &elf)
+{
+  auto get16 = [&](size_t at) { return (uint32_t)(uint8_t)elf[at] | (uint8_t)elf[at + 1] << 8; };
+  auto get32 = [&](size_t at) { return get16(at) | get16(at + 2) << 16; };
+  uint32_t shoff = get32(32), shnum = get16(48), shstrndx = get16(50);
+  auto section = [&](uint32_t i, int field) { return get32(shoff + 40 * i + 4 * field); };
+  auto name_of = [&](uint32_t offset) { return std::string(elf.c_str() + offset); };
+  std::map<std::string, uint32_t> index;
+  for (uint32_t i = 0; i < shnum; i++)
+    index[name_of(section(shstrndx, 4) + section(i, 0))] = i;
+  auto contents = [&](const char *name) {
+    uint32_t i = index.at(name);
+    return elf.substr(section(i, 4), section(i, 5));
+  };
+  std::string code = contents(".text"), symtab = contents(".symtab");
+  uint32_t strtab = section(index.at(".strtab"), 4);
+  std::map<std::string, uint32_t> labels;
+  std::vector<std::string> names;
+  for (size_t at = 0; at < symtab.size(); at += 16)
+  {
+    size_t entry = section(index.at(".symtab"), 4) + at;
+    names.push_back(name_of(strtab + get32(entry)));
+    if (get16(entry + 14) == index.at(".text")) labels[names.back()] = get32(entry + 4);
+  }
+  std::map<uint32_t, std::pair<int, std::string>> relocs;
+  std::string rela = contents(".rela.text");
+  for (size_t at = 0; at < rela.size(); at += 12)
+  {
+    size_t entry = section(index.at(".rela.text"), 4) + at;
+    uint32_t info = get32(entry + 4);
+    int32_t addend = get32(entry + 8);
+    std::string target = names[info >> 8];
+    if (addend) target += (addend > 0 ? "+" : "") + std::to_string(addend);
+    relocs[get32(entry)] = {(int)(info & 0xff), target};
+  }
+  auto decoded = obj_disassemble(code, relocs);
+  auto expected = obj_canonical(text, labels);
+  int mismatches = 0;
+  for (size_t i = 0; i < std::max(decoded.size(), expected.size()); i++)
+  {
+    std::string got = i < decoded.size() ? decoded[i] : "<end>";
+    std::string want = i < expected.size() ? expected[i] : "<end>";
+    if (got == want) continue;
+    if (++mismatches <= 10)
+      std::cerr << "verify-obj: instruction " << i << ": decoded \"" << got <<
+        "\", expected \"" << want << "\"" << std::endl;
+  }
+  if (mismatches)
+    std::cerr << "verify-obj: " << mismatches << " mismatches in " << expected.size() <<
+      " instructions" << std::endl;
+  return !mismatches;
+}
@@ -0,0 +1,164 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <string>
+#include <string_view>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// 词法分析的快速路径: 把源文件整个 mmap 进来, 用 SIMD 一次判断 16 个字节,
+// 跳过空白和注释, 找出标识符和数字的边界; 标识符作为指向映射区的切片交给 parser,
+// 不再为每个标识符 new 一个 string. 映射失败 (比如输入不是普通文件) 时退回 flex
+
+// 标识符 token 的值, 是平凡类型, 可以放进 bison 的 union
+struct TokenView
+{
+  const char *ptr;
+  size_t len;
+  std::string str() const { return std::string(ptr, len); }
+  std::string_view view() const { return std::string_view(ptr, len); }
+};
+
+inline bool use_flex_lexer = false;    // -flex-lexer: 总是使用 flex
+inline const char *lex_begin = nullptr;
+inline const char *lex_cur = nullptr;
+inline const char *lex_end = nullptr;
+inline size_t lex_map_size = 0;
+inline bool lex_mapped = false;
+inline const char *lex_released = nullptr;   // 此前的整页已经归还
+// flex 的 yytext 会被后续 token 覆盖, 退回 flex 时标识符复制到这里, 地址保持不变
+inline std::deque<std::string> lex_strings;
+
+inline bool fast_lex_open(const char *path)
+{
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) return false;
+  struct stat st;
+  if (fstat(fd, &st) < 0 || !S_ISREG(st.st_mode))
+  {
+    close(fd);
+    return false;
+  }
+  lex_map_size = st.st_size;
+  void *map = nullptr;
+  if (lex_map_size)
+  {
+    map = mmap(nullptr, lex_map_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map == MAP_FAILED)
+    {
+      close(fd);
+      return false;
+    }
+    madvise(map, lex_map_size, MADV_SEQUENTIAL);
+  }
+  close(fd);
+  lex_begin = lex_cur = lex_released = (const char *)map;
+  lex_end = lex_begin + lex_map_size;
+  lex_mapped = true;
+  return true;
+}
+
+// parser 已经把需要的标识符复制进 AST, 解析结束后即可解除映射
+inline void fast_lex_close()
+{
+  if (lex_mapped && lex_map_size) munmap((void *)lex_begin, lex_map_size);
+  lex_mapped = false;
+}
+
+// 流式编译时归还已经扫描过的整页, 驻留内存不随输入增长.
+// 映射是只读私有的, 万一再被访问也只是从文件重新读入
+inline void fast_lex_release()
+{
+  if (!lex_mapped || !lex_map_size) return;
+  long page = sysconf(_SC_PAGESIZE);
+  const char *end = lex_begin + (lex_cur - lex_begin) / page * page;
+  if (end <= lex_released) return;
+  madvise((void *)lex_released, end - lex_released, MADV_DONTNEED);
+  lex_released = end;
+}
+
+inline bool lex_is_space(char c)
+{
+  return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+}
+
+inline bool lex_is_ident(char c)
+{
+  return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') ||
+    (c >= '0' && c <= '9') || c == '_';
+}
+
+#if defined(__SSE2__)
+// 以下两个函数返回 16 字节中各字节是否属于对应字符类的位掩码
+inline unsigned lex_space_mask(__m128i v)
+{
+  __m128i m = _mm_or_si128(
+    _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8(' ')),
+      _mm_cmpeq_epi8(v, _mm_set1_epi8('\t'))),
+    _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('\n')),
+      _mm_cmpeq_epi8(v, _mm_set1_epi8('\r'))));
+  return _mm_movemask_epi8(m);
+}
+
+inline unsigned lex_ident_mask(__m128i v)
+{
+  // 字节按有符号数比较, 0x80 以上的字节是负数, 自然落在所有区间之外
+  __m128i lower = _mm_or_si128(v, _mm_set1_epi8(0x20));
+  __m128i alpha = _mm_and_si128(_mm_cmpgt_epi8(lower, _mm_set1_epi8('a' - 1)),
+    _mm_cmplt_epi8(lower, _mm_set1_epi8('z' + 1)));
+  __m128i digit = _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8('0' - 1)),
+    _mm_cmplt_epi8(v, _mm_set1_epi8('9' + 1)));
+  __m128i under = _mm_cmpeq_epi8(v, _mm_set1_epi8('_'));
+  return _mm_movemask_epi8(_mm_or_si128(_mm_or_si128(alpha, digit), under));
+}
+#endif
+
+// 跳过空白, 返回第一个非空白字符的位置
+inline const char *lex_skip_space(const char *p, const char *end)
+{
+#if defined(__SSE2__)
+  while (end - p >= 16)
+  {
+    unsigned mask = lex_space_mask(_mm_loadu_si128((const __m128i *)p));
+    if (mask != 0xffff) return p + __builtin_ctz(~mask);
+    p += 16;
+  }
+#endif
+  while (p < end && lex_is_space(*p)) p++;
+  return p;
+}
+
+// 返回标识符的结尾
+inline const char *lex_skip_ident(const char *p, const char *end)
+{
+#if defined(__SSE2__)
+  while (end - p >= 16)
+  {
+    unsigned mask = lex_ident_mask(_mm_loadu_si128((const __m128i *)p));
+    if (mask != 0xffff) return p + __builtin_ctz(~mask);
+    p += 16;
+  }
+#endif
+  while (p < end && lex_is_ident(*p)) p++;
+  return p;
+}
+
+// 从块注释的内容开始找 "*/", 返回其后的位置, 没有找到时返回 nullptr
+inline const char *lex_skip_block_comment(const char *p, const char *end)
+{
+  while (p < end)
+  {
+    auto star = (const char *)memchr(p, '*', end - p);
+    if (!star || star + 1 >= end) return nullptr;
+    if (star[1] == '/') return star + 2;
+    p = star + 1;
+  }
+  return nullptr;
+}
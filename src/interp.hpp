@@ -0,0 +1,464 @@
+#pragma once
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <cstdio>
+#include <iostream>
+#include <iterator>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "koopa.h"
+#include "riscv.hpp"
+#include "stats.hpp"
+
+// -interp: 直接解释执行 Koopa IR, 不需要 RISC-V 硬件或模拟器
+// 每个函数先翻译成紧凑的指令数组: 参数, 有值的指令和用到的常量各占一个槽,
+// 操作数是槽的下标. 内存按字 (4 字节) 编址, 指针就是字下标, 全局变量在低地址,
+// alloc 在其后的栈上. 调用使用显式的帧栈, 深递归不受 C++ 栈大小的限制
+// 运行时库函数在标准输入输出上实现, 除法按 RISC-V 的规则处理除以 0 和溢出
+// 结束后在标准错误输出按操作码的动态指令数, 每个函数的调用次数, 指令数和 load/store 数,
+// 以及执行次数最多的基本块, 作为比较前端和优化改动的确定性代价指标
+
+inline const int interp_hot_blocks = 20;   // 报告中列出的基本块数
+
+inline const char *const interp_runtime[] = {"getint", "getch", "getarray",
+  "putint", "putch", "putarray", "starttime", "stoptime"};
+inline const char *const interp_binary_names[] = {"ne", "eq", "gt", "lt", "ge",
+  "le", "add", "sub", "mul", "div", "mod", "and", "or", "xor", "shl", "shr", "sar"};
+
+struct InterpInst
+{
+  koopa_raw_value_tag_t tag;
+  koopa_raw_binary_op_t op;
+  int dest;             // 结果槽, 没有结果时为 -1
+  int a, b;             // 操作数槽
+  int32_t scale;        // getptr/getelemptr 下标每加一移动的字数
+  int target, other;    // br 的真假目标块, jump 的目标块
+  int callee;           // 函数编号, 运行时库函数为 -1 - 库函数编号
+  int arg_start, arg_count;
+};
+
+struct InterpFunc
+{
+  std::string name;
+  std::vector<InterpInst> insts;
+  std::vector<int> block_start;
+  std::vector<std::string> block_names;
+  std::vector<long long> block_counts;
+  std::vector<int> args;                           // call 的实参槽
+  std::vector<int32_t> init;                       // 槽的初值: 常量和全局变量的地址
+  std::vector<std::pair<int, int32_t>> allocs;     // alloc 的槽和相对帧底的字偏移
+  int32_t frame_words = 0;
+  long long calls = 0, executed = 0, loads = 0, stores = 0;
+};
+
+class KoopaInterp
+{
+ public:
+  explicit KoopaInterp(const koopa_raw_program_t &program)
+  {
+    for (size_t i = 0; i < program.values.len; i++)
+    {
+      auto global = reinterpret_cast<koopa_raw_value_t>(program.values.buffer[i]);
+      assert(global->kind.tag == KOOPA_RVT_GLOBAL_ALLOC);
+      globals[global] = mem.size();
+      init_aggregate(global->kind.data.global_alloc.init, mem);
+    }
+    stack_top = mem.size();
+    for (size_t i = 0; i < program.funcs.len; i++)
+    {
+      auto func = reinterpret_cast<koopa_raw_function_t>(program.funcs.buffer[i]);
+      func_index[func] = i;
+    }
+    funcs.resize(program.funcs.len);
+    for (size_t i = 0; i < program.funcs.len; i++)
+      translate(reinterpret_cast<koopa_raw_function_t>(program.funcs.buffer[i]), funcs[i]);
+  }
+
+  // 从 main 开始执行, 返回它的返回值
+  int32_t run()
+  {
+    int main_func = -1;
+    for (size_t i = 0; i < funcs.size(); i++)
+      if (funcs[i].name == "main") main_func = i;
+    if (main_func < 0)
+    {
+      std::cerr << "interp: no main function" << std::endl;
+      return -1;
+    }
+    struct Frame { int func, pc, base, ret_slot; int32_t mem_top; };
+    std::vector<Frame> frames;
+    std::vector<int32_t> slots;
+    auto enter = [&](int index, const int32_t *args, int arg_count, int ret_slot) {
+      InterpFunc &func = funcs[index];
+      func.calls++;
+      Frame frame = {index, func.block_start[0], (int)slots.size(), ret_slot, stack_top};
+      slots.insert(slots.end(), func.init.begin(), func.init.end());
+      std::copy(args, args + arg_count, slots.begin() + frame.base);
+      if (stack_top + func.frame_words > (int32_t)mem.size())
+        mem.resize(stack_top + func.frame_words);
+      for (auto &alloc : func.allocs) slots[frame.base + alloc.first] = stack_top + alloc.second;
+      op_counts[KOOPA_RVT_ALLOC] += func.allocs.size();
+      func.executed += func.allocs.size();
+      stack_top += func.frame_words;
+      func.block_counts[0]++;
+      frames.push_back(frame);
+    };
+    enter(main_func, nullptr, 0, -1);
+    std::vector<int32_t> call_args;
+    while (true)
+    {
+      Frame &frame = frames.back();
+      InterpFunc &func = funcs[frame.func];
+      const InterpInst &inst = func.insts[frame.pc++];
+      int32_t *slot = slots.data() + frame.base;
+      func.executed++;
+      op_counts[inst.tag]++;
+      switch (inst.tag)
+      {
+      case KOOPA_RVT_LOAD:
+        func.loads++;
+        slot[inst.dest] = mem[address(slot[inst.a], func)];
+        break;
+      case KOOPA_RVT_STORE:
+        func.stores++;
+        mem[address(slot[inst.b], func)] = slot[inst.a];
+        break;
+      case KOOPA_RVT_GET_PTR:
+      case KOOPA_RVT_GET_ELEM_PTR:
+        slot[inst.dest] = slot[inst.a] + slot[inst.b] * inst.scale;
+        break;
+      case KOOPA_RVT_BINARY:
+        binary_counts[inst.op]++;
+        slot[inst.dest] = binary(inst.op, slot[inst.a], slot[inst.b]);
+        break;
+      case KOOPA_RVT_BRANCH:
+      case KOOPA_RVT_JUMP:
+      {
+        int block = inst.tag == KOOPA_RVT_JUMP || slot[inst.a] ? inst.target : inst.other;
+        func.block_counts[block]++;
+        frame.pc = func.block_start[block];
+        break;
+      }
+      case KOOPA_RVT_CALL:
+      {
+        call_args.clear();
+        for (int i = 0; i < inst.arg_count; i++)
+          call_args.push_back(slot[func.args[inst.arg_start + i]]);
+        if (inst.callee < 0)
+        {
+          int32_t result = call_runtime(-1 - inst.callee, call_args, func);
+          if (inst.dest >= 0) slot[inst.dest] = result;
+          break;
+        }
+        enter(inst.callee, call_args.data(), inst.arg_count, inst.dest);
+        break;
+      }
+      case KOOPA_RVT_RETURN:
+      {
+        int32_t value = inst.a >= 0 ? slot[inst.a] : 0;
+        Frame done = frame;
+        frames.pop_back();
+        slots.resize(done.base);
+        stack_top = done.mem_top;
+        if (frames.empty()) return value;
+        if (done.ret_slot >= 0) slots[frames.back().base + done.ret_slot] = value;
+        break;
+      }
+      default:
+        assert(false);
+      }
+    }
+  }
+
+  void report() const
+  {
+    long long total = 0;
+    std::vector<std::pair<long long, std::string>> ops;
+    for (int tag = 0; tag <= KOOPA_RVT_RETURN; tag++)
+    {
+      total += op_counts[tag];
+      if (tag != KOOPA_RVT_BINARY && op_counts[tag])
+        ops.push_back({op_counts[tag], op_name((koopa_raw_value_tag_t)tag)});
+    }
+    for (int op = 0; op <= KOOPA_RBO_SAR; op++)
+      if (binary_counts[op]) ops.push_back({binary_counts[op], interp_binary_names[op]});
+    std::stable_sort(ops.begin(), ops.end(),
+      [](const auto &x, const auto &y) { return x.first > y.first; });
+    fprintf(stderr, "===== interpreter =====\n");
+    fprintf(stderr, "%-24s %14lld\n", "instructions", total);
+    for (auto &op : ops) fprintf(stderr, "  %-22s %14lld\n", op.second.c_str(), op.first);
+    fprintf(stderr, "%-24s %12s %14s %12s %12s\n", "function", "calls", "instructions",
+      "loads", "stores");
+    for (auto &func : funcs)
+      if (func.calls)
+        fprintf(stderr, "  %-22s %12lld %14lld %12lld %12lld\n", func.name.c_str(),
+          func.calls, func.executed, func.loads, func.stores);
+    for (int id = 0; id < (int)std::size(interp_runtime); id++)
+      if (runtime_calls[id])
+        fprintf(stderr, "  %-22s %12lld\n", interp_runtime[id], runtime_calls[id]);
+    std::vector<std::pair<long long, std::string>> blocks;
+    for (auto &func : funcs)
+      for (size_t i = 0; i < func.block_counts.size(); i++)
+        if (func.block_counts[i])
+          blocks.push_back({func.block_counts[i], func.name + " " + func.block_names[i]});
+    std::stable_sort(blocks.begin(), blocks.end(),
+      [](const auto &x, const auto &y) { return x.first > y.first; });
+    if (blocks.size() > (size_t)interp_hot_blocks) blocks.resize(interp_hot_blocks);
+    fprintf(stderr, "hot blocks\n");
+    for (auto &block : blocks)
+      fprintf(stderr, "  %-36s %14lld\n", block.second.c_str(), block.first);
+  }
+
+ private:
+  std::vector<int32_t> mem;
+  int32_t stack_top = 0;
+  std::vector<InterpFunc> funcs;
+  std::unordered_map<koopa_raw_function_t, int> func_index;
+  std::unordered_map<koopa_raw_value_t, int32_t> globals;
+  long long op_counts[KOOPA_RVT_RETURN + 1] = {0};
+  long long binary_counts[KOOPA_RBO_SAR + 1] = {0};
+  long long runtime_calls[std::size(interp_runtime)] = {0};
+
+  static const char *op_name(koopa_raw_value_tag_t tag)
+  {
+    switch (tag)
+    {
+    case KOOPA_RVT_ALLOC: return "alloc";
+    case KOOPA_RVT_LOAD: return "load";
+    case KOOPA_RVT_STORE: return "store";
+    case KOOPA_RVT_GET_PTR: return "getptr";
+    case KOOPA_RVT_GET_ELEM_PTR: return "getelemptr";
+    case KOOPA_RVT_BRANCH: return "br";
+    case KOOPA_RVT_JUMP: return "jump";
+    case KOOPA_RVT_CALL: return "call";
+    case KOOPA_RVT_RETURN: return "ret";
+    default: return "?";
+    }
+  }
+
+  size_t address(int32_t addr, const InterpFunc &func) const
+  {
+    if (addr < 0 || (size_t)addr >= mem.size())
+    {
+      std::cerr << "interp: access to address " << addr << " out of bounds in @" <<
+        func.name << std::endl;
+      std::exit(1);
+    }
+    return addr;
+  }
+
+  static int32_t binary(koopa_raw_binary_op_t op, int32_t x, int32_t y)
+  {
+    uint32_t ux = x, uy = y;
+    switch (op)
+    {
+    case KOOPA_RBO_NOT_EQ: return x != y;
+    case KOOPA_RBO_EQ: return x == y;
+    case KOOPA_RBO_GT: return x > y;
+    case KOOPA_RBO_LT: return x < y;
+    case KOOPA_RBO_GE: return x >= y;
+    case KOOPA_RBO_LE: return x <= y;
+    case KOOPA_RBO_ADD: return ux + uy;
+    case KOOPA_RBO_SUB: return ux - uy;
+    case KOOPA_RBO_MUL: return ux * uy;
+    case KOOPA_RBO_DIV:
+      if (y == 0) return -1;
+      if (x == INT32_MIN && y == -1) return x;
+      return x / y;
+    case KOOPA_RBO_MOD:
+      if (y == 0) return x;
+      if (x == INT32_MIN && y == -1) return 0;
+      return x % y;
+    case KOOPA_RBO_AND: return x & y;
+    case KOOPA_RBO_OR: return x | y;
+    case KOOPA_RBO_XOR: return x ^ y;
+    case KOOPA_RBO_SHL: return ux << (y & 31);
+    case KOOPA_RBO_SHR: return ux >> (y & 31);
+    case KOOPA_RBO_SAR: return x >> (y & 31);
+    default: assert(false); return 0;
+    }
+  }
+
+  int32_t call_runtime(int id, const std::vector<int32_t> &args, const InterpFunc &func)
+  {
+    runtime_calls[id]++;
+    int32_t value = 0;
+    switch (id)
+    {
+    case 0:   // getint
+      if (scanf("%d", &value) != 1) value = 0;
+      return value;
+    case 1:   // getch
+      return getchar();
+    case 2:   // getarray
+    {
+      int32_t n = 0;
+      if (scanf("%d", &n) != 1) n = 0;
+      for (int32_t i = 0; i < n; i++)
+      {
+        value = 0;
+        if (scanf("%d", &value) != 1) value = 0;
+        mem[address(args[0] + i, func)] = value;
+      }
+      return n;
+    }
+    case 3:   // putint
+      printf("%d", args[0]);
+      return 0;
+    case 4:   // putch
+      putchar(args[0]);
+      return 0;
+    case 5:   // putarray
+      printf("%d:", args[0]);
+      for (int32_t i = 0; i < args[0]; i++) printf(" %d", mem[address(args[1] + i, func)]);
+      putchar('\n');
+      return 0;
+    default:  // starttime, stoptime
+      return 0;
+    }
+  }
+
+  void translate(koopa_raw_function_t raw, InterpFunc &func)
+  {
+    func.name = raw->name + 1;
+    std::unordered_map<koopa_raw_value_t, int> slot_of;
+    std::unordered_map<koopa_raw_basic_block_t, int> block_of;
+    int slots = 0;
+    for (size_t i = 0; i < raw->params.len; i++)
+    {
+      slot_of[reinterpret_cast<koopa_raw_value_t>(raw->params.buffer[i])] = slots++;
+      func.init.push_back(0);
+    }
+    // 先给所有指令编号, 使得按块的顺序在定义之前出现的使用也能找到槽
+    for (size_t i = 0; i < raw->bbs.len; i++)
+    {
+      auto bb = reinterpret_cast<koopa_raw_basic_block_t>(raw->bbs.buffer[i]);
+      block_of[bb] = i;
+      for (size_t j = 0; j < bb->insts.len; j++)
+      {
+        auto inst = reinterpret_cast<koopa_raw_value_t>(bb->insts.buffer[j]);
+        if (inst->ty->tag == KOOPA_RTT_UNIT) continue;
+        slot_of[inst] = slots++;
+        func.init.push_back(0);
+        if (inst->kind.tag == KOOPA_RVT_ALLOC)
+        {
+          func.allocs.push_back({slot_of[inst], func.frame_words});
+          func.frame_words += cal_size(inst->ty->data.pointer.base) / 4;
+        }
+      }
+    }
+    auto operand = [&](koopa_raw_value_t value) {
+      auto it = slot_of.find(value);
+      if (it != slot_of.end()) return it->second;
+      int32_t init = 0;
+      if (value->kind.tag == KOOPA_RVT_INTEGER) init = value->kind.data.integer.value;
+      else if (value->kind.tag == KOOPA_RVT_GLOBAL_ALLOC) init = globals.at(value);
+      else assert(value->kind.tag == KOOPA_RVT_ZERO_INIT || value->kind.tag == KOOPA_RVT_UNDEF);
+      func.init.push_back(init);
+      return slot_of[value] = slots++;
+    };
+    for (size_t i = 0; i < raw->bbs.len; i++)
+    {
+      auto bb = reinterpret_cast<koopa_raw_basic_block_t>(raw->bbs.buffer[i]);
+      func.block_start.push_back(func.insts.size());
+      func.block_names.push_back(bb->name ? bb->name + 1 : "?");
+      for (size_t j = 0; j < bb->insts.len; j++)
+      {
+        auto value = reinterpret_cast<koopa_raw_value_t>(bb->insts.buffer[j]);
+        const auto &kind = value->kind;
+        if (kind.tag == KOOPA_RVT_ALLOC) continue;
+        InterpInst inst = {kind.tag, 0, -1, -1, -1, 0, -1, -1, 0, 0, 0};
+        if (value->ty->tag != KOOPA_RTT_UNIT) inst.dest = slot_of[value];
+        switch (kind.tag)
+        {
+        case KOOPA_RVT_LOAD:
+          inst.a = operand(kind.data.load.src);
+          break;
+        case KOOPA_RVT_STORE:
+          inst.a = operand(kind.data.store.value);
+          inst.b = operand(kind.data.store.dest);
+          break;
+        case KOOPA_RVT_GET_PTR:
+          inst.a = operand(kind.data.get_ptr.src);
+          inst.b = operand(kind.data.get_ptr.index);
+          inst.scale = cal_size(kind.data.get_ptr.src->ty->data.pointer.base) / 4;
+          break;
+        case KOOPA_RVT_GET_ELEM_PTR:
+          inst.a = operand(kind.data.get_elem_ptr.src);
+          inst.b = operand(kind.data.get_elem_ptr.index);
+          inst.scale = cal_size(value->ty->data.pointer.base) / 4;
+          break;
+        case KOOPA_RVT_BINARY:
+          inst.op = kind.data.binary.op;
+          inst.a = operand(kind.data.binary.lhs);
+          inst.b = operand(kind.data.binary.rhs);
+          break;
+        case KOOPA_RVT_BRANCH:
+          inst.a = operand(kind.data.branch.cond);
+          inst.target = block_of.at(kind.data.branch.true_bb);
+          inst.other = block_of.at(kind.data.branch.false_bb);
+          break;
+        case KOOPA_RVT_JUMP:
+          inst.target = block_of.at(kind.data.jump.target);
+          break;
+        case KOOPA_RVT_CALL:
+        {
+          auto callee = kind.data.call.callee;
+          inst.callee = func_index.at(callee);
+          if (callee->bbs.len == 0)
+          {
+            std::string name = callee->name + 1;
+            auto it = std::find(std::begin(interp_runtime), std::end(interp_runtime), name);
+            if (it == std::end(interp_runtime))
+            {
+              std::cerr << "interp: @" << name << " has no body" << std::endl;
+              std::exit(1);
+            }
+            inst.callee = -1 - (it - std::begin(interp_runtime));
+          }
+          inst.arg_start = func.args.size();
+          inst.arg_count = kind.data.call.args.len;
+          for (size_t k = 0; k < kind.data.call.args.len; k++)
+            func.args.push_back(operand(
+              reinterpret_cast<koopa_raw_value_t>(kind.data.call.args.buffer[k])));
+          break;
+        }
+        case KOOPA_RVT_RETURN:
+          if (kind.data.ret.value) inst.a = operand(kind.data.ret.value);
+          break;
+        default:
+          assert(false);
+        }
+        func.insts.push_back(inst);
+      }
+    }
+    func.block_counts.assign(raw->bbs.len, 0);
+  }
+};
+
+// 解析 Koopa IR 文本并执行, 返回 main 的返回值
+inline int32_t interp_string(const char *str)
+{
+  koopa_program_t program;
+  koopa_raw_program_builder_t builder = koopa_new_raw_program_builder();
+  koopa_raw_program_t raw;
+  {
+    PhaseTimer timer("koopa-parse");
+    koopa_error_code_t ret = koopa_parse_from_string(str, &program);
+    assert(ret == KOOPA_EC_SUCCESS);
+    raw = koopa_build_raw_program(builder, program);
+    koopa_delete_program(program);
+  }
+  int32_t value;
+  {
+    PhaseTimer timer("interp");
+    KoopaInterp interp(raw);
+    value = interp.run();
+    fflush(stdout);
+    interp.report();
+  }
+  koopa_delete_raw_program_builder(builder);
+  return value;
+}
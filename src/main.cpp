@@ -1,10 +1,19 @@
 #include <cassert>
 #include <cstdio>
+#include <cstdlib>
 #include <iostream>
 #include <memory>
+#include <optional>
+#include <sstream>
 #include <string>
 #include "AST.hpp"
 #include "riscv.hpp"
+#include "elf.hpp"
+#include "stats.hpp"
+#include "fastlex.hpp"
+#include "profile.hpp"
+#include "stream.hpp"
+#include "interp.hpp"
 #include "koopa.h"
 using namespace std;
 
@@ -16,36 +25,182 @@ using namespace std;
 extern FILE *yyin;
 extern int yyparse(unique_ptr<BaseAST> &ast);
 
+// 把汇编文本编码成目标文件写到标准输出, -verify-obj 时再反汇编核对
+static bool write_obj(const string &text)
+{
+  string elf;
+  {
+    PhaseTimer timer("obj-emit");
+    ObjAssembler assembler;
+    if (!assembler.assemble(text)) return false;
+    elf = assembler.elf();
+  }
+  cout.write(elf.data(), elf.size());
+  cout.flush();
+  return !verify_obj || obj_verify(text, elf);
+}
+
 int main(int argc, const char *argv[]) {
   // 解析命令行参数. 测试脚本/评测平台要求你的编译器能接收如下参数:
-  // compiler 模式 输入文件 -o 输出文件
-  assert(argc == 5);
+  // compiler 模式 输入文件 -o 输出文件 [选项...]
+  // 模式: -koopa 输出 Koopa IR, -riscv 输出汇编,
+  // -interp 解释执行 Koopa IR, 程序的输出写入输出文件, 动态计数打印到标准错误
+  assert(argc >= 5);
   auto mode = argv[1];
   auto input = argv[2];
   auto output = argv[4];
 
+  // 可选参数:
+  // -cache 目录     启用按函数划分的增量编译缓存
+  // -cache-size N   缓存目录中最多保留的文件数
+  // -ftime-report   输出各阶段耗时, 峰值内存与分配次数
+  // -stats          输出词法单元, AST 结点, 寄存器溢出等计数
+  // -stats-json 文件 把上述结果以 JSON 格式写入文件
+  // -flex-lexer     不使用 mmap 快速路径, 总是用 flex 做词法分析
+  // -mtune=名字     指令调度使用的流水线模型: generic (默认), sifive-u74, rocket, none
+  // -emit-obj       -riscv 模式下直接输出 ELF 目标文件而不是汇编文本
+  // -verify-obj     用内置解码器反汇编输出的目标文件, 与汇编文本逐条比较
+  // -fprofile-generate  插入基本块计数器, 程序结束时把计数打印到标准输出末尾
+  // -fprofile-use 文件  按文件中的计数做基本块布局, 寄存器分配和函数特化
+  // -stream         每解析完一个函数就生成并写出它的代码, 内存占用不随输入增长
+  // -fbuffered-io   程序与 runtime/sysyrt.s 链接, 调用库函数时只保存它改写的寄存器
+  // -march=名字     目标指令集: rv32im (默认) 或 rv32imc (使用 16 位压缩指令)
+  cache_flags = "compiler " __DATE__ " " __TIME__;
+  for (int i = 5; i < argc; i++)
+  {
+    string opt = argv[i];
+    if (opt == "-cache" && i + 1 < argc)
+    {
+      if (!cache_open(argv[++i])) cerr << "warning: cache disabled" << endl;
+    }
+    else if (opt == "-cache-size" && i + 1 < argc)
+      cache_capacity = atoi(argv[++i]);
+    else if (opt == "-ftime-report") time_report = true;
+    else if (opt == "-stats") print_stats = true;
+    else if (opt == "-stats-json" && i + 1 < argc) stats_json = argv[++i];
+    else if (opt == "-flex-lexer") use_flex_lexer = true;
+    else if (opt.compare(0, 7, "-mtune=") == 0 && set_tune(opt.substr(7)))
+      cache_flags += " " + opt;
+    else if (opt == "-emit-obj") emit_obj = true;
+    else if (opt == "-verify-obj") emit_obj = verify_obj = true;
+    else if (opt == "-fprofile-generate")
+    {
+      profile_generate = true;
+      cache_flags += " " + opt;
+    }
+    else if (opt == "-fprofile-use" && i + 1 < argc)
+    {
+      string text;
+      if (!profile_load(argv[++i], text))
+      {
+        cerr << "error: cannot read profile " << argv[i] << endl;
+        return 1;
+      }
+      cache_flags += " -fprofile-use=" + cache_hash(text);
+    }
+    else if (opt == "-stream")
+    {
+      stream_compile = true;
+      cache_flags += " " + opt;
+    }
+    else if (opt == "-march=rv32im" || opt == "-march=rv32imc")
+    {
+      rvc = opt == "-march=rv32imc";
+      cache_flags += " " + opt;
+    }
+    else if (opt == "-fbuffered-io")
+    {
+      buffered_io = true;
+      cache_flags += " " + opt;
+    }
+    else
+    {
+      cerr << "error: unknown option " << opt << endl;
+      return 1;
+    }
+  }
+
+  count_allocs = time_report || print_stats || !stats_json.empty();
+
   // 打开输入文件, 并且指定 lexer 在解析的时候读取这个文件
-  yyin = fopen(input, "r");
-  assert(yyin);
+  // 优先把文件映射进内存走快速路径, 不能映射时交给 flex 读取
+  if (use_flex_lexer || !fast_lex_open(input))
+  {
+    yyin = fopen(input, "r");
+    assert(yyin);
+  }
+
+  // 流式编译时每个顶层定义在解析的同时生成代码, parser 的调试输出被丢弃
+  ostringstream stream_asm;
+  streambuf *stdout_buf = cout.rdbuf();
+  bool interp = mode[1] == 'i';
+  if (stream_compile && interp)
+  {
+    cerr << "error: -stream cannot be used with -interp" << endl;
+    return 1;
+  }
+  if (stream_compile)
+  {
+    freopen(output,"w",stdout);
+    cache_riscv = mode[1] != 'k';
+    stream_begin(cache_riscv, emit_obj && cache_riscv ? stream_asm.rdbuf() : stdout_buf);
+    cout.rdbuf(nullptr);
+  }
 
   // 调用 parser 函数, parser 函数会进一步调用 lexer 解析输入文件的
   unique_ptr<BaseAST> ast;
-  auto ret = yyparse(ast);
-  assert(!ret);
+  {
+    optional<PhaseTimer> timer;
+    if (!stream_compile) timer.emplace("parse");
+    auto ret = yyparse(ast);
+    assert(!ret);
+    fast_lex_close();
+  }
+  if (stream_compile)
+  {
+    cout.rdbuf(stdout_buf);
+    stream_finish();
+    if (emit_obj && cache_riscv && !write_obj(stream_asm.str())) return 1;
+    cout.flush();
+    if (!cache_dir.empty()) cache_evict();
+    report_stats();
+    return 0;
+  }
   if(mode[1]=='k')
   {
     freopen(output,"w",stdout);
 
-    ast->Dump();
+    {
+      PhaseTimer timer("koopa-emit");
+      ast->Dump();
+      cout.flush();
+    }
+    if (!cache_dir.empty()) cache_evict();
+    report_stats();
     return 0;
   }
+  // 解释执行需要每个函数的函数体, 不使用缓存的汇编
+  cache_riscv = !interp;
   freopen("whatever.txt","w",stdout);
 
-  ast->Dump();
-  cout<<endl;
-  FILE* ff=fopen("whatever.txt","r");
-  char *buf=(char *)malloc(10000000);
-  fread(buf, 1,10000000, ff);
+  {
+    PhaseTimer timer("koopa-emit");
+    ast->Dump();
+    cout<<endl;
+  }
+  char *buf;
+  {
+    PhaseTimer timer("ir-roundtrip");
+    FILE* ff=fopen("whatever.txt","r");
+    // 按文件实际大小分配, 大程序的 IR 可能超过 10MB
+    fseek(ff,0,SEEK_END);
+    long size=ftell(ff);
+    fseek(ff,0,SEEK_SET);
+    buf=(char *)malloc(size+1);
+    size_t len=fread(buf, 1,size, ff);
+    buf[len]=0;
+    fclose(ff);
+  }
   //cout<<buf;
   /*freopen("temps.txt","w",stdout);
   parse_string(buf,0);
@@ -54,7 +209,29 @@ int main(int argc, const char *argv[]) {
   deep=0;
   now_array=0;*/
   freopen(output,"w",stdout);
-  parse_string(buf);
+  if (interp)
+  {
+    int value = interp_string(buf);
+    report_stats();
+    return value & 0xff;
+  }
+  if (emit_obj)
+  {
+    // 汇编文本留在内存里, 直接编码成目标文件
+    string text;
+    {
+      ostringstream asm_buf;
+      auto old_buf = cout.rdbuf(asm_buf.rdbuf());
+      parse_string(buf);
+      cout.rdbuf(old_buf);
+      text = asm_buf.str();
+    }
+    if (!write_obj(text)) return 1;
+  }
+  else parse_string(buf);
+  cout.flush();
+  if (!cache_dir.empty()) cache_evict();
+  report_stats();
     
     return 0;
 
@@ -0,0 +1,59 @@
+#pragma once
+#include <cstdint>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+// 基于基本块计数的 profile 引导优化
+// -fprofile-generate: 每个基本块开头给自己的计数器加一, main 返回前调用生成的
+// __prof_dump, 经 putint/putch 在标准输出末尾打印 "#profile" 和 "键 次数" 各行,
+// 把程序的输出重定向到文件即得到 profile
+// -fprofile-use 文件: 读入计数, 用于基本块布局, 全局变量的寄存器分配权重
+// 和前端按调用热度做的函数特化
+// 键是 "函数名:基本块名" 的 31 位散列, 前端的输出是确定的, 两次编译的块名一致
+
+inline bool profile_generate = false;
+inline std::unordered_map<uint32_t, long long> profile_counts;   // 为空表示没有 profile
+
+inline uint32_t profile_key(std::string_view func, std::string_view block)
+{
+  uint32_t h = 2166136261u;
+  auto mix = [&](std::string_view s) {
+    for (unsigned char c : s) h = (h ^ c) * 16777619u;
+  };
+  mix(func);
+  mix(":");
+  mix(block);
+  return h & 0x7fffffff;
+}
+
+// 没有记录时返回 -1
+inline long long profile_count(std::string_view func, std::string_view block)
+{
+  auto it = profile_counts.find(profile_key(func, block));
+  return it == profile_counts.end() ? -1 : it->second;
+}
+
+// 读入 profile, 文件内容通过 text 返回, 供缓存计算键
+// 多次运行的输出可以拼接在一起, 同一个键的计数累加
+inline bool profile_load(const std::string &path, std::string &text)
+{
+  std::ifstream in(path, std::ios::binary);
+  if (!in) return false;
+  std::ostringstream buf;
+  buf << in.rdbuf();
+  text = buf.str();
+  size_t pos = 0;
+  while ((pos = text.find("#profile\n", pos)) != std::string::npos)
+  {
+    pos += 9;
+    std::istringstream lines(text.substr(pos));
+    long long key, count;
+    // 计数器是 32 位的, putint 把超过 2^31 的值打印成负数
+    while (lines >> key >> count)
+      profile_counts[key] += count < 0 ? count + (1ll << 32) : count;
+  }
+  return true;
+}
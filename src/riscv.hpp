@@ -3,22 +3,126 @@
 #include <string>
 #include <cassert>
 #include <map>
+#include <set>
+#include <unordered_map>
+#include <cstdint>
+#include <vector>
+#include <algorithm>
 #include <cmath>
+#include <sstream>
 #include "koopa.h"
+#include "cache.hpp"
+#include "stats.hpp"
+#include "sched.hpp"
+#include "profile.hpp"
+#include "rvc.hpp"
 
 
 struct Reg { int reg_name; int reg_offset; };
 std::string reg_names[16] = {"t0", "t1", "t2", "t3", "t4", "t5", "t6",
     "a0", "a1", "a2", "a3", "a4", "a5", "a6", "a7", "x0"};
-koopa_raw_value_t registers[16];
+// the parameters and instructions of the function being generated are
+// numbered densely up front; their state lives in values, indexed by number.
+// Integers and globals have no number. Numbers are looked up in an open
+// addressing table with twice as many entries as there are values
+struct ValueState
+{
+    koopa_raw_value_t value;
+    Reg var = {-1, -1};
+    bool bound = false;      // generated, var is valid
+    unsigned remaining = 0;  // uses not generated yet; at 0 the register is free
+    int slot = -1;           // frame offset of an alloc
+};
+std::vector<ValueState> values;
+std::vector<std::pair<koopa_raw_value_t, int>> value_ids;
+int value_id_bits = 0;
+// number of the value each register was last given to, -1 for none
+int registers[16];
+// 0: free, 1: holds a value that may be spilled, 2: locked by the current
+// instruction, 3: pinned to a local variable for the whole function
 int reg_stats[16] = {0};
 koopa_raw_value_t present_value = 0;
-std::map<const koopa_raw_value_t, Reg> value_map;
-int global_num = 0;
-std::map<const koopa_raw_value_t, std::string> global_values;
+int present_id = -1;
+std::unordered_map<koopa_raw_value_t, std::string> global_values;
 int stack_size = 0, stack_top = 0;
 bool restore_ra = false;
-
+std::string present_func;
+// globals that are used repeatedly in a function live in callee-saved
+// registers: scalars keep their value there and are written back only around
+// calls that may touch them and at returns; arrays keep their address
+std::string saved_reg_names[11] = {"s0", "s1", "s2", "s3", "s4", "s5", "s6",
+    "s7", "s8", "s9", "s10"};
+const int max_cached_globals = 10;
+std::map<koopa_raw_value_t, int> cached_globals;
+std::set<koopa_raw_value_t> dirty_globals;
+struct GlobalRefs
+{
+    std::set<koopa_raw_value_t> ref, mod;
+    bool unknown = false;  // body not visible, may touch any global
+};
+std::map<koopa_raw_function_t, GlobalRefs> func_globals;
+// globals no instruction ever writes to: emitted into .rodata, and loads
+// from them with constant indices become immediates
+std::set<koopa_raw_value_t> readonly_globals;
+// the block emitted right after the current one; jumps to it fall through
+koopa_raw_basic_block_t next_bb = nullptr;
+// -fprofile-generate: functions that own a counter table, and the keys of the
+// blocks counted so far in the current function
+std::vector<std::string> profile_tables;
+std::vector<uint32_t> profile_blocks;
+// -stream hands over one function per program. Analyses that need to see
+// every function are then off, functions from earlier programs are treated
+// as touching any global, and each global's data is emitted only once
+bool whole_program = true;
+std::set<std::string> external_funcs;
+std::set<std::string> emitted_globals;
+// if/else-if chains testing one variable against constants. The head block
+// (the first test) ends in a bounds check and a jump through a table in
+// .rodata when the cases are dense, otherwise in a binary search over them;
+// the blocks of the remaining tests are not emitted
+struct SwitchPlan
+{
+    koopa_raw_value_t load;     // the head's load of the variable
+    size_t test_start;          // where the head's test begins
+    std::vector<std::pair<int32_t, koopa_raw_basic_block_t>> cases;   // sorted
+    koopa_raw_basic_block_t default_bb;
+};
+const size_t min_switch_cases = 4;
+std::map<koopa_raw_basic_block_t, SwitchPlan> switch_plans;
+std::set<koopa_raw_basic_block_t> switch_absorbed;
+int switch_labels = 0;
+std::string switch_tables;
+// leaf functions keep scalar locals whose address never escapes in
+// caller-saved registers instead of stack slots
+const int max_pinned_locals = 7;
+std::map<koopa_raw_value_t, int> pinned_locals;
+// loads of a pinned local that may return its register: the local is not
+// stored to before their last use
+std::set<koopa_raw_value_t> direct_loads;
+// something went to the stack; a leaf generated without a frame is then
+// generated again with one
+bool frame_used = false;
+// ra is saved only on the paths that reach a call: at the start of a block
+// with a call that is not yet saved on entry, or at the end of blocks where
+// paths that have and have not saved it would join
+std::set<koopa_raw_basic_block_t> ra_save_start, ra_save_end, ra_saved;
+koopa_raw_basic_block_t present_bb = nullptr;
+// -fbuffered-io: the program is linked with runtime/sysyrt.s, whose functions
+// write only a0, a1 and t0-t2, so values in the other registers stay there
+// across calls to them
+bool buffered_io = false;
+const unsigned all_temps = 0x7fff;
+const unsigned runtime_clobbers = 1u << 0 | 1u << 1 | 1u << 2 | 1u << 7 | 1u << 8;
+// -march=rv32imc: a0-a5 are tried first, most compressed instructions can
+// only name x8-x15
+const int rvc_reg_order[15] = {7, 8, 9, 10, 11, 12, 0, 1, 2, 3, 4, 5, 6, 13, 14};
+// the frame from sp up: outgoing arguments, ra, the save slots of the
+// s-registers, scalar locals (the most used first), spill slots, then local
+// arrays (the most used per byte first). Objects beyond a 12-bit offset from
+// sp are reached through s-registers the cached globals leave free, each set
+// in the prologue to sp + offset and covering the 4096 bytes around it
+int save_area = 0, spill_start = 0;
+std::vector<std::pair<int, int>> frame_bases;
 
 void Visit(const koopa_raw_program_t &program);
 void Visit(const koopa_raw_slice_t &slice);
@@ -37,15 +141,78 @@ Reg Visit(const koopa_raw_get_elem_ptr_t &get_elem_ptr);
 Reg Visit(const koopa_raw_get_ptr_t &get_ptr);
 std::string Visit(const koopa_raw_global_alloc_t &global);
 int find_reg(int stat);
-void clear_registers(bool save_temps = true);
+void add_offset(int dest, int base, int offset);
+void clear_registers(bool save_temps = true, unsigned regs = all_temps);
+void release_value(koopa_raw_value_t value);
+void number_values(const koopa_raw_function_t &func);
+void reset_values();
+int value_id(koopa_raw_value_t value);
+void bind_value(int id, Reg var);
 int cal_size(const koopa_raw_type_t &ty);
-void init_aggregate(const koopa_raw_value_t &aggr);
+void init_aggregate(const koopa_raw_value_t &aggr, std::vector<int32_t> &words);
+std::string bb_label(const koopa_raw_basic_block_t &bb);
+void collect_global_refs(const koopa_raw_slice_t &funcs);
+void choose_cached_globals(const koopa_raw_function_t &func);
+void load_cached_global(koopa_raw_value_t global, int reg);
+void store_cached_global(koopa_raw_value_t global, int reg);
+int saved_reg_offset(int reg);
+int plan_frame(const koopa_raw_function_t &func);
+bool frame_base(int offset, std::string &base, int &imm);
+std::string frame_slot(int offset);
+std::string frame_addr(int offset);
+koopa_raw_value_t pointer_root(koopa_raw_value_t ptr);
+void find_readonly_globals(const koopa_raw_program_t &program);
+bool fold_global_load(koopa_raw_value_t src, int32_t &value);
+bool folded_address(koopa_raw_value_t ptr);
+bool offset_address(koopa_raw_value_t ptr, koopa_raw_value_t &base, int &offset);
+std::vector<double> block_weights(const koopa_raw_function_t &func);
+std::vector<koopa_raw_basic_block_t> layout_blocks(const koopa_raw_function_t &func);
+void find_switch_chains(const koopa_raw_function_t &func);
+bool switch_constant(koopa_raw_value_t value, uint32_t &key,
+    std::set<koopa_raw_value_t> &insts);
+bool switch_test(koopa_raw_basic_block_t bb, koopa_raw_value_t &load, int32_t &key,
+    size_t &test_start);
+void emit_switch(const SwitchPlan &plan);
+void emit_switch_tree(const SwitchPlan &plan, const std::string &value, size_t lo,
+    size_t hi, bool last);
+void emit_profile_dump();
+bool choose_pinned_locals(const koopa_raw_function_t &func);
+std::vector<koopa_raw_basic_block_t> block_succs(koopa_raw_basic_block_t bb);
+void plan_ra_saves(const koopa_raw_function_t &func);
+void emit_ra(bool save);
+bool runtime_call(koopa_raw_function_t callee);
+
+
+void parse_string(const char *str)
+{
+    koopa_program_t program;
+    koopa_raw_program_builder_t builder = koopa_new_raw_program_builder();
+    koopa_raw_program_t raw;
+    {
+        PhaseTimer timer("koopa-parse");
+        koopa_error_code_t ret = koopa_parse_from_string(str, &program);
+        assert(ret == KOOPA_EC_SUCCESS);
+        raw = koopa_build_raw_program(builder, program);
+        koopa_delete_program(program);
+    }
+    {
+        PhaseTimer timer("riscv-emit");
+        Visit(raw);
+    }
+    koopa_delete_raw_program_builder(builder);
+}
 
 
 void Visit(const koopa_raw_program_t &program)
 {
+    global_values.clear();
+    func_globals.clear();
+    readonly_globals.clear();
+    if (whole_program)find_readonly_globals(program);
     Visit(program.values);
+    collect_global_refs(program.funcs);
     Visit(program.funcs);
+    if (profile_generate && whole_program)emit_profile_dump();
 }
 
 
@@ -74,27 +241,40 @@ void Visit(const koopa_raw_slice_t &slice)
 
 void Visit(const koopa_raw_function_t &func)
 {
-    if (func->bbs.len == 0)return;
+    if (func->bbs.len == 0)
+    {
+        // the body of a cache hit is only declared in the IR
+        auto cached = cached_asm.find(func->name + 1);
+        if (cached != cached_asm.end())
+        {
+            std::cout << cached->second;
+            if (profile_generate)profile_tables.push_back(cached->first);
+        }
+        return;
+    }
+    present_func = func->name + 1;
+    std::ostringstream func_buf;
+    std::streambuf *old_buf = nullptr;
+    auto key = cache_keys.find(present_func);
+    if (key != cache_keys.end() || rvc)old_buf = std::cout.rdbuf(func_buf.rdbuf());
     std::cout << "\t.text" << std::endl;
     std::cout << "\t.globl " << (func->name + 1) << std::endl;
     std::cout << (func->name + 1) << ":" << std::endl;
     assert(stack_size == 0); assert(stack_top == 0);
+    number_values(func);
+    find_switch_chains(func);
+    bool all_pinned = choose_pinned_locals(func);
     int max_arg_num = 0;
     for (size_t i = 0; i < func->bbs.len; i++)
     {
         auto ptr = func->bbs.buffer[i];
         koopa_raw_basic_block_t bb =
             reinterpret_cast<koopa_raw_basic_block_t>(ptr);
+        if (switch_absorbed.count(bb))continue;
         for (size_t j = 0; j < bb->insts.len; j++)
         {
             ptr = bb->insts.buffer[j];
             koopa_raw_value_t inst = reinterpret_cast<koopa_raw_value_t>(ptr);
-            if (inst->ty->tag != KOOPA_RTT_UNIT)
-            {
-                if (inst->kind.tag == KOOPA_RVT_ALLOC)
-                    stack_size += cal_size(inst->ty->data.pointer.base);
-                else stack_size += 4;0
-            }
             if (inst->kind.tag == KOOPA_RVT_CALL)
             {
                 restore_ra = true;
@@ -103,92 +283,200 @@ void Visit(const koopa_raw_function_t &func)
             }
         }
     }
-    int arg_stack_size = 0;
-    if (max_arg_num > 8)arg_stack_size = (max_arg_num - 8) * 4;
-    stack_size += arg_stack_size;
-    stack_top += arg_stack_size;
-    if (restore_ra)stack_size += 4;
-    stack_size = ceil(stack_size / 16.0) * 16;
-    if (stack_size > 0 && stack_size <= 2048)
-        std::cout << "\taddi  sp, sp, -" << stack_size << std::endl;
-    else if (stack_size > 2048)
-    {
-        std::cout << "\tli    s11, -" << stack_size << std::endl;
-        std::cout << "\tadd   sp, sp, s11" << std::endl;
-    }
-    if (restore_ra)
+    // main calls the profile dump before returning
+    if (profile_generate && present_func == "main")restore_ra = true;
+    save_area = max_arg_num > 8 ? (max_arg_num - 8) * 4 : 0;
+    choose_cached_globals(func);
+    stack_size = plan_frame(func);
+    if (restore_ra)plan_ra_saves(func);
+    std::vector<koopa_raw_basic_block_t> layout = layout_blocks(func);
+    layout.erase(std::remove_if(layout.begin(), layout.end(),
+        [](koopa_raw_basic_block_t bb) { return switch_absorbed.count(bb) > 0; }),
+        layout.end());
+    // a leaf whose locals all got registers is first generated without a
+    // frame, and once more with one if the temporaries had to be spilled
+    int frame_size = stack_size;
+    auto bases = frame_bases;
+    long counters[] = {stat_ir_insts, stat_reg_spills, stat_s11_seqs,
+        stat_sched_cycles, stat_jump_tables, stat_switch_trees};
+    for (bool elide = all_pinned && !restore_ra && cached_globals.empty();;
+        elide = false)
     {
-        if (stack_size - 4 >= -2048 && stack_size - 4 <= 2047)
-            std::cout << "\tsw    ra, " << stack_size - 4 << "(sp)" <<
+        std::ostringstream body_buf;
+        std::streambuf *outer_buf = nullptr;
+        if (elide)outer_buf = std::cout.rdbuf(body_buf.rdbuf());
+        stack_size = elide ? 0 : frame_size;
+        stack_top = spill_start;
+        frame_bases = elide ? decltype(bases)() : bases;
+        frame_used = false;
+        for (auto &pinned : pinned_locals)reg_stats[pinned.second] = 3;
+        if (stack_size > 0 && stack_size <= 2048)
+            std::cout << "\taddi  sp, sp, -" << stack_size << std::endl;
+        else if (stack_size > 2048)
+        {
+            stat_s11_seqs++;
+            std::cout << "\tli    s11, -" << stack_size << std::endl;
+            std::cout << "\tadd   sp, sp, s11" << std::endl;
+        }
+        for (auto &cached : cached_globals)
+        {
+            store_cached_global(nullptr, cached.second);
+            load_cached_global(cached.first, cached.second);
+        }
+        for (auto &base : frame_bases)
+        {
+            stat_frame_bases++;
+            stat_s11_seqs++;
+            store_cached_global(nullptr, base.first);
+            std::cout << "\tli    s11, " << base.second << std::endl;
+            std::cout << "\tadd   " << saved_reg_names[base.first] << ", sp, s11" <<
                 std::endl;
-        else
+        }
+        for (size_t i = 0; i < func->params.len; i++)
         {
-            std::cout << "\tli    s11, " << stack_size - 4 << std::endl;
-            std::cout << "\tadd   s11, sp, s11" << std::endl;
-            std::cout << "\tsw    ra, (s11)" << std::endl;
+            auto ptr = func->params.buffer[i];
+            koopa_raw_value_t param = reinterpret_cast<koopa_raw_value_t>(ptr);
+            if (i < 8)
+            {
+                struct Reg param_var = { static_cast<int>(i + 7), -1 };
+                bind_value(value_id(param), param_var);
+                // reg_stats[i + 7] = 1;
+                // registers[i + 7] = param;
+                // for now param will only be used once at the beginning of a
+                // function and never used again, so we don't need to maintain
+                // the correct register states for it
+            }
+            else
+            {
+                int offset = stack_size + (i - 8) * 4;
+                struct Reg param_var = { -1, offset };
+                bind_value(value_id(param), param_var);
+            }
         }
-    }
-    for (size_t i = 0; i < func->params.len; i++)
-    {
-        auto ptr = func->params.buffer[i];
-        koopa_raw_value_t param = reinterpret_cast<koopa_raw_value_t>(ptr);
-        if (i < 8)
+        for (size_t i = 0; i < layout.size(); i++)
         {
-            struct Reg param_var = { static_cast<int>(i + 7), -1 };
-            value_map[param] = param_var;
-            // reg_stats[i + 7] = 1;
-            // registers[i + 7] = param;
-            // for now param will only be used once at the beginning of a
-            // function and never used again, so we don't need to maintain
-            // the correct register states for it
+            next_bb = i + 1 < layout.size() ? layout[i + 1] : nullptr;
+            Visit(layout[i]);
         }
-        else
+        next_bb = nullptr;
+        if (!elide)break;
+        std::cout.rdbuf(outer_buf);
+        if (!frame_used)
         {
-            int offset = stack_size + (i - 8) * 4;
-            struct Reg param_var = { -1, offset };
-            value_map[param] = param_var;
+            stat_frames_elided++;
+            std::cout << body_buf.str();
+            break;
         }
+        stat_ir_insts = counters[0]; stat_reg_spills = counters[1];
+        stat_s11_seqs = counters[2]; stat_sched_cycles = counters[3];
+        stat_jump_tables = counters[4]; stat_switch_trees = counters[5];
+        for (int i = 0; i < 16; i++)reg_stats[i] = 0;
+        reset_values();
+        switch_tables.clear();
+        switch_labels = 0;
+        profile_blocks.clear();
+    }
+    std::cout << switch_tables;
+    switch_tables.clear();
+    switch_plans.clear();
+    switch_absorbed.clear();
+    switch_labels = 0;
+    pinned_locals.clear();
+    direct_loads.clear();
+    ra_save_start.clear();
+    ra_save_end.clear();
+    ra_saved.clear();
+    if (profile_generate)
+    {
+        // counter table: the number of blocks, then a (key, count) pair each
+        std::cout << "\t.data" << std::endl;
+        std::cout << ".Lprof." << present_func << ":" << std::endl;
+        std::cout << "\t.word " << profile_blocks.size() << std::endl;
+        for (uint32_t key : profile_blocks)
+            std::cout << "\t.word " << key << std::endl << "\t.word 0" << std::endl;
+        profile_tables.push_back(present_func);
+        profile_blocks.clear();
     }
-    Visit(func->bbs);
     stack_size = stack_top = 0;
+    frame_bases.clear();
     for (int i = 0; i < 16; i++)reg_stats[i] = 0;
-    value_map.clear();
+    value_ids.clear();
+    values.clear();
+    cached_globals.clear();
+    dirty_globals.clear();
     restore_ra = false;
     std::cout << std::endl;
+    if (old_buf)
+    {
+        std::cout.rdbuf(old_buf);
+        std::string text = rvc ? rvc_compress(func_buf.str()) : func_buf.str();
+        if (key != cache_keys.end())cache_store(key->second, ".S", text);
+        std::cout << text;
+    }
 }
 
 
 void Visit(const koopa_raw_basic_block_t &bb)
 {
-    std::cout << bb->name + 1 << ":" << std::endl;
-    Visit(bb->insts);
+    std::cout << bb_label(bb) << ":" << std::endl;
+    stat_ir_insts += bb->insts.len;
+    if (profile_generate)
+    {
+        // t0 and s11 hold nothing at the start of a block
+        std::cout << "\tla    s11, .Lprof." << present_func << "+" <<
+            8 * profile_blocks.size() + 8 << std::endl;
+        std::cout << "\tlw    t0, 0(s11)" << std::endl;
+        std::cout << "\taddi  t0, t0, 1" << std::endl;
+        std::cout << "\tsw    t0, 0(s11)" << std::endl;
+        profile_blocks.push_back(profile_key(present_func, bb->name));
+    }
+    present_bb = bb;
+    if (ra_save_start.count(bb))emit_ra(true);
+    auto plan = switch_plans.find(bb);
+    auto visit_insts = [&]() {
+        size_t end = plan == switch_plans.end() ? bb->insts.len :
+            plan->second.test_start;
+        if (ra_save_end.count(bb) && plan == switch_plans.end())end--;
+        for (size_t i = 0; i < end; i++)
+            Visit(reinterpret_cast<koopa_raw_value_t>(bb->insts.buffer[i]));
+        if (ra_save_end.count(bb))emit_ra(true);
+        if (plan != switch_plans.end())emit_switch(plan->second);
+        else if (end < bb->insts.len)
+            Visit(reinterpret_cast<koopa_raw_value_t>(bb->insts.buffer[end]));
+    };
+    if (!tune_model)
+    {
+        visit_insts();
+        return;
+    }
+    // buffer the block so that it can be scheduled for the pipeline model
+    std::ostringstream bb_buf;
+    std::streambuf *old_buf = std::cout.rdbuf(bb_buf.rdbuf());
+    visit_insts();
+    std::cout.rdbuf(old_buf);
+    std::cout << schedule_block(bb_buf.str());
 }
 
 
 Reg Visit(const koopa_raw_value_t &value)
 {
     koopa_raw_value_t old_value = present_value;
+    int old_id = present_id, id = value_id(value);
     present_value = value;
-    if (value_map.count(value))
+    present_id = id;
+    if (id >= 0 && values[id].bound)
     {
-        if (value_map[value].reg_name == -1)
+        if (values[id].var.reg_name == -1)
         {
             int reg_name = find_reg(1);
-            value_map[value].reg_name = reg_name;
-            int reg_offset = value_map[value].reg_offset;
-            if (reg_offset >= -2048 && reg_offset <= 2047)
-                std::cout << "\tlw    " << reg_names[reg_name] << ", " <<
-                    reg_offset << "(sp)" << std::endl;
-            else
-            {
-                std::cout << "\tli    s11, " << reg_offset << std::endl;
-                std::cout << "\tadd   s11, sp, s11" << std::endl;
-                std::cout << "\tlw    " << reg_names[reg_name] << ", (s11)" <<
-                    std::endl;
-            }
+            values[id].var.reg_name = reg_name;
+            std::string slot = frame_addr(values[id].var.reg_offset);
+            std::cout << "\tlw    " << reg_names[reg_name] << ", " << slot <<
+                std::endl;
         }
         present_value = old_value;
-        return value_map[value];
+        present_id = old_id;
+        return values[id].var;
     }
 
     const auto &kind = value->kind;
@@ -203,21 +491,21 @@ Reg Visit(const koopa_raw_value_t &value)
         break;
     case KOOPA_RVT_BINARY:
         result_var = Visit(kind.data.binary);
-        value_map[value] = result_var;
+        bind_value(id, result_var);
         assert(result_var.reg_name >= 0);
         break;
     case KOOPA_RVT_ALLOC:
-        result_var.reg_offset = stack_top;
-        assert(value->ty->tag == KOOPA_RTT_POINTER);
-        stack_top += cal_size(value->ty->data.pointer.base);
-        value_map[value] = result_var;
+        if (pinned_locals.count(value))break;
+        assert(values[id].slot >= 0);
+        result_var.reg_offset = values[id].slot;
+        bind_value(id, result_var);
         break;
     case KOOPA_RVT_GLOBAL_ALLOC:
         global_values[value] = Visit(kind.data.global_alloc);
         break;
     case KOOPA_RVT_LOAD:
         result_var = Visit(kind.data.load);
-        value_map[value] = result_var;
+        bind_value(id, result_var);
         assert(result_var.reg_name >= 0);
         break;
     case KOOPA_RVT_STORE:
@@ -227,24 +515,36 @@ Reg Visit(const koopa_raw_value_t &value)
         Visit(kind.data.branch);
         break;
     case KOOPA_RVT_GET_ELEM_PTR:
+    {
+        // only feeds loads that are folded to constants, or loads and stores
+        // that take the constant offset themselves
+        koopa_raw_value_t base;
+        int offset;
+        if (folded_address(value) || offset_address(value, base, offset))break;
         result_var = Visit(kind.data.get_elem_ptr);
-        value_map[value] = result_var;
+        bind_value(id, result_var);
         assert(result_var.reg_name >= 0);
         break;
+    }
     case KOOPA_RVT_GET_PTR:
+    {
+        koopa_raw_value_t base;
+        int offset;
+        if (offset_address(value, base, offset))break;
         result_var = Visit(kind.data.get_ptr);
-        value_map[value] = result_var;
+        bind_value(id, result_var);
         assert(result_var.reg_name >= 0);
         break;
+    }
     case KOOPA_RVT_JUMP:
         Visit(kind.data.jump);
         break;
     case KOOPA_RVT_CALL:
         result_var = Visit(kind.data.call);
-        value_map[value] = result_var;
+        bind_value(id, result_var);
         if (value->ty->tag != KOOPA_RTT_UNIT)  // has ret
         {
-            registers[result_var.reg_name] = value;
+            registers[result_var.reg_name] = id;
             reg_stats[result_var.reg_name] = 1;
         }
         assert(result_var.reg_name >= 0);
@@ -253,6 +553,7 @@ Reg Visit(const koopa_raw_value_t &value)
         assert(false);
     }
     present_value = old_value;
+    present_id = old_id;
     return result_var;
 }
 
@@ -268,19 +569,17 @@ void Visit(const koopa_raw_return_t &ret)
             std::cout << "\tmv    a0, " << reg_names[result_var.reg_name] <<
                 std::endl;
     }
+    if (profile_generate && present_func == "main")
+        std::cout << "\tcall  .Lprof_dump" << std::endl;
     clear_registers(false);
-    if (restore_ra)
+    for (auto &cached : cached_globals)
     {
-        if (stack_size - 4 >= -2048 && stack_size - 4 <= 2047)
-            std::cout << "\tlw    ra, " << stack_size - 4 << "(sp)" <<
-                std::endl;
-        else
-        {
-            std::cout << "\tli    t0, " << stack_size - 4 << std::endl;
-            std::cout << "\tadd   t0, sp, t0" << std::endl;
-            std::cout << "\tlw    ra, (t0)" << std::endl;
-        }
+        if (dirty_globals.count(cached.first))
+            store_cached_global(cached.first, cached.second);
+        load_cached_global(nullptr, cached.second);
     }
+    for (auto &base : frame_bases)load_cached_global(nullptr, base.first);
+    if (ra_saved.count(present_bb))emit_ra(false);
     if (stack_size > 0 && stack_size <= 2047)
         std::cout << "\taddi  sp, sp, " << stack_size << std::endl;
     else if (stack_size > 2047)
@@ -313,10 +612,13 @@ Reg Visit(const koopa_raw_binary_t &binary)
     struct Reg right_val = Visit(binary.rhs);
     int right_reg = right_val.reg_name;
     reg_stats[left_reg] = old_stat;
+    // the result may take the register of an operand used for the last time
+    release_value(binary.lhs);
+    if (binary.rhs != binary.lhs)release_value(binary.rhs);
     old_stat = reg_stats[right_reg];
-    reg_stats[right_reg] = 2;
+    if (old_stat)reg_stats[right_reg] = 2;
     struct Reg result_var = {find_reg(1), -1};
-    reg_stats[right_reg] = old_stat;
+    if (old_stat)reg_stats[right_reg] = old_stat;
     std::string left_name = reg_names[left_reg];
     std::string right_name = reg_names[right_reg];
     std::string result_name = reg_names[result_var.reg_name];
@@ -379,6 +681,15 @@ Reg Visit(const koopa_raw_binary_t &binary)
             << std::endl;
         break;
     case 6:  // add
+        if (left_name == "x0" || right_name == "x0")
+        {
+            // a constant or a copy; nothing to do if it already is in place
+            std::string other = left_name == "x0" ? right_name : left_name;
+            if (other != result_name)
+                std::cout << "\tmv    " << result_name << ", " << other <<
+                    std::endl;
+            break;
+        }
         std::cout << "\tadd   " << result_name << ", " << left_name << ", " <<
             right_name << std::endl;
         break;
@@ -416,6 +727,32 @@ Reg Visit(const koopa_raw_binary_t &binary)
 Reg Visit(const koopa_raw_load_t &load)
 {
     koopa_raw_value_t src = load.src;
+    auto pinned = pinned_locals.find(src);
+    if (pinned != pinned_locals.end())
+    {
+        if (direct_loads.count(present_value))return {pinned->second, -1};
+        struct Reg result_var = {find_reg(1), -1};
+        std::cout << "\tmv    " << reg_names[result_var.reg_name] << ", " <<
+            reg_names[pinned->second] << std::endl;
+        return result_var;
+    }
+    int32_t folded;
+    if (fold_global_load(src, folded))
+    {
+        if (folded == 0)return {15, -1};
+        struct Reg result_var = {find_reg(1), -1};
+        std::cout << "\tli    " << reg_names[result_var.reg_name] << ", " <<
+            folded << std::endl;
+        return result_var;
+    }
+    if (cached_globals.count(src))
+    {
+        // copy out, later stores to the global must not change this value
+        struct Reg result_var = {find_reg(1), -1};
+        std::cout << "\tmv    " << reg_names[result_var.reg_name] << ", " <<
+            saved_reg_names[cached_globals[src]] << std::endl;
+        return result_var;
+    }
     if (src->kind.tag == KOOPA_RVT_GLOBAL_ALLOC)
     {
         int reg_name = find_reg(1);
@@ -426,6 +763,25 @@ Reg Visit(const koopa_raw_load_t &load)
             reg_names[reg_name] << ")" << std::endl;
         return result_var;
     }
+    koopa_raw_value_t base;
+    int offset;
+    if (offset_address(src, base, offset))
+    {
+        std::string addr = frame_slot(offset);
+        int base_reg = -1, base_old_stat;
+        if (base)
+        {
+            base_reg = Visit(base).reg_name;
+            base_old_stat = reg_stats[base_reg];
+            reg_stats[base_reg] = 2;
+            addr = std::to_string(offset) + "(" + reg_names[base_reg] + ")";
+        }
+        struct Reg result_var = {find_reg(1), -1};
+        if (base_reg >= 0)reg_stats[base_reg] = base_old_stat;
+        std::cout << "\tlw    " << reg_names[result_var.reg_name] << ", " <<
+            addr << std::endl;
+        return result_var;
+    }
     else if (src->kind.tag == KOOPA_RVT_GET_ELEM_PTR ||
         src->kind.tag == KOOPA_RVT_GET_PTR)
     {
@@ -437,19 +793,12 @@ Reg Visit(const koopa_raw_load_t &load)
         return result_var;
     }
     // we have to make sure one offset is at most loaded to one register
-    if (value_map[src].reg_name >= 0)return value_map[src];
-    int reg_name = find_reg(1), reg_offset = value_map[src].reg_offset;
+    const Reg &src_var = values[value_id(src)].var;
+    if (src_var.reg_name >= 0)return src_var;
+    int reg_name = find_reg(1), reg_offset = src_var.reg_offset;
     struct Reg result_var = {reg_name, reg_offset};
-    if (reg_offset >= -2048 && reg_offset <= 2047)
-        std::cout << "\tlw    " << reg_names[reg_name] << ", " << reg_offset <<
-            "(sp)" << std::endl;
-    else
-    {
-        std::cout << "\tli    s11, " << reg_offset << std::endl;
-        std::cout << "\tadd   s11, s11, sp" << std::endl;
-        std::cout << "\tlw    " << reg_names[reg_name] << ", (s11)" <<
-            std::endl;
-    }
+    std::string slot = frame_addr(reg_offset);
+    std::cout << "\tlw    " << reg_names[reg_name] << ", " << slot << std::endl;
     return result_var;
 }
 
@@ -459,6 +808,20 @@ void Visit(const koopa_raw_store_t &store)
     struct Reg value = Visit(store.value);
     koopa_raw_value_t dest = store.dest;
     assert(value.reg_name >= 0);
+    auto pinned = pinned_locals.find(dest);
+    if (pinned != pinned_locals.end())
+    {
+        if (value.reg_name != pinned->second)
+            std::cout << "\tmv    " << reg_names[pinned->second] << ", " <<
+                reg_names[value.reg_name] << std::endl;
+        return;
+    }
+    if (cached_globals.count(dest))
+    {
+        std::cout << "\tmv    " << saved_reg_names[cached_globals[dest]] <<
+            ", " << reg_names[value.reg_name] << std::endl;
+        return;
+    }
     if (dest->kind.tag == KOOPA_RVT_GLOBAL_ALLOC)
     {
         std::cout << "\tla    s11, " << global_values[dest] << std::endl;
@@ -466,6 +829,22 @@ void Visit(const koopa_raw_store_t &store)
             std::endl;
         return;
     }
+    koopa_raw_value_t base;
+    int offset;
+    if (offset_address(dest, base, offset))
+    {
+        std::string addr = frame_slot(offset);
+        if (base)
+        {
+            int old_stat = reg_stats[value.reg_name];
+            reg_stats[value.reg_name] = 2;
+            addr = std::to_string(offset) + "(" + reg_names[Visit(base).reg_name] + ")";
+            reg_stats[value.reg_name] = old_stat;
+        }
+        std::cout << "\tsw    " << reg_names[value.reg_name] << ", " << addr <<
+            std::endl;
+        return;
+    }
     else if (dest->kind.tag == KOOPA_RVT_GET_ELEM_PTR ||
         dest->kind.tag == KOOPA_RVT_GET_PTR)
     {
@@ -478,51 +857,52 @@ void Visit(const koopa_raw_store_t &store)
             reg_names[dest_var.reg_name] << ")" << std::endl;
         return;
     }
-    assert(value_map.count(dest));
-    if (value_map[dest].reg_offset == -1)
+    int dest_id = value_id(dest);
+    assert(dest_id >= 0 && values[dest_id].bound);
+    Reg &dest_var = values[dest_id].var;
+    if (dest_var.reg_offset == -1)
     {
-        value_map[dest].reg_offset = stack_top;
+        dest_var.reg_offset = stack_top;
         stack_top += 4;
     }
     else  // old register loaded from reg_offset is outdated ...
         for (int i = 0; i < 16; i++)
-            if (i == value.reg_name)continue;
-            else if (reg_stats[i] > 0 && value_map[registers[i]].reg_offset ==
-                value_map[dest].reg_offset)
+            if (i == value.reg_name || registers[i] < 0)continue;
+            else if ((reg_stats[i] == 1 || reg_stats[i] == 2) &&
+                values[registers[i]].var.reg_offset == dest_var.reg_offset)
             {
-                reg_stats[i] = 0;  // ... so clear it and update value_map
-                value_map[registers[i]].reg_name = value.reg_name;
+                reg_stats[i] = 0;  // ... so clear it and update its state
+                values[registers[i]].var.reg_name = value.reg_name;
             }
-    int reg_name = value.reg_name, reg_offset = value_map[dest].reg_offset;
-    if (reg_offset >= -2048 && reg_offset <= 2047)
-        std::cout << "\tsw    " << reg_names[reg_name] << ", " << reg_offset <<
-            "(sp)" << std::endl;
-    else
-    {
-        std::cout << "\tli    s11, " << reg_offset << std::endl;
-        std::cout << "\tadd   s11, s11, sp" << std::endl;
-        std::cout << "\tsw    " << reg_names[reg_name] << ", (s11)" <<
-            std::endl;
-    }
+    std::string slot = frame_addr(dest_var.reg_offset);
+    std::cout << "\tsw    " << reg_names[value.reg_name] << ", " << slot << std::endl;
 }
 
 
 void Visit(const koopa_raw_branch_t &branch)
 {
-    std::string true_label = branch.true_bb->name + 1;
-    std::string false_label = branch.false_bb->name + 1;
+    std::string true_label = bb_label(branch.true_bb);
+    std::string false_label = bb_label(branch.false_bb);
     int cond_reg = Visit(branch.cond).reg_name;
     clear_registers(false);
+    if (branch.true_bb == next_bb && branch.false_bb != next_bb)
+    {
+        std::cout << "\tbeqz  " << reg_names[cond_reg] << ", " << false_label
+            << std::endl;
+        return;
+    }
     std::cout << "\tbnez  " << reg_names[cond_reg] << ", " << true_label
         << std::endl;
-    std::cout << "\tj     " << false_label << std::endl;
+    if (branch.false_bb != next_bb)
+        std::cout << "\tj     " << false_label << std::endl;
 }
 
 
 void Visit(const koopa_raw_jump_t &jump)
 {
     clear_registers(false);
-    std::string target_label = jump.target->name + 1;
+    if (jump.target == next_bb)return;
+    std::string target_label = bb_label(jump.target);
     std::cout << "\tj     " << target_label << std::endl;
 }
 
@@ -530,7 +910,8 @@ void Visit(const koopa_raw_jump_t &jump)
 Reg Visit(const koopa_raw_call_t &call)
 {
     struct Reg result_var = { 7, -1 };
-    clear_registers();
+    unsigned clobbered = runtime_call(call.callee) ? runtime_clobbers : all_temps;
+    clear_registers(true, clobbered);
     std::vector<int> old_stats;
     for (size_t i = 0; i < call.args.len; i++)
     {
@@ -546,47 +927,58 @@ Reg Visit(const koopa_raw_call_t &call)
             old_stats.push_back(reg_stats[i + 7]);
             reg_stats[i + 7] = 2;
         }
-        else if ((i - 8) * 4 >= -2048 && (i - 8) * 4 <= 2047)
-            std::cout << "\tsw    " << reg_names[arg_var.reg_name] << ", " <<
-                (i - 8) * 4 << "(sp)" << std::endl;
         else
         {
-            std::cout << "\tli    s11, " << (i - 8) * 4 << std::endl;
-            std::cout << "\tadd   s11, s11, sp" << std::endl;
-            std::cout << "\tsw    " << reg_names[arg_var.reg_name] << ", (s11)"
-                << std::endl;
+            std::string slot = frame_addr((i - 8) * 4);
+            std::cout << "\tsw    " << reg_names[arg_var.reg_name] << ", " << slot <<
+                std::endl;
         }
     }
     for (int i = 0; i < old_stats.size(); i++)reg_stats[i + 7] = old_stats[i];
+    const GlobalRefs &refs = func_globals[call.callee];
+    for (auto &cached : cached_globals)
+        if (dirty_globals.count(cached.first) && (refs.unknown ||
+            refs.ref.count(cached.first) || refs.mod.count(cached.first)))
+            store_cached_global(cached.first, cached.second);
     std::cout << "\tcall  " << call.callee->name + 1 << std::endl;
-    clear_registers(false);
+    // a cached array holds its address, which no call can change
+    for (auto &cached : cached_globals)
+        if ((refs.unknown || refs.mod.count(cached.first)) &&
+            cached.first->ty->data.pointer.base->tag != KOOPA_RTT_ARRAY)
+            load_cached_global(cached.first, cached.second);
+    clear_registers(false, clobbered);
     return result_var;
 }
 
 
 std::string Visit(const koopa_raw_global_alloc_t &global)
 {
-    std::string name = "var_" + std::to_string(global_num++);
-    std::cout << "\t.data" << std::endl;
+    std::string name = present_value->name + 1;
+    if (!emitted_globals.insert(name).second)return name;
+    std::vector<int32_t> words;
+    init_aggregate(global.init, words);
+    bool zero = true;
+    for (int32_t word : words)zero &= word == 0;
+    if (zero)std::cout << "\t.bss" << std::endl;
+    else if (readonly_globals.count(present_value))
+        std::cout << "\t.section .rodata" << std::endl;
+    else std::cout << "\t.data" << std::endl;
     std::cout << "\t.globl " << name << std::endl;
     std::cout << name << ":" << std::endl;
-    switch (global.init->kind.tag)
+    // runs of zeros become one .zero
+    for (size_t i = 0; i < words.size();)
     {
-    case KOOPA_RVT_ZERO_INIT:
-        std::cout << "\t.zero " << cal_size(global.init->ty) << std::endl <<
-            std::endl;
-        break;
-    case KOOPA_RVT_INTEGER:
-        std::cout << "\t.word " << global.init->kind.data.integer.value <<
-            std::endl << std::endl;
-        break;
-    case KOOPA_RVT_AGGREGATE:
-        init_aggregate(global.init);
-        std::cout << std::endl;
-        break;
-    default:
-        assert(false);
+        size_t j = i;
+        while (j < words.size() && words[j] == 0)j++;
+        if (j > i)
+        {
+            std::cout << "\t.zero " << (j - i) * 4 << std::endl;
+            i = j;
+            continue;
+        }
+        std::cout << "\t.word " << words[i++] << std::endl;
     }
+    std::cout << std::endl;
     return name;
 }
 
@@ -601,30 +993,48 @@ Reg Visit(const koopa_raw_get_elem_ptr_t &get_elem_ptr)
         int total_size = cal_size(arr), len = arr->data.array.len;
         assert(total_size % len == 0);
         int elem_size = total_size / len;
+        if (get_elem_ptr.index->kind.tag == KOOPA_RVT_INTEGER &&
+            !cached_globals.count(get_elem_ptr.src))
+        {
+            int offset = elem_size * get_elem_ptr.index->kind.data.integer.value;
+            reg_stats[result_var.reg_name] = 1;
+            std::cout << "\tla    " << reg_names[result_var.reg_name] << ", " <<
+                global_values[get_elem_ptr.src];
+            if (offset)std::cout << "+" << offset;
+            std::cout << std::endl;
+            return result_var;
+        }
         struct Reg ind_var = Visit(get_elem_ptr.index);
         int ind_reg = ind_var.reg_name;
         reg_stats[result_var.reg_name] = 1;
-        std::cout << "\tla    " << reg_names[result_var.reg_name] << ", " <<
-            global_values[get_elem_ptr.src] << std::endl;
+        std::string base = reg_names[result_var.reg_name];
+        if (cached_globals.count(get_elem_ptr.src))
+            base = saved_reg_names[cached_globals[get_elem_ptr.src]];
+        else
+            std::cout << "\tla    " << base << ", " <<
+                global_values[get_elem_ptr.src] << std::endl;
         std::cout << "\tli    s11, " << elem_size << std::endl;
         std::cout << "\tmul   s11, s11, " << reg_names[ind_reg] << std::endl;
         std::cout << "\tadd   " << reg_names[result_var.reg_name] << ", " <<
-            reg_names[result_var.reg_name] << ", s11" << std::endl;
+            base << ", s11" << std::endl;
         return result_var;
     }
-    struct Reg src_var = value_map[get_elem_ptr.src];
+    struct Reg src_var = {-1, -1};
+    if (value_id(get_elem_ptr.src) >= 0)src_var = values[value_id(get_elem_ptr.src)].var;
     koopa_raw_type_t arr = get_elem_ptr.src->ty->data.pointer.base;
     struct Reg result_var = {find_reg(2), -1};
-    int src_reg, src_old_stat;
+    int src_reg = -1, src_old_stat = 0;
     if (get_elem_ptr.src->name && get_elem_ptr.src->name[0] == '@')
     {
-        int offset = src_var.reg_offset;
+        int offset = src_var.reg_offset, imm;
         assert(offset >= 0);  // variables have positive offset
-        if (offset >= -2048 && offset <= 2047)
-            std::cout << "\taddi  " << reg_names[result_var.reg_name] <<
-                ", sp, " << offset << std::endl;
+        std::string frame_reg;
+        if (frame_base(offset, frame_reg, imm))
+            std::cout << "\taddi  " << reg_names[result_var.reg_name] << ", " <<
+                frame_reg << ", " << imm << std::endl;
         else
         {
+            stat_s11_seqs++;
             std::cout << "\tli    s11, " << offset << std::endl;
             std::cout << "\tadd   " << reg_names[result_var.reg_name] <<
                 ", sp, s11" << std::endl;
@@ -641,6 +1051,16 @@ Reg Visit(const koopa_raw_get_elem_ptr_t &get_elem_ptr)
     int total_size = cal_size(arr), len = arr->data.array.len;
     assert(total_size % len == 0);
     int elem_size = total_size / len;
+    if (get_elem_ptr.index->kind.tag == KOOPA_RVT_INTEGER)
+    {
+        // constant index: fold the offset into a single add
+        bool local = get_elem_ptr.src->name && get_elem_ptr.src->name[0] == '@';
+        add_offset(result_var.reg_name, local ? result_var.reg_name : src_reg,
+            elem_size * get_elem_ptr.index->kind.data.integer.value);
+        reg_stats[result_var.reg_name] = 1;
+        if (!local)reg_stats[src_reg] = src_old_stat;
+        return result_var;
+    }
     struct Reg ind_var = Visit(get_elem_ptr.index), tmp_var;
     if (elem_size != 0 && ind_var.reg_name != 15)
     {
@@ -674,10 +1094,22 @@ Reg Visit(const koopa_raw_get_elem_ptr_t &get_elem_ptr)
 
 Reg Visit(const koopa_raw_get_ptr_t &get_ptr)
 {
-    struct Reg src_var = value_map[get_ptr.src];
+    // the source may have been spilled since it was computed
+    struct Reg src_var = Visit(get_ptr.src);
+    assert(src_var.reg_name >= 0);
+    int src_old_stat = reg_stats[src_var.reg_name];
+    reg_stats[src_var.reg_name] = 2;
     koopa_raw_type_t arr = get_ptr.src->ty->data.pointer.base;
     struct Reg result_var = {find_reg(2), -1};
     int elem_size = cal_size(arr);
+    if (get_ptr.index->kind.tag == KOOPA_RVT_INTEGER)
+    {
+        add_offset(result_var.reg_name, src_var.reg_name,
+            elem_size * get_ptr.index->kind.data.integer.value);
+        reg_stats[result_var.reg_name] = 1;
+        reg_stats[src_var.reg_name] = src_old_stat;
+        return result_var;
+    }
     struct Reg ind_var = Visit(get_ptr.index), tmp_var;
     if (elem_size != 0 && ind_var.reg_name != 15)
     {
@@ -697,42 +1129,60 @@ Reg Visit(const koopa_raw_get_ptr_t &get_ptr)
     std::cout << "\tadd   " << reg_names[result_var.reg_name] << ", " <<
         reg_names[src_var.reg_name] << ", " <<
         reg_names[tmp_var.reg_name] << std::endl;
+    reg_stats[src_var.reg_name] = src_old_stat;
     return result_var;
 }
 
 
+// dest = base + offset
+void add_offset(int dest, int base, int offset)
+{
+    if (offset >= -2048 && offset <= 2047)
+    {
+        if (offset != 0 || dest != base)
+            std::cout << "\taddi  " << reg_names[dest] << ", " << reg_names[base] <<
+                ", " << offset << std::endl;
+        return;
+    }
+    stat_s11_seqs++;
+    std::cout << "\tli    s11, " << offset << std::endl;
+    std::cout << "\tadd   " << reg_names[dest] << ", " << reg_names[base] <<
+        ", s11" << std::endl;
+}
+
+
 int find_reg(int stat)
 {
-    for (int i = 0; i < 15; i++)
+    for (int k = 0; k < 15; k++)
+    {
+        int i = rvc ? rvc_reg_order[k] : k;
         if (reg_stats[i] == 0)
         {
-            registers[i] = present_value;
+            registers[i] = present_id;
             reg_stats[i] = stat;
             return i;
         }
-    for (int i = 0; i < 15; i++)
+    }
+    for (int k = 0; k < 15; k++)
     {
+        int i = rvc ? rvc_reg_order[k] : k;
         if (reg_stats[i] == 1)
         {
-            value_map[registers[i]].reg_name = -1;
-            int offset = value_map[registers[i]].reg_offset;
-            if (offset == -1)
-            {
-                offset = stack_top;
-                stack_top += 4;
-                value_map[registers[i]].reg_offset = offset;
-            }
-            if (offset >= -2048 && offset <= 2047)
-                std::cout << "\tsw    " << reg_names[i] << ", " << offset <<
-                    "(sp)" << std::endl;
-            else
+            if (registers[i] >= 0)
             {
-                std::cout << "\tli    s11, " << offset << std::endl;
-                std::cout << "\tadd   s11, s11, sp" << std::endl;
-                std::cout << "\tsw    " << reg_names[i] << ", (s11)" <<
-                    std::endl;
+                stat_reg_spills++;
+                frame_used = true;
+                Reg &var = values[registers[i]].var;
+                var.reg_name = -1;
+                if (var.reg_offset == -1)
+                {
+                    var.reg_offset = stack_top;
+                    stack_top += 4;
+                }
+                std::string slot = frame_addr(var.reg_offset);
+                std::cout << "\tsw    " << reg_names[i] << ", " << slot << std::endl;
             }
-            registers[i] = present_value;
+            registers[i] = present_id;
             reg_stats[i] = stat;
             return i;
         }
@@ -742,30 +1192,111 @@ int find_reg(int stat)
 }
 
 
-void clear_registers(bool save_temps)
+// called once per use of value after the user has read it
+void release_value(koopa_raw_value_t value)
+{
+    int id = value_id(value);
+    if (id < 0)return;
+    ValueState &state = values[id];
+    if (state.remaining > 0 && --state.remaining > 0)return;
+    if (!state.bound)return;
+    int reg = state.var.reg_name;
+    if (reg < 0 || reg >= 15 || reg_stats[reg] != 1 || registers[reg] != id)return;
+    reg_stats[reg] = 0;
+    state.var.reg_name = -1;
+}
+
+
+// numbers the parameters and instructions of func and sets their state up
+void number_values(const koopa_raw_function_t &func)
+{
+    size_t count = func->params.len;
+    for (size_t i = 0; i < func->bbs.len; i++)
+        count += reinterpret_cast<koopa_raw_basic_block_t>(func->bbs.buffer[i])->insts.len;
+    values.clear();
+    values.reserve(count);
+    for (size_t i = 0; i < func->params.len; i++)
+        values.push_back({reinterpret_cast<koopa_raw_value_t>(func->params.buffer[i])});
+    for (size_t i = 0; i < func->bbs.len; i++)
+    {
+        auto bb = reinterpret_cast<koopa_raw_basic_block_t>(func->bbs.buffer[i]);
+        for (size_t j = 0; j < bb->insts.len; j++)
+            values.push_back({reinterpret_cast<koopa_raw_value_t>(bb->insts.buffer[j])});
+    }
+    value_id_bits = 4;
+    while ((size_t)1 << value_id_bits < 2 * values.size())value_id_bits++;
+    value_ids.assign((size_t)1 << value_id_bits, {nullptr, -1});
+    size_t mask = value_ids.size() - 1;
+    for (size_t id = 0; id < values.size(); id++)
+    {
+        size_t h = (reinterpret_cast<uintptr_t>(values[id].value) *
+            0x9e3779b97f4a7c15ull) >> (64 - value_id_bits);
+        while (value_ids[h].first)h = (h + 1) & mask;
+        value_ids[h] = {values[id].value, (int)id};
+    }
+    reset_values();
+}
+
+
+// back to the state before any of the function is generated; frame offsets
+// of the allocs are kept
+void reset_values()
+{
+    for (auto &state : values)
+    {
+        state.var = {-1, -1};
+        state.bound = false;
+        state.remaining = state.value->used_by.len;
+    }
+    for (int i = 0; i < 16; i++)registers[i] = -1;
+}
+
+
+int value_id(koopa_raw_value_t value)
+{
+    if (value_ids.empty())return -1;
+    size_t mask = value_ids.size() - 1;
+    size_t h = (reinterpret_cast<uintptr_t>(value) * 0x9e3779b97f4a7c15ull) >>
+        (64 - value_id_bits);
+    for (;; h = (h + 1) & mask)
+        if (value_ids[h].first == value)return value_ids[h].second;
+        else if (!value_ids[h].first)return -1;
+}
+
+
+void bind_value(int id, Reg var)
+{
+    values[id].var = var;
+    values[id].bound = true;
+}
+
+
+// frees the registers in the mask regs
+void clear_registers(bool save_temps, unsigned regs)
 {
     for (int i = 0; i < 15; i++)
-        if (reg_stats[i] > 0)
+        if ((regs >> i & 1) && (reg_stats[i] == 1 || reg_stats[i] == 2))
         {
-            value_map[registers[i]].reg_name = -1;
-            int offset = value_map[registers[i]].reg_offset;
+            if (registers[i] < 0)
+            {
+                reg_stats[i] = 0;
+                continue;
+            }
+            Reg &var = values[registers[i]].var;
+            var.reg_name = -1;
+            int offset = var.reg_offset;
             if (offset == -1)
             {
                 offset = stack_top;
                 stack_top += 4;
-                value_map[registers[i]].reg_offset = offset;
+                var.reg_offset = offset;
                 if (save_temps)
                 {
-                    if (offset >= -2048 && offset <= 2047)
-                        std::cout << "\tsw    " << reg_names[i] << ", " <<
-                            offset << "(sp)" << std::endl;
-                    else
-                    {
-                        std::cout << "\tli    s11, " << offset << std::endl;
-                        std::cout << "\tadd   s11, s11, sp" << std::endl;
-                        std::cout << "\tsw    " << reg_names[i] << ", (s11)" <<
-                            std::endl;
-                    }
+                    stat_clear_spills++;
+                    frame_used = true;
+                    std::string slot = frame_addr(offset);
+                    std::cout << "\tsw    " << reg_names[i] << ", " << slot <<
+                        std::endl;
                 }
             }
             reg_stats[i] = 0;
@@ -786,19 +1317,1038 @@ int cal_size(const koopa_raw_type_t &ty)
 }
 
 
-void init_aggregate(const koopa_raw_value_t &aggr)
+// flatten an initializer into words
+void init_aggregate(const koopa_raw_value_t &aggr, std::vector<int32_t> &words)
 {
-    koopa_raw_slice_t elems = aggr->kind.data.aggregate.elems;
-    for (size_t i = 0; i < elems.len; i++)
+    switch (aggr->kind.tag)
+    {
+    case KOOPA_RVT_ZERO_INIT:
+        words.resize(words.size() + cal_size(aggr->ty) / 4, 0);
+        break;
+    case KOOPA_RVT_INTEGER:
+        words.push_back(aggr->kind.data.integer.value);
+        break;
+    case KOOPA_RVT_AGGREGATE:
     {
-        auto ptr = elems.buffer[i];
+        koopa_raw_slice_t elems = aggr->kind.data.aggregate.elems;
         assert(elems.kind == KOOPA_RSIK_VALUE);
-        auto value = reinterpret_cast<koopa_raw_value_t>(ptr);
-        if (value->kind.tag == KOOPA_RVT_INTEGER)
-            std::cout << "\t.word " << value->kind.data.integer.value <<
-                std::endl;
-        else if (value->kind.tag == KOOPA_RVT_AGGREGATE)
-            init_aggregate(value);
-        else assert(false);
+        for (size_t i = 0; i < elems.len; i++)
+            init_aggregate(reinterpret_cast<koopa_raw_value_t>(elems.buffer[i]),
+                words);
+        break;
+    }
+    default:
+        assert(false);
+    }
+}
+
+
+// block names are only unique within a function, so qualify them with the
+// function name; .L keeps them out of the symbol table
+std::string bb_label(const koopa_raw_basic_block_t &bb)
+{
+    return ".L" + present_func + "." + (bb->name + 1);
+}
+
+
+// direct global accesses of every function with a body, then closed over the
+// call graph; callees without a body (library functions) touch no globals of
+// ours unless their assembly came from the cache or an earlier -stream program
+void collect_global_refs(const koopa_raw_slice_t &funcs)
+{
+    std::map<koopa_raw_function_t, std::set<koopa_raw_function_t>> callees;
+    for (size_t i = 0; i < funcs.len; i++)
+    {
+        auto func = reinterpret_cast<koopa_raw_function_t>(funcs.buffer[i]);
+        GlobalRefs &refs = func_globals[func];
+        if (func->bbs.len == 0)
+        {
+            refs.unknown = cached_asm.count(func->name + 1) > 0 ||
+                external_funcs.count(func->name + 1) > 0;
+            continue;
+        }
+        for (size_t j = 0; j < func->bbs.len; j++)
+        {
+            auto bb = reinterpret_cast<koopa_raw_basic_block_t>(func->bbs.buffer[j]);
+            for (size_t k = 0; k < bb->insts.len; k++)
+            {
+                auto inst = reinterpret_cast<koopa_raw_value_t>(bb->insts.buffer[k]);
+                const auto &kind = inst->kind;
+                if (kind.tag == KOOPA_RVT_LOAD &&
+                    kind.data.load.src->kind.tag == KOOPA_RVT_GLOBAL_ALLOC)
+                    refs.ref.insert(kind.data.load.src);
+                else if (kind.tag == KOOPA_RVT_STORE &&
+                    kind.data.store.dest->kind.tag == KOOPA_RVT_GLOBAL_ALLOC)
+                    refs.mod.insert(kind.data.store.dest);
+                else if (kind.tag == KOOPA_RVT_CALL)
+                    callees[func].insert(kind.data.call.callee);
+            }
+        }
+    }
+    for (bool changed = true; changed;)
+    {
+        changed = false;
+        for (auto &edges : callees)
+        {
+            GlobalRefs &refs = func_globals[edges.first];
+            for (auto callee : edges.second)
+            {
+                const GlobalRefs &callee_refs = func_globals[callee];
+                size_t old_size = refs.ref.size() + refs.mod.size();
+                bool old_unknown = refs.unknown;
+                refs.unknown |= callee_refs.unknown;
+                refs.ref.insert(callee_refs.ref.begin(), callee_refs.ref.end());
+                refs.mod.insert(callee_refs.mod.begin(), callee_refs.mod.end());
+                changed |= refs.unknown != old_unknown ||
+                    refs.ref.size() + refs.mod.size() != old_size;
+            }
+        }
+    }
+}
+
+
+// estimated execution count of every block relative to the entry. A branch
+// back to an earlier block closes a loop over all blocks in between (the
+// frontend lays loops out in order), which runs about 8 times; other branches
+// are taken half of the time, except that the test at the bottom of a loop
+// always reaches the exit eventually. A profile replaces the estimate with
+// measured counts
+std::vector<double> block_weights(const koopa_raw_function_t &func)
+{
+    size_t n = func->bbs.len;
+    long long entry = n ? profile_count(func->name + 1,
+        reinterpret_cast<koopa_raw_basic_block_t>(func->bbs.buffer[0])->name) : -1;
+    if (entry > 0)
+    {
+        std::vector<double> weight(n);
+        for (size_t i = 0; i < n; i++)
+        {
+            auto bb = reinterpret_cast<koopa_raw_basic_block_t>(func->bbs.buffer[i]);
+            weight[i] = std::max(profile_count(func->name + 1, bb->name), 0ll) /
+                (double)entry;
+        }
+        return weight;
+    }
+    std::map<koopa_raw_basic_block_t, size_t> order;
+    for (size_t i = 0; i < n; i++)
+        order[reinterpret_cast<koopa_raw_basic_block_t>(func->bbs.buffer[i])] = i;
+    std::vector<std::vector<size_t>> succs(n);
+    std::vector<int> depth(n, 0);
+    std::vector<bool> latch(n, false);
+    for (size_t i = 0; i < n; i++)
+    {
+        auto bb = reinterpret_cast<koopa_raw_basic_block_t>(func->bbs.buffer[i]);
+        if (bb->insts.len == 0)continue;
+        auto last = reinterpret_cast<koopa_raw_value_t>(
+            bb->insts.buffer[bb->insts.len - 1]);
+        if (last->kind.tag == KOOPA_RVT_JUMP)
+            succs[i].push_back(order[last->kind.data.jump.target]);
+        else if (last->kind.tag == KOOPA_RVT_BRANCH)
+        {
+            succs[i].push_back(order[last->kind.data.branch.true_bb]);
+            succs[i].push_back(order[last->kind.data.branch.false_bb]);
+        }
+        for (size_t target : succs[i])
+            if (target <= i)
+            {
+                latch[i] = true;
+                for (size_t j = target; j <= i; j++)depth[j]++;
+            }
+    }
+    std::vector<double> freq(n, 0), weight(n);
+    if (n)freq[0] = 1;
+    for (size_t i = 0; i < n; i++)
+    {
+        double share = succs[i].size() == 2 && !latch[i] ? freq[i] / 2 : freq[i];
+        for (size_t target : succs[i])
+            if (target > i)freq[target] += share;
+        weight[i] = std::min(freq[i], 1.0) * std::pow(8.0, std::min(depth[i], 5));
+    }
+    return weight;
+}
+
+
+// blocks in emission order. Without a profile the frontend order is kept; with
+// one, each block is followed by its hottest successor not placed yet, so the
+// common path falls through and the cold blocks sink to the end
+std::vector<koopa_raw_basic_block_t> layout_blocks(const koopa_raw_function_t &func)
+{
+    size_t n = func->bbs.len;
+    std::vector<koopa_raw_basic_block_t> blocks(n), layout;
+    bool terminated = true;
+    for (size_t i = 0; i < n; i++)
+    {
+        blocks[i] = reinterpret_cast<koopa_raw_basic_block_t>(func->bbs.buffer[i]);
+        terminated &= blocks[i]->insts.len > 0;
+    }
+    if (!terminated || profile_count(func->name + 1, blocks[0]->name) <= 0)
+        return blocks;
+    std::set<koopa_raw_basic_block_t> placed;
+    size_t next_unplaced = 0;
+    for (koopa_raw_basic_block_t bb = blocks[0]; bb;)
+    {
+        layout.push_back(bb);
+        placed.insert(bb);
+        auto last = reinterpret_cast<koopa_raw_value_t>(
+            bb->insts.buffer[bb->insts.len - 1]);
+        std::vector<koopa_raw_basic_block_t> succs;
+        if (last->kind.tag == KOOPA_RVT_JUMP)
+            succs.push_back(last->kind.data.jump.target);
+        else if (last->kind.tag == KOOPA_RVT_BRANCH)
+        {
+            succs.push_back(last->kind.data.branch.true_bb);
+            succs.push_back(last->kind.data.branch.false_bb);
+        }
+        bb = nullptr;
+        long long best = -1;
+        for (auto succ : succs)
+        {
+            long long count = profile_count(func->name + 1, succ->name);
+            if (!placed.count(succ) && count > best)
+            {
+                bb = succ;
+                best = count;
+            }
+        }
+        while (!bb && next_unplaced < n)
+            if (!placed.count(blocks[next_unplaced++]))bb = blocks[next_unplaced - 1];
+    }
+    return layout;
+}
+
+
+// a constant the frontend left as arithmetic on integers, such as "add 0, K"
+// or "sub 0, K" for a negative one; the instructions are collected and must
+// have no other use
+bool switch_constant(koopa_raw_value_t value, uint32_t &key,
+    std::set<koopa_raw_value_t> &insts)
+{
+    if (value->kind.tag == KOOPA_RVT_INTEGER)
+    {
+        key = value->kind.data.integer.value;
+        return true;
+    }
+    uint32_t lhs, rhs;
+    const auto &binary = value->kind.data.binary;
+    if (value->kind.tag != KOOPA_RVT_BINARY || value->used_by.len != 1 ||
+        !switch_constant(binary.lhs, lhs, insts) || !switch_constant(binary.rhs, rhs, insts))
+        return false;
+    if (binary.op == KOOPA_RBO_ADD)key = lhs + rhs;
+    else if (binary.op == KOOPA_RBO_SUB)key = lhs - rhs;
+    else if (binary.op == KOOPA_RBO_MUL)key = lhs * rhs;
+    else return false;
+    insts.insert(value);
+    return true;
+}
+
+
+// a block that ends in a test "load P; constant; eq; br", where the load and
+// the compare only feed the branch and nothing else is mixed in. Gives the
+// load, the constant and the position of the first instruction of the test
+bool switch_test(koopa_raw_basic_block_t bb, koopa_raw_value_t &load, int32_t &key,
+    size_t &test_start)
+{
+    size_t n = bb->insts.len;
+    if (n < 3)return false;
+    auto inst = [&](size_t i) {
+        return reinterpret_cast<koopa_raw_value_t>(bb->insts.buffer[i]);
+    };
+    koopa_raw_value_t br = inst(n - 1), eq = inst(n - 2);
+    if (br->kind.tag != KOOPA_RVT_BRANCH || br->kind.data.branch.cond != eq ||
+        br->kind.data.branch.true_bb == br->kind.data.branch.false_bb ||
+        eq->kind.tag != KOOPA_RVT_BINARY || eq->kind.data.binary.op != KOOPA_RBO_EQ ||
+        eq->used_by.len != 1)
+        return false;
+    load = eq->kind.data.binary.lhs;
+    koopa_raw_value_t constant = eq->kind.data.binary.rhs;
+    if (load->kind.tag != KOOPA_RVT_LOAD)std::swap(load, constant);
+    std::set<koopa_raw_value_t> test;
+    uint32_t value;
+    if (load->kind.tag != KOOPA_RVT_LOAD || load->used_by.len != 1 ||
+        !switch_constant(constant, value, test))
+        return false;
+    key = value;
+    test.insert(load);
+    if (test.size() > n - 2)return false;
+    test_start = n - 2 - test.size();
+    for (size_t i = test_start; i < n - 2; i++)
+        if (!test.count(inst(i)))return false;
+    return true;
+}
+
+
+// a chain starts at a test whose false edge leads to another test of the same
+// variable, consisting of nothing else and reached from nowhere else, and so
+// on; the block the last test falls to is the default. A constant tested
+// twice keeps its first target
+void find_switch_chains(const koopa_raw_function_t &func)
+{
+    std::map<koopa_raw_basic_block_t, int> preds;
+    for (size_t i = 0; i < func->bbs.len; i++)
+    {
+        auto bb = reinterpret_cast<koopa_raw_basic_block_t>(func->bbs.buffer[i]);
+        if (bb->insts.len == 0)continue;
+        auto last = reinterpret_cast<koopa_raw_value_t>(
+            bb->insts.buffer[bb->insts.len - 1]);
+        if (last->kind.tag == KOOPA_RVT_JUMP)preds[last->kind.data.jump.target]++;
+        else if (last->kind.tag == KOOPA_RVT_BRANCH)
+        {
+            preds[last->kind.data.branch.true_bb]++;
+            preds[last->kind.data.branch.false_bb]++;
+        }
+    }
+    for (size_t i = 0; i < func->bbs.len; i++)
+    {
+        auto head = reinterpret_cast<koopa_raw_basic_block_t>(func->bbs.buffer[i]);
+        koopa_raw_value_t next_load;
+        int32_t key;
+        SwitchPlan plan;
+        size_t next_start;
+        if (switch_absorbed.count(head) ||
+            !switch_test(head, plan.load, key, plan.test_start))
+            continue;
+        std::set<int32_t> seen;
+        std::vector<koopa_raw_basic_block_t> chain;
+        for (koopa_raw_basic_block_t test = head;;)
+        {
+            const auto &branch = reinterpret_cast<koopa_raw_value_t>(
+                test->insts.buffer[test->insts.len - 1])->kind.data.branch;
+            if (seen.insert(key).second)plan.cases.push_back({key, branch.true_bb});
+            koopa_raw_basic_block_t next = branch.false_bb;
+            if (next == head || preds[next] != 1 || switch_plans.count(next) ||
+                !switch_test(next, next_load, key, next_start) || next_start != 0 ||
+                next_load->kind.data.load.src != plan.load->kind.data.load.src)
+            {
+                plan.default_bb = next;
+                break;
+            }
+            chain.push_back(next);
+            test = next;
+        }
+        if (plan.cases.size() < min_switch_cases)continue;
+        std::sort(plan.cases.begin(), plan.cases.end());
+        switch_absorbed.insert(chain.begin(), chain.end());
+        switch_plans[head] = plan;
+    }
+}
+
+
+// the head of a chain loads the variable as usual and then dispatches. When
+// the cases cover at least a third of their range, the offset from the
+// smallest one indexes a table of block addresses after a single unsigned
+// bounds check; otherwise a binary search compares against the middle case.
+// The block's values are dead by now, so s11 and any register not pinned to a
+// local are free
+void emit_switch(const SwitchPlan &plan)
+{
+    int value_reg = Visit(plan.load).reg_name;
+    clear_registers(false);
+    std::string value = reg_names[value_reg];
+    long low = plan.cases.front().first, high = plan.cases.back().first;
+    long range = high - low + 1;
+    if (range > 3 * (long)plan.cases.size())
+    {
+        stat_switch_trees++;
+        emit_switch_tree(plan, value, 0, plan.cases.size(), true);
+        return;
+    }
+    stat_jump_tables++;
+    int temp_reg = 0;
+    while (temp_reg == value_reg || reg_stats[temp_reg])temp_reg++;
+    std::string temp = reg_names[temp_reg];
+    std::string table = ".L" + present_func + ".sw." + std::to_string(switch_labels++);
+    if (-low >= -2048 && -low <= 2047)
+        std::cout << "\taddi  s11, " << value << ", " << -low << std::endl;
+    else
+    {
+        std::cout << "\tli    s11, " << low << std::endl;
+        std::cout << "\tsub   s11, " << value << ", s11" << std::endl;
+    }
+    std::cout << "\tli    " << temp << ", " << range << std::endl;
+    std::cout << "\tbgeu  s11, " << temp << ", " << bb_label(plan.default_bb) << std::endl;
+    std::cout << "\tslli  s11, s11, 2" << std::endl;
+    std::cout << "\tla    " << temp << ", " << table << std::endl;
+    std::cout << "\tadd   s11, s11, " << temp << std::endl;
+    std::cout << "\tlw    s11, 0(s11)" << std::endl;
+    std::cout << "\tjr    s11" << std::endl;
+    switch_tables += "\t.section .rodata\n" + table + ":\n";
+    size_t next = 0;
+    for (long k = low; k <= high; k++)
+    {
+        koopa_raw_basic_block_t target = plan.default_bb;
+        if (plan.cases[next].first == k)target = plan.cases[next++].second;
+        switch_tables += "\t.word " + bb_label(target) + "\n";
+    }
+}
+
+
+// cases [lo, hi) of a chain without a table; the last subtree emitted may
+// fall through to the default
+void emit_switch_tree(const SwitchPlan &plan, const std::string &value, size_t lo,
+    size_t hi, bool last)
+{
+    if (hi - lo <= 3)
+    {
+        for (size_t i = lo; i < hi; i++)
+        {
+            std::cout << "\tli    s11, " << plan.cases[i].first << std::endl;
+            std::cout << "\tbeq   " << value << ", s11, " <<
+                bb_label(plan.cases[i].second) << std::endl;
+        }
+        if (!last || plan.default_bb != next_bb)
+            std::cout << "\tj     " << bb_label(plan.default_bb) << std::endl;
+        return;
+    }
+    size_t mid = (lo + hi) / 2;
+    std::string left = ".L" + present_func + ".sw." + std::to_string(switch_labels++);
+    std::cout << "\tli    s11, " << plan.cases[mid].first << std::endl;
+    std::cout << "\tbeq   " << value << ", s11, " << bb_label(plan.cases[mid].second) <<
+        std::endl;
+    std::cout << "\tblt   " << value << ", s11, " << left << std::endl;
+    emit_switch_tree(plan, value, mid + 1, hi, false);
+    std::cout << left << ":" << std::endl;
+    emit_switch_tree(plan, value, lo, mid, last);
+}
+
+
+// scalars and pointers of a leaf function that are only loaded and stored.
+// The most used ones get registers counted down from a7 past the parameters,
+// then from t6; t0 stays free for the profile counters and the jump tables,
+// and at least eight registers are left to the temporaries. Calls to the
+// buffered runtime are allowed, the locals then avoid the registers it writes.
+// Returns whether every local got a register
+bool choose_pinned_locals(const koopa_raw_function_t &func)
+{
+    std::vector<double> weight = block_weights(func);
+    std::vector<koopa_raw_value_t> allocs;
+    // weighted accesses, by value number
+    std::vector<double> use_weight(values.size());
+    double unnumbered = 0;
+    auto uses = [&](koopa_raw_value_t value) -> double &
+        { int id = value_id(value); return id < 0 ? unnumbered : use_weight[id]; };
+    unsigned clobbered = 0;
+    for (size_t i = 0; i < func->bbs.len; i++)
+    {
+        auto bb = reinterpret_cast<koopa_raw_basic_block_t>(func->bbs.buffer[i]);
+        for (size_t j = 0; j < bb->insts.len; j++)
+        {
+            auto inst = reinterpret_cast<koopa_raw_value_t>(bb->insts.buffer[j]);
+            if (inst->kind.tag == KOOPA_RVT_CALL)
+            {
+                if (!runtime_call(inst->kind.data.call.callee))return false;
+                clobbered = runtime_clobbers;
+            }
+            if (inst->kind.tag == KOOPA_RVT_ALLOC)allocs.push_back(inst);
+            else if (inst->kind.tag == KOOPA_RVT_LOAD)
+                uses(inst->kind.data.load.src) += weight[i];
+            else if (inst->kind.tag == KOOPA_RVT_STORE)
+                uses(inst->kind.data.store.dest) += weight[i];
+        }
+    }
+    std::vector<std::pair<double, koopa_raw_value_t>> candidates;
+    for (auto alloc : allocs)
+    {
+        auto base = alloc->ty->data.pointer.base;
+        if (base->tag != KOOPA_RTT_INT32 && base->tag != KOOPA_RTT_POINTER)continue;
+        bool scalar = true;
+        for (size_t k = 0; k < alloc->used_by.len; k++)
+        {
+            auto user = reinterpret_cast<koopa_raw_value_t>(alloc->used_by.buffer[k]);
+            scalar &= user->kind.tag == KOOPA_RVT_LOAD ||
+                (user->kind.tag == KOOPA_RVT_STORE &&
+                user->kind.data.store.value != alloc);
+        }
+        if (scalar)candidates.push_back({uses(alloc), alloc});
+    }
+    std::stable_sort(candidates.begin(), candidates.end(),
+        [](const auto &a, const auto &b) { return a.first > b.first; });
+    std::vector<int> free_regs;
+    for (int reg = 14; reg >= 7 + (int)func->params.len; reg--)
+        if (!(clobbered >> reg & 1))free_regs.push_back(reg);
+    for (int reg = 6; reg >= 1; reg--)
+        if (!(clobbered >> reg & 1))free_regs.push_back(reg);
+    size_t count = std::min({candidates.size(), free_regs.size(),
+        (size_t)max_pinned_locals});
+    for (size_t i = 0; i < count; i++)
+        pinned_locals[candidates[i].second] = free_regs[i];
+    stat_pinned_locals += count;
+    // a load may return the register itself when every use of it, including
+    // the uses of addresses computed from it, comes before the next store
+    for (size_t i = 0; i < func->bbs.len; i++)
+    {
+        auto bb = reinterpret_cast<koopa_raw_basic_block_t>(func->bbs.buffer[i]);
+        std::map<koopa_raw_value_t, size_t> pos;
+        for (size_t j = 0; j < bb->insts.len; j++)
+            pos[reinterpret_cast<koopa_raw_value_t>(bb->insts.buffer[j])] = j;
+        for (size_t j = 0; j < bb->insts.len; j++)
+        {
+            auto inst = reinterpret_cast<koopa_raw_value_t>(bb->insts.buffer[j]);
+            if (inst->kind.tag != KOOPA_RVT_LOAD ||
+                !pinned_locals.count(inst->kind.data.load.src))
+                continue;
+            size_t last = j;
+            bool local = true;
+            std::vector<koopa_raw_value_t> work = {inst};
+            while (!work.empty() && local)
+            {
+                auto value = work.back();
+                work.pop_back();
+                for (size_t k = 0; k < value->used_by.len; k++)
+                {
+                    auto user = reinterpret_cast<koopa_raw_value_t>(
+                        value->used_by.buffer[k]);
+                    auto it = pos.find(user);
+                    if (it == pos.end())local = false;
+                    else last = std::max(last, it->second);
+                    if (user->kind.tag == KOOPA_RVT_GET_PTR ||
+                        user->kind.tag == KOOPA_RVT_GET_ELEM_PTR)
+                        work.push_back(user);
+                }
+            }
+            for (size_t k = j + 1; k < last && local; k++)
+            {
+                auto other = reinterpret_cast<koopa_raw_value_t>(bb->insts.buffer[k]);
+                local = other->kind.tag != KOOPA_RVT_STORE ||
+                    other->kind.data.store.dest != inst->kind.data.load.src;
+            }
+            if (local)direct_loads.insert(inst);
+        }
+    }
+    return count == allocs.size();
+}
+
+
+std::vector<koopa_raw_basic_block_t> block_succs(koopa_raw_basic_block_t bb)
+{
+    std::vector<koopa_raw_basic_block_t> succs;
+    auto plan = switch_plans.find(bb);
+    if (plan != switch_plans.end())
+    {
+        for (auto &c : plan->second.cases)succs.push_back(c.second);
+        succs.push_back(plan->second.default_bb);
+        return succs;
+    }
+    if (bb->insts.len == 0)return succs;
+    auto last = reinterpret_cast<koopa_raw_value_t>(bb->insts.buffer[bb->insts.len - 1]);
+    if (last->kind.tag == KOOPA_RVT_JUMP)succs.push_back(last->kind.data.jump.target);
+    else if (last->kind.tag == KOOPA_RVT_BRANCH)
+    {
+        succs.push_back(last->kind.data.branch.true_bb);
+        succs.push_back(last->kind.data.branch.false_bb);
+    }
+    return succs;
+}
+
+
+// whether ra is saved is propagated from the entry block; where paths
+// disagree, the predecessors that have not saved it save it before their
+// terminator, until every block is reached in one state. Paths that return
+// without calling, like the fast path of a recursive function, never touch ra
+void plan_ra_saves(const koopa_raw_function_t &func)
+{
+    auto entry = reinterpret_cast<koopa_raw_basic_block_t>(func->bbs.buffer[0]);
+    std::set<koopa_raw_basic_block_t> calls;
+    std::map<koopa_raw_basic_block_t, std::vector<koopa_raw_basic_block_t>> preds;
+    for (size_t i = 0; i < func->bbs.len; i++)
+    {
+        auto bb = reinterpret_cast<koopa_raw_basic_block_t>(func->bbs.buffer[i]);
+        if (switch_absorbed.count(bb))continue;
+        for (size_t j = 0; j < bb->insts.len; j++)
+            if (reinterpret_cast<koopa_raw_value_t>(bb->insts.buffer[j])->kind.tag ==
+                KOOPA_RVT_CALL)
+                calls.insert(bb);
+        for (auto succ : block_succs(bb))preds[succ].push_back(bb);
+    }
+    // main calls the profile dump at every return
+    if (profile_generate && present_func == "main")calls.insert(entry);
+    while (true)
+    {
+        std::map<koopa_raw_basic_block_t, bool> saved_in = {{entry, false}};
+        auto saved_out = [&](koopa_raw_basic_block_t bb) {
+            return saved_in[bb] || calls.count(bb) || ra_save_end.count(bb);
+        };
+        std::vector<koopa_raw_basic_block_t> work = {entry};
+        std::set<koopa_raw_basic_block_t> conflicts;
+        while (!work.empty())
+        {
+            auto bb = work.back();
+            work.pop_back();
+            bool out = saved_out(bb);
+            for (auto succ : block_succs(bb))
+            {
+                auto it = saved_in.find(succ);
+                if (it == saved_in.end())
+                {
+                    saved_in[succ] = out;
+                    work.push_back(succ);
+                }
+                else if (it->second != out)conflicts.insert(succ);
+            }
+        }
+        size_t forced = ra_save_end.size();
+        for (auto succ : conflicts)
+            for (auto pred : preds[succ])
+                if (saved_in.count(pred) && !saved_out(pred))ra_save_end.insert(pred);
+        if (conflicts.empty() || ra_save_end.size() == forced)
+        {
+            if (!conflicts.empty())
+            {
+                // a loop back to the entry: save ra before anything else
+                ra_save_end.clear();
+                calls.insert(entry);
+                continue;
+            }
+            // a block reached with ra saved must not save it again: ra may
+            // hold a return address into this function by then
+            for (auto &state : saved_in)
+            {
+                if (saved_out(state.first))ra_saved.insert(state.first);
+                if (!state.second && calls.count(state.first))
+                    ra_save_start.insert(state.first);
+                if (state.second)ra_save_end.erase(state.first);
+            }
+            return;
+        }
+    }
+}
+
+
+bool runtime_call(koopa_raw_function_t callee)
+{
+    static const std::set<std::string> runtime_funcs = {"getint", "getch",
+        "getarray", "putint", "putch", "putarray", "starttime", "stoptime"};
+    std::string name = callee->name + 1;
+    return buffered_io && callee->bbs.len == 0 && runtime_funcs.count(name) &&
+        !external_funcs.count(name) && !cached_asm.count(name);
+}
+
+
+// ra lives in the slot right above the outgoing arguments
+void emit_ra(bool save)
+{
+    std::string slot = frame_addr(save_area);
+    std::cout << (save ? "\tsw    ra, " : "\tlw    ra, ") << slot << std::endl;
+}
+
+
+// called by main before it returns: prints a marker line, then one
+// "key count" line per counted block. The tables are walked by a small loop
+// so the dump stays short however many blocks there are
+void emit_profile_dump()
+{
+    std::cout << "\t.text" << std::endl;
+    std::cout << ".Lprof_dump:" << std::endl;
+    std::cout << "\taddi  sp, sp, -16" << std::endl;
+    std::cout << "\tsw    ra, 12(sp)" << std::endl;
+    std::cout << "\tsw    a0, 8(sp)" << std::endl;
+    for (char c : std::string("\n#profile\n"))
+    {
+        std::cout << "\tli    a0, " << (int)c << std::endl;
+        std::cout << "\tcall  putch" << std::endl;
+    }
+    for (auto &func : profile_tables)
+    {
+        std::cout << "\tla    a0, .Lprof." << func << std::endl;
+        std::cout << "\tcall  .Lprof_table" << std::endl;
+    }
+    std::cout << "\tlw    a0, 8(sp)" << std::endl;
+    std::cout << "\tlw    ra, 12(sp)" << std::endl;
+    std::cout << "\taddi  sp, sp, 16" << std::endl;
+    std::cout << "\tret" << std::endl;
+    std::cout << ".Lprof_table:" << std::endl;
+    std::cout << "\taddi  sp, sp, -16" << std::endl;
+    std::cout << "\tsw    ra, 12(sp)" << std::endl;
+    std::cout << "\tsw    s0, 8(sp)" << std::endl;
+    std::cout << "\tsw    s1, 4(sp)" << std::endl;
+    std::cout << "\tlw    s1, 0(a0)" << std::endl;
+    std::cout << "\taddi  s0, a0, 4" << std::endl;
+    std::cout << ".Lprof_table.loop:" << std::endl;
+    std::cout << "\tbeqz  s1, .Lprof_table.done" << std::endl;
+    std::cout << "\tlw    a0, 0(s0)" << std::endl;
+    std::cout << "\tcall  putint" << std::endl;
+    std::cout << "\tli    a0, 32" << std::endl;
+    std::cout << "\tcall  putch" << std::endl;
+    std::cout << "\tlw    a0, 4(s0)" << std::endl;
+    std::cout << "\tcall  putint" << std::endl;
+    std::cout << "\tli    a0, 10" << std::endl;
+    std::cout << "\tcall  putch" << std::endl;
+    std::cout << "\taddi  s0, s0, 8" << std::endl;
+    std::cout << "\taddi  s1, s1, -1" << std::endl;
+    std::cout << "\tj     .Lprof_table.loop" << std::endl;
+    std::cout << ".Lprof_table.done:" << std::endl;
+    std::cout << "\tlw    s1, 4(sp)" << std::endl;
+    std::cout << "\tlw    s0, 8(sp)" << std::endl;
+    std::cout << "\tlw    ra, 12(sp)" << std::endl;
+    std::cout << "\taddi  sp, sp, 16" << std::endl;
+    std::cout << "\tret" << std::endl;
+    std::cout << std::endl;
+}
+
+
+// a cached scalar turns each access from la + lw/sw (3 instructions once la
+// expands to auipc + addi) into one mv, a cached array saves the la; the price
+// is saving the s register, the initial load and the write-back/reload around
+// calls that may touch the global. Accesses and calls are weighted by the
+// estimated execution count of their block
+void choose_cached_globals(const koopa_raw_function_t &func)
+{
+    std::vector<double> weights = block_weights(func);
+    std::vector<koopa_raw_value_t> globals;
+    std::map<koopa_raw_value_t, double> benefit, cost;
+    std::vector<std::pair<const GlobalRefs *, double>> calls;
+    double ret_weight = 0;
+    auto use = [&](koopa_raw_value_t global, double weight)
+    {
+        if (global->kind.tag != KOOPA_RVT_GLOBAL_ALLOC ||
+            readonly_globals.count(global))return;
+        if (!benefit.count(global))globals.push_back(global);
+        benefit[global] += weight;
+    };
+    for (size_t i = 0; i < func->bbs.len; i++)
+    {
+        auto bb = reinterpret_cast<koopa_raw_basic_block_t>(func->bbs.buffer[i]);
+        double weight = weights[i];
+        for (size_t j = 0; j < bb->insts.len; j++)
+        {
+            auto inst = reinterpret_cast<koopa_raw_value_t>(bb->insts.buffer[j]);
+            const auto &kind = inst->kind;
+            if (kind.tag == KOOPA_RVT_LOAD)use(kind.data.load.src, 2 * weight);
+            else if (kind.tag == KOOPA_RVT_STORE)
+            {
+                use(kind.data.store.dest, 2 * weight);
+                if (kind.data.store.dest->kind.tag == KOOPA_RVT_GLOBAL_ALLOC)
+                    dirty_globals.insert(kind.data.store.dest);
+            }
+            else if (kind.tag == KOOPA_RVT_GET_ELEM_PTR)
+                use(kind.data.get_elem_ptr.src, 2 * weight);
+            else if (kind.tag == KOOPA_RVT_CALL)
+                calls.push_back({&func_globals[kind.data.call.callee], weight});
+            else if (kind.tag == KOOPA_RVT_RETURN)ret_weight += weight;
+        }
+    }
+    // save slots out of reach of a 12-bit offset need li + add each way
+    double save_cost = save_area + 4 * (max_cached_globals + 1) > 2047 ? 6 : 2;
+    for (auto global : globals)
+    {
+        cost[global] = save_cost + 2;
+        if (global->ty->data.pointer.base->tag == KOOPA_RTT_ARRAY)continue;
+        cost[global]++;
+        bool dirty = dirty_globals.count(global);
+        for (auto &call : calls)
+        {
+            const GlobalRefs &refs = *call.first;
+            if (dirty && (refs.unknown || refs.ref.count(global) ||
+                refs.mod.count(global)))
+                cost[global] += 3 * call.second;
+            if (refs.unknown || refs.mod.count(global))
+                cost[global] += 3 * call.second;
+        }
+        if (dirty)cost[global] += 3 * ret_weight;
+    }
+    std::stable_sort(globals.begin(), globals.end(), [&](auto a, auto b)
+        { return benefit[a] - cost[a] > benefit[b] - cost[b]; });
+    for (auto global : globals)
+    {
+        if (benefit[global] <= cost[global] ||
+            cached_globals.size() == max_cached_globals)break;
+        int reg = cached_globals.size() + 1;
+        cached_globals[global] = reg;
+    }
+}
+
+
+// save slots of s1 .. s10, then s0, sit right above ra
+int saved_reg_offset(int reg)
+{
+    return save_area + (restore_ra ? 4 : 0) + 4 * (reg ? reg - 1 : 10);
+}
+
+
+// lays the frame out (see save_area) and returns its size. Allocs get
+// their offsets here, spill slots are handed out from spill_start as they are
+// needed, one for each value at most. When used objects lie beyond 2047, the
+// frame is laid out again with a save slot for each base register
+int plan_frame(const koopa_raw_function_t &func)
+{
+    std::vector<double> weight = block_weights(func);
+    std::vector<koopa_raw_value_t> scalars, arrays;
+    // weighted accesses, by value number
+    std::vector<double> use_weight(values.size());
+    double unnumbered = 0;
+    auto uses = [&](koopa_raw_value_t value) -> double &
+        { int id = value_id(value); return id < 0 ? unnumbered : use_weight[id]; };
+    int spill_size = 0;
+    for (size_t i = 0; i < func->bbs.len; i++)
+    {
+        auto bb = reinterpret_cast<koopa_raw_basic_block_t>(func->bbs.buffer[i]);
+        if (switch_absorbed.count(bb))continue;
+        for (size_t j = 0; j < bb->insts.len; j++)
+        {
+            auto inst = reinterpret_cast<koopa_raw_value_t>(bb->insts.buffer[j]);
+            if (pinned_locals.count(inst))continue;
+            if (inst->kind.tag == KOOPA_RVT_ALLOC)
+                (cal_size(inst->ty->data.pointer.base) == 4 ? scalars : arrays)
+                    .push_back(inst);
+            else if (inst->ty->tag != KOOPA_RTT_UNIT)spill_size += 4;
+            if (inst->kind.tag == KOOPA_RVT_LOAD)
+                uses(pointer_root(inst->kind.data.load.src)) += weight[i];
+            else if (inst->kind.tag == KOOPA_RVT_STORE)
+                uses(pointer_root(inst->kind.data.store.dest)) += weight[i];
+            else if (inst->kind.tag == KOOPA_RVT_GET_ELEM_PTR)
+                uses(pointer_root(inst)) += weight[i];
+        }
+    }
+    auto hotter = [&](koopa_raw_value_t a, koopa_raw_value_t b)
+        { return uses(a) > uses(b); };
+    std::stable_sort(scalars.begin(), scalars.end(), hotter);
+    std::stable_sort(arrays.begin(), arrays.end(), [&](auto a, auto b)
+        { return uses(a) / cal_size(a->ty->data.pointer.base) >
+            uses(b) / cal_size(b->ty->data.pointer.base); });
+    // s1 .. sn hold cached globals, the bases take the next ones, s0 last
+    int cached = cached_globals.size();
+    size_t free_regs = max_cached_globals + 1 - cached;
+    int size;
+    for (size_t reserved = 0;; reserved = frame_bases.size())
+    {
+        int offset = save_area + (restore_ra ? 4 : 0) + 4 * (cached + reserved);
+        for (auto alloc : scalars)
+        {
+            values[value_id(alloc)].slot = offset;
+            offset += 4;
+        }
+        spill_start = offset;
+        offset += spill_size;
+        // starts of the used objects out of reach, in increasing order
+        std::vector<int> far;
+        for (auto alloc : arrays)
+        {
+            if (uses(alloc) > 0 && offset > 2047)far.push_back(offset);
+            values[value_id(alloc)].slot = offset;
+            offset += cal_size(alloc->ty->data.pointer.base);
+        }
+        size = ceil(offset / 16.0) * 16;
+        if (func->params.len > 8 && size + 4 * (int)func->params.len - 32 > 2048)
+            far.push_back(std::max(size, 2048));
+        frame_bases.clear();
+        for (int start : far)
+        {
+            if (!frame_bases.empty() && start <= frame_bases.back().second + 2047)
+                continue;
+            if (frame_bases.size() == free_regs)break;
+            int reg = cached + 1 + frame_bases.size();
+            frame_bases.push_back({reg <= max_cached_globals ? reg : 0, start + 2048});
+        }
+        if (frame_bases.size() <= reserved)return size;
+    }
+}
+
+
+// base register and 12-bit offset reaching the frame slot at offset
+bool frame_base(int offset, std::string &base, int &imm)
+{
+    if (offset >= -2048 && offset <= 2047)
+    {
+        base = "sp";
+        imm = offset;
+        return true;
+    }
+    for (auto &frame_base : frame_bases)
+        if (offset - frame_base.second >= -2048 && offset - frame_base.second <= 2047)
+        {
+            base = saved_reg_names[frame_base.first];
+            imm = offset - frame_base.second;
+            return true;
+        }
+    return false;
+}
+
+
+// "imm(base)" for the frame slot at offset, or "" out of reach
+std::string frame_slot(int offset)
+{
+    std::string base;
+    int imm;
+    if (!frame_base(offset, base, imm))return "";
+    return std::to_string(imm) + "(" + base + ")";
+}
+
+
+// like frame_slot, but a slot out of reach has its address put in s11 first
+std::string frame_addr(int offset)
+{
+    std::string slot = frame_slot(offset);
+    if (!slot.empty())return slot;
+    stat_s11_seqs++;
+    std::cout << "\tli    s11, " << offset << std::endl;
+    std::cout << "\tadd   s11, s11, sp" << std::endl;
+    return "0(s11)";
+}
+
+
+// global == nullptr restores the register from its save slot
+void load_cached_global(koopa_raw_value_t global, int reg)
+{
+    std::string name = saved_reg_names[reg];
+    if (global)
+    {
+        std::cout << "\tla    " << name << ", " << global_values[global] << std::endl;
+        if (global->ty->data.pointer.base->tag != KOOPA_RTT_ARRAY)
+            std::cout << "\tlw    " << name << ", 0(" << name << ")" << std::endl;
+        return;
+    }
+    std::string slot = frame_addr(saved_reg_offset(reg));
+    std::cout << "\tlw    " << name << ", " << slot << std::endl;
+}
+
+
+// global == nullptr saves the caller's value of the register
+void store_cached_global(koopa_raw_value_t global, int reg)
+{
+    std::string name = saved_reg_names[reg];
+    if (global)
+    {
+        std::cout << "\tla    s11, " << global_values[global] << std::endl;
+        std::cout << "\tsw    " << name << ", 0(s11)" << std::endl;
+        return;
+    }
+    std::string slot = frame_addr(saved_reg_offset(reg));
+    std::cout << "\tsw    " << name << ", " << slot << std::endl;
+}
+
+
+// the global (or other base) a pointer is derived from
+koopa_raw_value_t pointer_root(koopa_raw_value_t ptr)
+{
+    while (true)
+        if (ptr->kind.tag == KOOPA_RVT_GET_ELEM_PTR)ptr = ptr->kind.data.get_elem_ptr.src;
+        else if (ptr->kind.tag == KOOPA_RVT_GET_PTR)ptr = ptr->kind.data.get_ptr.src;
+        else return ptr;
+}
+
+
+// a global is written by a store through it or by a callee it is passed to;
+// the body of a function whose assembly came from the cache is unknown
+void find_readonly_globals(const koopa_raw_program_t &program)
+{
+    for (size_t i = 0; i < program.values.len; i++)
+    {
+        auto value = reinterpret_cast<koopa_raw_value_t>(program.values.buffer[i]);
+        if (value->kind.tag == KOOPA_RVT_GLOBAL_ALLOC)readonly_globals.insert(value);
+    }
+    for (size_t i = 0; i < program.funcs.len; i++)
+    {
+        auto func = reinterpret_cast<koopa_raw_function_t>(program.funcs.buffer[i]);
+        if (func->bbs.len == 0 && cached_asm.count(func->name + 1))
+        {
+            readonly_globals.clear();
+            return;
+        }
+        for (size_t j = 0; j < func->bbs.len; j++)
+        {
+            auto bb = reinterpret_cast<koopa_raw_basic_block_t>(func->bbs.buffer[j]);
+            for (size_t k = 0; k < bb->insts.len; k++)
+            {
+                auto inst = reinterpret_cast<koopa_raw_value_t>(bb->insts.buffer[k]);
+                const auto &kind = inst->kind;
+                if (kind.tag == KOOPA_RVT_STORE)
+                {
+                    readonly_globals.erase(pointer_root(kind.data.store.dest));
+                    readonly_globals.erase(pointer_root(kind.data.store.value));
+                }
+                else if (kind.tag == KOOPA_RVT_CALL)
+                    for (size_t a = 0; a < kind.data.call.args.len; a++)
+                        readonly_globals.erase(pointer_root(
+                            reinterpret_cast<koopa_raw_value_t>(
+                                kind.data.call.args.buffer[a])));
+            }
+        }
+    }
+}
+
+
+// the value a load reads when it comes from a read-only global through
+// constant indices only
+bool fold_global_load(koopa_raw_value_t src, int32_t &value)
+{
+    std::vector<int32_t> indices;
+    while (src->kind.tag == KOOPA_RVT_GET_ELEM_PTR)
+    {
+        koopa_raw_value_t index = src->kind.data.get_elem_ptr.index;
+        if (index->kind.tag != KOOPA_RVT_INTEGER)return false;
+        indices.push_back(index->kind.data.integer.value);
+        src = src->kind.data.get_elem_ptr.src;
+    }
+    if (!readonly_globals.count(src))return false;
+    koopa_raw_value_t init = src->kind.data.global_alloc.init;
+    for (auto it = indices.rbegin(); it != indices.rend(); ++it)
+    {
+        if (init->kind.tag == KOOPA_RVT_ZERO_INIT)break;
+        if (init->kind.tag != KOOPA_RVT_AGGREGATE)return false;
+        koopa_raw_slice_t elems = init->kind.data.aggregate.elems;
+        if (*it < 0 || *it >= (int32_t)elems.len)return false;
+        init = reinterpret_cast<koopa_raw_value_t>(elems.buffer[*it]);
+    }
+    if (init->kind.tag == KOOPA_RVT_ZERO_INIT)value = 0;
+    else if (init->kind.tag == KOOPA_RVT_INTEGER)value = init->kind.data.integer.value;
+    else return false;
+    return true;
+}
+
+
+// an address whose every use is a folded load need not be computed
+bool folded_address(koopa_raw_value_t ptr)
+{
+    if (ptr->used_by.len == 0)return false;
+    for (size_t i = 0; i < ptr->used_by.len; i++)
+    {
+        auto user = reinterpret_cast<koopa_raw_value_t>(ptr->used_by.buffer[i]);
+        int32_t value;
+        if (user->kind.tag == KOOPA_RVT_LOAD && fold_global_load(ptr, value))continue;
+        if (user->kind.tag == KOOPA_RVT_GET_ELEM_PTR &&
+            user->kind.data.get_elem_ptr.src == ptr && folded_address(user))continue;
+        return false;
+    }
+    return true;
+}
+
+
+// a constant index into a local array or through a pointer, used only as the
+// address of loads and stores: they address base + offset directly (base is
+// null for sp), so the pointer itself is never computed
+bool offset_address(koopa_raw_value_t ptr, koopa_raw_value_t &base, int &offset)
+{
+    koopa_raw_value_t index;
+    int elem_size;
+    if (ptr->kind.tag == KOOPA_RVT_GET_PTR)
+    {
+        base = ptr->kind.data.get_ptr.src;
+        index = ptr->kind.data.get_ptr.index;
+        elem_size = cal_size(base->ty->data.pointer.base);
+    }
+    else if (ptr->kind.tag == KOOPA_RVT_GET_ELEM_PTR)
+    {
+        base = ptr->kind.data.get_elem_ptr.src;
+        index = ptr->kind.data.get_elem_ptr.index;
+        if (base->kind.tag == KOOPA_RVT_GLOBAL_ALLOC)return false;
+        koopa_raw_type_t arr = base->ty->data.pointer.base;
+        elem_size = cal_size(arr) / arr->data.array.len;
+    }
+    else return false;
+    if (index->kind.tag != KOOPA_RVT_INTEGER || ptr->used_by.len == 0)return false;
+    offset = elem_size * index->kind.data.integer.value;
+    if (base->kind.tag == KOOPA_RVT_ALLOC)
+    {
+        offset += values[value_id(base)].slot;
+        base = nullptr;
+    }
+    if (base ? offset < -2048 || offset > 2047 : frame_slot(offset).empty())return false;
+    for (size_t i = 0; i < ptr->used_by.len; i++)
+    {
+        auto user = reinterpret_cast<koopa_raw_value_t>(ptr->used_by.buffer[i]);
+        if (user->kind.tag == KOOPA_RVT_LOAD && user->kind.data.load.src == ptr)continue;
+        if (user->kind.tag == KOOPA_RVT_STORE && user->kind.data.store.dest == ptr &&
+            user->kind.data.store.value != ptr)continue;
+        return false;
     }
+    return true;
 }
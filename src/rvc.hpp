@@ -0,0 +1,133 @@
+#pragma once
+#include <algorithm>
+#include <charconv>
+#include <string>
+#include <string_view>
+#include "sched.hpp"
+
+// -march=rv32imc: 使用 C 扩展的 16 位压缩指令
+// 寄存器分配优先使用压缩指令能编码的 a0-a5 (x8-x15 中的 s0, s1 由缓存的全局变量使用),
+// 每个函数生成完后逐行把能压缩的指令改写成 c.* 助记符.
+// 跳转和分支能否压缩取决于到目标的距离, 汇编文本中保持原样由汇编器决定,
+// -emit-obj 时由 ObjAssembler 在布局时决定
+
+inline bool rvc = false;
+
+// 压缩指令大多只能使用 x8-x15
+inline bool rvc_reg(int reg) { return reg >= 8 && reg <= 15; }
+
+inline bool rvc_imm(std::string_view s, long &value)
+{
+  auto result = std::from_chars(s.data(), s.data() + s.size(), value);
+  return result.ec == std::errc() && result.ptr == s.data() + s.size();
+}
+
+// "偏移(基址)" 形式的访存操作数, 偏移可以省略
+inline bool rvc_mem(std::string_view s, long &offset, int &base)
+{
+  size_t paren = s.find('(');
+  if (paren == std::string_view::npos || s.back() != ')') return false;
+  base = sched_reg(s.substr(paren + 1, s.size() - paren - 2));
+  offset = 0;
+  return base >= 0 && (paren == 0 || rvc_imm(s.substr(0, paren), offset));
+}
+
+// 能压缩时返回 c.* 形式的指令 (不含缩进), 否则返回空串
+inline std::string rvc_inst(std::string_view op, const std::string_view *args, int argc)
+{
+  int r[3];
+  for (int i = 0; i < 3; i++) r[i] = i < argc ? sched_reg(args[i]) : -1;
+  auto inst = [](std::string name, std::string operands) {
+    return name + std::string(std::max(1, 6 - (int)name.size()), ' ') + operands;
+  };
+  auto arg = [&](int i) { return std::string(args[i]); };
+  long imm = 0, offset;
+  int base;
+  bool has_imm = argc && rvc_imm(args[argc - 1], imm);
+  bool small = has_imm && imm >= -32 && imm < 32;
+  if (op == "ret" && argc == 0) return inst("c.jr", "ra");
+  if (op == "jr" && argc == 1 && r[0] > 0) return inst("c.jr", arg(0));
+  if (op == "mv" && argc == 2 && r[0] > 0 && r[1] >= 0)
+    return r[1] ? inst("c.mv", arg(0) + ", " + arg(1)) : inst("c.li", arg(0) + ", 0");
+  if (op == "li" && argc == 2 && r[0] > 0 && small)
+    return inst("c.li", arg(0) + ", " + std::to_string(imm));
+  if ((op == "lw" || op == "sw") && argc == 2 && r[0] >= 0 &&
+    rvc_mem(args[1], offset, base) && offset >= 0 && offset % 4 == 0)
+  {
+    std::string operands = arg(0) + ", " + std::to_string(offset) + "(" +
+      std::string(args[1].substr(args[1].find('(') + 1));
+    if (base == 2 && offset < 256 && (op == "sw" || r[0] > 0))
+      return inst(op == "lw" ? "c.lwsp" : "c.swsp", operands);
+    if (rvc_reg(base) && rvc_reg(r[0]) && offset < 128)
+      return inst(op == "lw" ? "c.lw" : "c.sw", operands);
+    return "";
+  }
+  if (argc == 3 && has_imm && r[0] > 0 && r[1] >= 0)
+  {
+    if (op == "addi" && r[1] == 0 && small)
+      return inst("c.li", arg(0) + ", " + std::to_string(imm));
+    if (op == "addi" && imm == 0 && r[1] > 0) return inst("c.mv", arg(0) + ", " + arg(1));
+    if (op == "addi" && r[0] == 2 && r[1] == 2 && imm && imm % 16 == 0 && imm >= -512 &&
+      imm < 512)
+      return inst("c.addi16sp", "sp, " + std::to_string(imm));
+    if (op == "addi" && r[1] == 2 && rvc_reg(r[0]) && imm > 0 && imm < 1024 && imm % 4 == 0)
+      return inst("c.addi4spn", arg(0) + ", sp, " + std::to_string(imm));
+    if (r[0] != r[1]) return "";
+    if (op == "addi" && imm && small) return inst("c.addi", arg(0) + ", " + std::to_string(imm));
+    if (op == "andi" && rvc_reg(r[0]) && small)
+      return inst("c.andi", arg(0) + ", " + std::to_string(imm));
+    if ((op == "slli" || ((op == "srli" || op == "srai") && rvc_reg(r[0]))) &&
+      imm > 0 && imm < 32)
+      return inst("c." + std::string(op), arg(0) + ", " + std::to_string(imm));
+    return "";
+  }
+  if (argc != 3 || r[0] <= 0 || r[1] < 0 || r[2] < 0) return "";
+  if (op == "add")
+  {
+    if (r[1] == 0 || r[2] == 0)
+      return r[1] + r[2] ? inst("c.mv", arg(0) + ", " + arg(r[1] ? 1 : 2)) : "";
+    if (r[1] == r[0]) return inst("c.add", arg(0) + ", " + arg(2));
+    if (r[2] == r[0]) return inst("c.add", arg(0) + ", " + arg(1));
+    return "";
+  }
+  if ((op == "sub" || op == "and" || op == "or" || op == "xor") && rvc_reg(r[0]))
+  {
+    if (r[1] == r[0] && rvc_reg(r[2])) return inst("c." + std::string(op), arg(0) + ", " + arg(2));
+    if (op != "sub" && r[2] == r[0] && rvc_reg(r[1]))
+      return inst("c." + std::string(op), arg(0) + ", " + arg(1));
+  }
+  return "";
+}
+
+// 把一段汇编中能压缩的指令改写成 c.* 形式, 标号, 伪指令和其余指令保持不变
+inline std::string rvc_compress(std::string_view text)
+{
+  std::string out;
+  out.reserve(text.size());
+  while (!text.empty())
+  {
+    size_t end = text.find('\n');
+    std::string_view line = text.substr(0, end);
+    text.remove_prefix(end == std::string_view::npos ? text.size() : end + 1);
+    std::string_view body = sched_trim(line);
+    std::string compressed;
+    if (!body.empty() && body[0] != '.' && body.back() != ':')
+    {
+      size_t op_end = body.find_first_of(" \t");
+      std::string_view op = body.substr(0, op_end), args[3];
+      std::string_view rest = op_end == std::string_view::npos ? "" : body.substr(op_end);
+      int argc = 0;
+      while (!sched_trim(rest).empty() && argc < 3)
+      {
+        size_t comma = rest.find(',');
+        args[argc++] = sched_trim(rest.substr(0, comma));
+        rest.remove_prefix(comma == std::string_view::npos ? rest.size() : comma + 1);
+      }
+      if (sched_trim(rest).empty()) compressed = rvc_inst(op, args, argc);
+    }
+    if (compressed.empty()) out += line;
+    else out += "\t" + compressed;
+    if (end != std::string_view::npos) out += '\n';
+  }
+  return out;
+}
@@ -0,0 +1,303 @@
+#pragma once
+#include <algorithm>
+#include <cstdlib>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "stats.hpp"
+
+// 面向顺序流水线的指令调度
+// 每个基本块的汇编先写进缓冲区, 再按标号, 跳转, 调用和无法识别的指令切成直线区域,
+// 在区域内做表调度: 按延迟加权的关键路径长度选指令, 把 lw 和 mul/div 的结果
+// 与使用它们的指令拉开, 用无关指令填满流水线停顿
+// 调度在寄存器分配之后进行, 保留寄存器上的读后写, 写后读, 写后写依赖和内存依赖,
+// 不引入新的寄存器, 寄存器压力与分配结果相同
+
+// 流水线模型, 由 -mtune 选择
+struct TuneModel
+{
+  const char *name;
+  int issue_width;     // 每周期发射的指令数
+  int load_latency;    // lw 到使用者的周期数
+  int mul_latency;
+  int div_latency;
+};
+
+inline const TuneModel tune_models[] = {
+  {"generic", 1, 3, 3, 20},
+  {"sifive-u74", 2, 3, 3, 34},   // 双发射, div/rem 为可变延迟, 取典型值
+  {"rocket", 1, 2, 4, 33},
+};
+inline const TuneModel *tune_model = &tune_models[0];   // nullptr 表示不调度
+
+// 长的直线区域按窗口切开调度, 使依赖图的构造保持线性
+constexpr int sched_window = 64;
+
+// 处理 -mtune=名字, none 关闭调度, 名字未知时返回 false
+inline bool set_tune(const std::string &name)
+{
+  if (name == "none")
+  {
+    tune_model = nullptr;
+    return true;
+  }
+  for (auto &model : tune_models)
+    if (name == model.name)
+    {
+      tune_model = &model;
+      return true;
+    }
+  return false;
+}
+
+// 寄存器名到编号, 不是寄存器时返回 -1
+inline int sched_reg(std::string_view name)
+{
+  if (name == "zero" || name == "x0") return 0;
+  if (name == "ra") return 1;
+  if (name == "sp") return 2;
+  if (name == "gp") return 3;
+  if (name == "tp") return 4;
+  if (name == "fp") return 8;
+  if (name.size() < 2 || name.size() > 3) return -1;
+  int num = 0;
+  for (size_t i = 1; i < name.size(); i++)
+  {
+    if (name[i] < '0' || name[i] > '9') return -1;
+    num = num * 10 + name[i] - '0';
+  }
+  switch (name[0])
+  {
+  case 'a': return num < 8 ? 10 + num : -1;
+  case 't': return num < 3 ? 5 + num : num < 7 ? 25 + num : -1;
+  case 's': return num < 2 ? 8 + num : num < 12 ? 16 + num : -1;
+  default: return -1;
+  }
+}
+
+struct SchedInst
+{
+  std::string_view text;
+  unsigned defs, uses;   // 寄存器位掩码, 不含 x0
+  int mem;               // 0 不访存, 1 load, 2 store
+  bool sp_based;         // 以 sp 加常数偏移寻址
+  long offset;
+  int latency;
+};
+
+inline std::string_view sched_trim(std::string_view s)
+{
+  while (!s.empty() && (s.front() == ' ' || s.front() == '\t')) s.remove_prefix(1);
+  while (!s.empty() && (s.back() == ' ' || s.back() == '\t')) s.remove_suffix(1);
+  return s;
+}
+
+// 解析一行汇编, 返回 false 表示它是区域的边界
+inline bool sched_parse(std::string_view line, SchedInst &inst)
+{
+  if (line.empty() || line[0] != '\t') return false;
+  size_t op_end = line.find_first_of(" \t", 1);
+  if (op_end == std::string_view::npos) return false;
+  std::string_view op = line.substr(1, op_end - 1);
+  if (op.empty() || op[0] == '.' || op[0] == 'b' || op[0] == 'j' || op == "call" ||
+    op == "ret" || op == "tail")
+    return false;
+  std::string_view args[4];
+  int argc = 0;
+  std::string_view rest = line.substr(op_end);
+  while (argc < 4)
+  {
+    size_t comma = rest.find(',');
+    args[argc++] = sched_trim(rest.substr(0, comma));
+    if (comma == std::string_view::npos) break;
+    rest.remove_prefix(comma + 1);
+  }
+  inst = {line, 0, 0, 0, false, 0, 1};
+  auto bit = [](int reg) { return reg > 0 ? 1u << reg : 0u; };
+  if (op == "lw" || op == "sw")
+  {
+    if (argc != 2) return false;
+    size_t paren = args[1].find('(');
+    if (paren == std::string_view::npos || args[1].back() != ')') return false;
+    int base = sched_reg(args[1].substr(paren + 1, args[1].size() - paren - 2));
+    int reg = sched_reg(args[0]);
+    if (base < 0 || reg < 0) return false;
+    inst.uses |= bit(base);
+    inst.sp_based = base == 2;
+    inst.offset = paren ? atol(std::string(args[1].substr(0, paren)).c_str()) : 0;
+    if (op == "lw")
+    {
+      inst.defs |= bit(reg);
+      inst.mem = 1;
+      inst.latency = tune_model->load_latency;
+    }
+    else
+    {
+      inst.uses |= bit(reg);
+      inst.mem = 2;
+    }
+    return true;
+  }
+  // 其余指令的第一个操作数是目的寄存器, 之后的寄存器操作数都是源
+  int dest = sched_reg(args[0]);
+  if (dest < 0) return false;
+  inst.defs |= bit(dest);
+  for (int i = 1; i < argc; i++) inst.uses |= bit(sched_reg(args[i]));
+  if (op == "mul" || op == "mulh" || op == "mulhu" || op == "mulhsu")
+    inst.latency = tune_model->mul_latency;
+  else if (op == "div" || op == "divu" || op == "rem" || op == "remu")
+    inst.latency = tune_model->div_latency;
+  return true;
+}
+
+// 按给定顺序在模型上发射需要的周期数, 只用于统计调度的效果
+inline long sched_cycles(const SchedInst *insts, const int *order, int n)
+{
+  long ready[32] = {0};
+  long cycle = 0;
+  int issued = 0;
+  for (int k = 0; k < n; k++)
+  {
+    auto &inst = insts[order[k]];
+    long start = cycle;
+    for (int reg = 1; reg < 32; reg++)
+      if (inst.uses >> reg & 1) start = std::max(start, ready[reg]);
+    if (start > cycle || issued == tune_model->issue_width)
+    {
+      cycle = std::max(start, cycle + 1);
+      issued = 0;
+    }
+    issued++;
+    for (int reg = 1; reg < 32; reg++)
+      if (inst.defs >> reg & 1) ready[reg] = cycle + inst.latency;
+  }
+  return cycle + 1;
+}
+
+// 对不超过一个窗口的直线区域做表调度, 按新顺序输出
+inline void sched_region(const SchedInst *insts, int n, std::string &out)
+{
+  int order[sched_window];
+  if (n <= 2)
+  {
+    for (int i = 0; i < n; i++)
+    {
+      out += insts[i].text;
+      out += '\n';
+    }
+    return;
+  }
+  // 依赖边: succ[i][j] 为 i 到 j 的延迟, -1 表示没有边
+  static int succ[sched_window][sched_window];
+  int preds[sched_window] = {0};
+  for (int i = 0; i < n; i++) std::fill(succ[i], succ[i] + n, -1);
+  auto edge = [&](int from, int to, int latency) {
+    if (succ[from][to] < 0) preds[to]++;
+    succ[from][to] = std::max(succ[from][to], latency);
+  };
+  int last_def[32];
+  unsigned read_since_def[32][sched_window / 32 + 1] = {};
+  std::fill(last_def, last_def + 32, -1);
+  for (int i = 0; i < n; i++)
+  {
+    auto &inst = insts[i];
+    for (int reg = 1; reg < 32; reg++)
+      if (inst.uses >> reg & 1 && last_def[reg] >= 0)
+        edge(last_def[reg], i, insts[last_def[reg]].latency);
+    for (int reg = 1; reg < 32; reg++)
+      if (inst.defs >> reg & 1)
+      {
+        for (int use = 0; use < i; use++)
+          if (read_since_def[reg][use / 32] >> use % 32 & 1) edge(use, i, 0);
+        if (last_def[reg] >= 0) edge(last_def[reg], i, 1);
+        std::fill(read_since_def[reg], read_since_def[reg] + sched_window / 32 + 1, 0);
+        last_def[reg] = i;
+      }
+    for (int reg = 1; reg < 32; reg++)
+      if (inst.uses >> reg & 1 && !(inst.defs >> reg & 1))
+        read_since_def[reg][i / 32] |= 1u << i % 32;
+    // 以 sp 加不同常数偏移寻址的访存互不相关, 其余 store 与所有访存保持顺序
+    if (inst.mem)
+      for (int j = 0; j < i; j++)
+        if (insts[j].mem && (inst.mem == 2 || insts[j].mem == 2) &&
+          !(inst.sp_based && insts[j].sp_based && inst.offset != insts[j].offset))
+          edge(j, i, insts[j].mem == 2 && inst.mem == 1 ? 1 : 0);
+  }
+
+  // 优先级: 到区域末尾的关键路径长度, 相同时保持原顺序
+  long height[sched_window], earliest[sched_window] = {0};
+  for (int i = n - 1; i >= 0; i--)
+  {
+    height[i] = insts[i].latency;
+    for (int j = i + 1; j < n; j++)
+      if (succ[i][j] >= 0) height[i] = std::max(height[i], succ[i][j] + height[j]);
+  }
+  bool done[sched_window] = {false};
+  long cycle = 0;
+  int issued = 0;
+  for (int count = 0; count < n;)
+  {
+    int pick = -1;
+    if (issued < tune_model->issue_width)
+      for (int i = 0; i < n; i++)
+        if (!done[i] && !preds[i] && earliest[i] <= cycle &&
+          (pick < 0 || height[i] > height[pick]))
+          pick = i;
+    if (pick < 0)
+    {
+      cycle++;
+      issued = 0;
+      continue;
+    }
+    done[pick] = true;
+    order[count++] = pick;
+    issued++;
+    for (int j = pick + 1; j < n; j++)
+      if (succ[pick][j] >= 0)
+      {
+        earliest[j] = std::max(earliest[j], cycle + succ[pick][j]);
+        preds[j]--;
+      }
+  }
+  if (print_stats || !stats_json.empty())
+  {
+    int original[sched_window];
+    for (int i = 0; i < n; i++) original[i] = i;
+    stat_sched_cycles += sched_cycles(insts, original, n) - sched_cycles(insts, order, n);
+  }
+  for (int i = 0; i < n; i++)
+  {
+    out += insts[order[i]].text;
+    out += '\n';
+  }
+}
+
+// 调度一个基本块的汇编文本
+inline std::string schedule_block(std::string_view text)
+{
+  std::string out;
+  out.reserve(text.size());
+  SchedInst region[sched_window];
+  int n = 0;
+  while (!text.empty())
+  {
+    size_t end = text.find('\n');
+    std::string_view line = text.substr(0, end);
+    text.remove_prefix(end == std::string_view::npos ? text.size() : end + 1);
+    if (sched_parse(line, region[n]))
+    {
+      if (++n == sched_window)
+      {
+        sched_region(region, n, out);
+        n = 0;
+      }
+      continue;
+    }
+    sched_region(region, n, out);
+    n = 0;
+    out += line;
+    out += '\n';
+  }
+  sched_region(region, n, out);
+  return out;
+}
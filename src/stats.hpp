@@ -0,0 +1,161 @@
+#pragma once
+#include <chrono>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <malloc.h>
+#include <sys/resource.h>
+
+// 编译过程的分阶段计时与计数
+// -ftime-report 输出各阶段耗时, 峰值内存与分配次数, -stats 输出计数器,
+// -stats-json 文件 把两者以 JSON 格式写入文件
+
+inline bool time_report = false;
+inline bool print_stats = false;
+inline std::string stats_json;
+// 要求输出统计时才由 alloc_count.cpp 中替换的 operator new 计数
+inline bool count_allocs = false;
+
+// 计数器, 由词法分析, AST 构造和后端各处累加
+inline long stat_allocs = 0;         // operator new 调用次数
+inline long stat_tokens = 0;         // 词法单元数
+inline long stat_ast_nodes = 0;      // AST 结点数
+inline long stat_expr_nodes = 0;     // 表达式结点数
+inline long stat_ir_insts = 0;       // 后端处理的 Koopa 指令数
+inline long stat_reg_spills = 0;     // find_reg 溢出的寄存器数
+inline long stat_clear_spills = 0;   // clear_registers 写回栈的次数
+inline long stat_s11_seqs = 0;       // 超出 12 位偏移的 li/add s11 序列数
+inline long stat_sched_cycles = 0;   // 指令调度在流水线模型上省下的周期数 (静态估计)
+inline long stat_dead_funcs = 0;     // 从 main 不可达而不生成代码的函数数
+inline long stat_dead_globals = 0;   // 只被不可达函数引用而不输出的全局变量数
+inline long stat_jump_tables = 0;    // 改写成跳转表的 if/else-if 链数
+inline long stat_switch_trees = 0;   // 改写成二分比较的 if/else-if 链数
+inline long stat_pinned_locals = 0;  // 叶函数中放进寄存器的局部变量数
+inline long stat_frames_elided = 0;  // 不建立栈帧的函数数
+inline long stat_expr_reordered = 0; // 为减少寄存器需求先求右操作数的二元运算数
+inline long stat_frame_bases = 0;    // 大栈帧中指向远处区域的基址寄存器数
+
+struct PhaseRecord
+{
+  std::string name;
+  double wall_ms;
+  long peak_rss_kb;
+  long heap_kb;      // 阶段内堆上占用的增量, 可以为负
+  long allocs;
+};
+inline std::vector<PhaseRecord> phase_records;
+
+inline long peak_rss_kb()
+{
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  return usage.ru_maxrss;
+}
+
+// 当前在堆上分配出去的字节数 (KB), 由 malloc 自己统计
+inline long heap_in_use_kb()
+{
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || __GLIBC_MINOR__ >= 33)
+  struct mallinfo2 info = mallinfo2();
+  return (long)((info.uordblks + info.hblkhd) / 1024);
+#else
+  return 0;
+#endif
+}
+
+// 在作用域内计时一个阶段
+class PhaseTimer
+{
+ public:
+  explicit PhaseTimer(const char *name)
+    : name(name), heap_kb(heap_in_use_kb()), allocs(stat_allocs),
+      start(std::chrono::steady_clock::now()) {}
+  ~PhaseTimer()
+  {
+    std::chrono::duration<double, std::milli> wall =
+      std::chrono::steady_clock::now() - start;
+    // 流式编译时同一阶段对每个函数各运行一次, 合并成一条记录
+    for (auto &phase : phase_records)
+      if (phase.name == name)
+      {
+        phase.wall_ms += wall.count();
+        phase.peak_rss_kb = peak_rss_kb();
+        phase.heap_kb += heap_in_use_kb() - heap_kb;
+        phase.allocs += stat_allocs - allocs;
+        return;
+      }
+    phase_records.push_back({name, wall.count(), peak_rss_kb(),
+      heap_in_use_kb() - heap_kb, stat_allocs - allocs});
+  }
+
+ private:
+  const char *name;
+  long heap_kb;
+  long allocs;
+  std::chrono::steady_clock::time_point start;
+};
+
+inline void report_stats()
+{
+  const std::pair<const char *, long> counters[] = {
+    {"allocations", stat_allocs},
+    {"tokens", stat_tokens},
+    {"ast_nodes", stat_ast_nodes},
+    {"expr_nodes", stat_expr_nodes},
+    {"ir_instructions", stat_ir_insts},
+    {"find_reg_spills", stat_reg_spills},
+    {"clear_registers_spills", stat_clear_spills},
+    {"s11_offset_sequences", stat_s11_seqs},
+    {"sched_cycles_saved", stat_sched_cycles},
+    {"dead_functions", stat_dead_funcs},
+    {"dead_globals", stat_dead_globals},
+    {"jump_tables", stat_jump_tables},
+    {"switch_trees", stat_switch_trees},
+    {"pinned_locals", stat_pinned_locals},
+    {"frames_elided", stat_frames_elided},
+    {"expr_reordered", stat_expr_reordered},
+    {"frame_base_registers", stat_frame_bases},
+  };
+  if (time_report)
+  {
+    double total = 0;
+    fprintf(stderr, "===== time report =====\n");
+    fprintf(stderr, "%-16s %12s %14s %12s %12s\n", "phase", "wall (ms)",
+      "peak RSS (KB)", "heap (KB)", "allocs");
+    for (auto &phase : phase_records)
+    {
+      fprintf(stderr, "%-16s %12.3f %14ld %12ld %12ld\n", phase.name.c_str(),
+        phase.wall_ms, phase.peak_rss_kb, phase.heap_kb, phase.allocs);
+      total += phase.wall_ms;
+    }
+    fprintf(stderr, "%-16s %12.3f %14ld %12s %12ld\n", "total", total, peak_rss_kb(),
+      "", stat_allocs);
+  }
+  if (print_stats)
+  {
+    fprintf(stderr, "===== statistics =====\n");
+    for (auto &counter : counters)
+      fprintf(stderr, "%-24s %12ld\n", counter.first, counter.second);
+  }
+  if (!stats_json.empty())
+  {
+    FILE *out = fopen(stats_json.c_str(), "w");
+    if (!out) return;
+    fprintf(out, "{\n  \"phases\": [");
+    for (size_t i = 0; i < phase_records.size(); i++)
+      fprintf(out, "%s\n    {\"name\": \"%s\", \"wall_ms\": %.3f, "
+        "\"peak_rss_kb\": %ld, \"heap_kb\": %ld, \"allocs\": %ld}", i ? "," : "",
+        phase_records[i].name.c_str(), phase_records[i].wall_ms,
+        phase_records[i].peak_rss_kb, phase_records[i].heap_kb, phase_records[i].allocs);
+    fprintf(out, "\n  ],\n  \"counters\": {");
+    bool first = true;
+    for (auto &counter : counters)
+    {
+      fprintf(out, "%s\n    \"%s\": %ld", first ? "" : ",", counter.first,
+        counter.second);
+      first = false;
+    }
+    fprintf(out, "\n  }\n}\n");
+    fclose(out);
+  }
+}
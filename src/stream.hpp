@@ -0,0 +1,135 @@
+#pragma once
+#include <iostream>
+#include <memory>
+#include <set>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include "AST.hpp"
+#include "riscv.hpp"
+#include "cache.hpp"
+#include "fastlex.hpp"
+
+// 流式编译 (-stream): parser 每归约出一个顶层定义就立即处理它.
+// 全局声明生成 Koopa 后暂存, 函数定义生成 Koopa, 与它引用到的全局变量和函数的声明
+// 拼成一个只含这个函数的小程序, 交给后端生成汇编并写出, 随后释放 AST, IR 和表达式池.
+// 驻留内存只与最大的函数有关, 与输入的总长度无关.
+// 需要看到整个程序的优化 (过程间的签名改写与特化, 删除不可达函数, 编译期执行函数调用,
+// 只读全局变量的折叠) 在这个模式下不做
+
+inline bool stream_compile = false;
+inline bool stream_riscv = false;
+inline std::streambuf *stream_out = nullptr;     // 输出的目的地
+inline std::string stream_header;                // 运行时库函数的声明
+inline std::string stream_pending;               // 还没有交给后端的全局变量定义
+// 已经生成过的函数和全局变量的名字 -> 在后续小程序中使用的声明.
+// 全局变量的数据已经输出, 声明里的初值一律换成 zeroinit
+inline std::unordered_map<std::string, std::string> stream_symbols;
+
+// " global @x = alloc 类型, 初值" 改成以 zeroinit 为初值
+inline std::string stream_global_decl(std::string_view line)
+{
+  size_t pos = line.find("alloc ") + 6;
+  int depth = 0;
+  for (; pos < line.size(); pos++)
+  {
+    if (line[pos] == '[') depth++;
+    else if (line[pos] == ']') depth--;
+    else if (line[pos] == ',' && depth == 0) break;
+  }
+  return std::string(line.substr(0, pos)) + ", zeroinit\n";
+}
+
+// 暂存的全局变量已经输出, 之后只以声明的形式出现
+inline void stream_retire_globals()
+{
+  std::string_view text = stream_pending;
+  while (!text.empty())
+  {
+    size_t end = text.find('\n');
+    std::string_view line = text.substr(0, end);
+    text.remove_prefix(end == std::string_view::npos ? text.size() : end + 1);
+    size_t at = line.find(" global @");
+    if (at == std::string_view::npos) continue;
+    size_t name_end = line.find(' ', at + 9);
+    stream_symbols[std::string(line.substr(at + 9, name_end - at - 9))] =
+      stream_global_decl(line);
+  }
+  stream_pending.clear();
+}
+
+inline void stream_codegen(const std::string &func_ir)
+{
+  std::string program = stream_header;
+  // 加上函数体中出现的 @名字 中已经生成过的那些的声明
+  std::set<std::string_view> seen;
+  for (size_t pos = func_ir.find('@'); pos != std::string::npos; pos = func_ir.find('@', pos))
+  {
+    size_t end = ++pos;
+    while (end < func_ir.size() && lex_is_ident(func_ir[end])) end++;
+    std::string_view name(func_ir.data() + pos, end - pos);
+    pos = end;
+    if (!seen.insert(name).second) continue;
+    auto it = stream_symbols.find(std::string(name));
+    if (it != stream_symbols.end()) program += it->second;
+  }
+  program += stream_pending;
+  program += func_ir;
+  parse_string(program.c_str());
+  stream_retire_globals();
+}
+
+inline void stream_handle(std::unique_ptr<BaseAST> item)
+{
+  // parser 运行期间 cout 不输出任何东西, 只在这里临时接到输出上
+  std::ostringstream ir;
+  std::streambuf *parse_buf = std::cout.rdbuf(stream_riscv ? ir.rdbuf() : stream_out);
+  if (auto def = dynamic_cast<const FuncDefAST *>(item.get()))
+  {
+    dump_func_def(def);
+    if (stream_riscv)
+    {
+      std::cout.rdbuf(stream_out);
+      stream_codegen(ir.str());
+      stream_symbols[def->Name()] = def->DeclLine() + "\n";
+      external_funcs.insert(def->Name());
+      cached_asm.erase(def->ident);
+    }
+  }
+  else
+  {
+    item->Dump();
+    if (stream_riscv) stream_pending += ir.str();
+  }
+  std::cout.rdbuf(parse_buf);
+  // 已处理的定义不会再被引用
+  item.reset();
+  expr_pool.clear();
+  expr_args.clear();
+  fast_lex_release();
+}
+
+inline void stream_begin(bool riscv, std::streambuf *out)
+{
+  stream_riscv = riscv;
+  stream_out = out;
+  whole_program = false;
+  stream_item = stream_handle;
+  std::ostringstream header;
+  std::streambuf *old_buf = std::cout.rdbuf(riscv ? header.rdbuf() : out);
+  begin_comp_unit();
+  std::cout.rdbuf(old_buf);
+  stream_header = header.str();
+}
+
+inline void stream_finish()
+{
+  std::streambuf *old_buf = std::cout.rdbuf(stream_out);
+  // 最后一个函数之后的全局变量
+  if (stream_riscv && !stream_pending.empty()) stream_codegen("");
+  if (stream_riscv && profile_generate) emit_profile_dump();
+  end_comp_unit();
+  std::cout.rdbuf(old_buf);
+  stream_item = nullptr;
+}
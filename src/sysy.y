@@ -2,6 +2,7 @@
   #include <memory>
   #include <string>
   #include "AST.hpp"
+  #include "fastlex.hpp"
 }
 
 %{
@@ -31,23 +32,28 @@ using namespace std;
 // 请自行 STFW 在 union 里写一个带析构函数的类会出现什么情况
 %union {
   std::string *str_val;
+  TokenView ident_val;
   int int_val;
   BaseAST *ast_val;
   std::vector<std::unique_ptr<BaseAST> > *vec_val;
+  std::vector<int> *idx_val;
 }
 
 // lexer 返回的所有 token 种类的声明
-// 注意 IDENT 和 INT_CONST 会返回 token 的值, 分别对应 str_val 和 int_val
+// 注意 IDENT 和 INT_CONST 会返回 token 的值, 分别对应 ident_val 和 int_val
+// ident_val 是指向源文件映射区的切片, 建 AST 时才复制成 string
 %token INT VOID RETURN LOR LAND EQ NEQ GEQ LEQ LQ GQ CONST IF ELSE WHILE BREAK CONTINUE
-%token <str_val> IDENT
+%token <ident_val> IDENT
 %token <int_val> INT_CONST
 
 // 非终结符的类型定义
-%type <ast_val> FuncDef Block Stmt Number PrimaryExp Exp UnaryExp MulExp AddExp LOrExp RelExp EqExp LAndExp
+%type <ast_val> FuncDef Block Stmt Exp
+%type <int_val> Number PrimaryExp UnaryExp MulExp AddExp LOrExp RelExp EqExp LAndExp
 %type <ast_val> BlockItem Decl LVal ConstDecl ConstDef ConstInitVal ConstExp VarDecl VarDef InitVal ComplexStmt
 %type <ast_val> OpenStmt ClosedStmt  FuncFParam CompUnitList
 %type <int_val> UnaryOp
-%type <vec_val> BlockItemList ConstDefList VarDefList FuncFParams FuncRParms  
+%type <vec_val> BlockItemList ConstDefList VarDefList FuncFParams ConstInitValList InitValList
+%type <idx_val> FuncRParms Indices
 %type <str_val> Type 
 %%
 
@@ -67,22 +73,26 @@ CompUnitList
   : FuncDef{
       auto ast=new CompUnitAST();
       auto func_def=unique_ptr<BaseAST>($1);
-      ast->func_def_list.push_back(move(func_def));
+      if(stream_item) stream_item(move(func_def));
+      else ast->func_def_list.push_back(move(func_def));
       $$=ast;
   }|Decl{
       auto ast=new CompUnitAST();
       auto decl=unique_ptr<BaseAST>($1);
-      ast->decl_list.push_back(move(decl));
+      if(stream_item) stream_item(move(decl));
+      else ast->decl_list.push_back(move(decl));
       $$=ast;
   }|CompUnitList FuncDef{
       auto ast=(CompUnitAST*)($1);
       auto func_def=unique_ptr<BaseAST>($2);
-      ast->func_def_list.push_back(move(func_def));
+      if(stream_item) stream_item(move(func_def));
+      else ast->func_def_list.push_back(move(func_def));
       $$=ast;
   }|CompUnitList Decl{
       auto ast=(CompUnitAST*)($1);
       auto decl=unique_ptr<BaseAST>($2);
-      ast->decl_list.push_back(move(decl));
+      if(stream_item) stream_item(move(decl));
+      else ast->decl_list.push_back(move(decl));
       $$=ast;
   }
   ;
@@ -101,7 +111,7 @@ FuncDef
   : Type IDENT '(' ')' Block {
     auto ast=new FuncDefAST();
     ast->func_type = *unique_ptr<string>($1);
-    ast->ident = *unique_ptr<string>($2);
+    ast->ident = $2.str();
     ast->block = unique_ptr<BaseAST>($5);
     cout<<"FuncDef"<<endl;
     ((BlockAST*)(ast->block).get())->func = ast->ident;
@@ -110,7 +120,7 @@ FuncDef
   }|Type IDENT '(' FuncFParams ')' Block{
     auto ast=new FuncDefAST();
     ast->func_type = *unique_ptr<string>($1);
-    ast->ident = *unique_ptr<string>($2);
+    ast->ident = $2.str();
     vector<unique_ptr<BaseAST>> *v_ptr = ($4);
     for (auto it = v_ptr->begin(); it != v_ptr->end(); it++)
       ast->params.push_back(move(*it));
@@ -139,19 +149,42 @@ FuncFParam
       auto ast = new FuncFParamAST();
       ast->type = FuncFParamType::var;
       ast->b_type = *unique_ptr<string>($1);
-      ast->ident = *unique_ptr<string>($2);
+      ast->ident = $2.str();
+      $$ = ast;
+  }|Type IDENT '[' ']'{
+      auto ast = new FuncFParamAST();
+      ast->type = FuncFParamType::list;
+      ast->b_type = *unique_ptr<string>($1);
+      ast->ident = $2.str();
+      $$ = ast;
+  }|Type IDENT '[' ']' Indices{
+      auto ast = new FuncFParamAST();
+      ast->type = FuncFParamType::list;
+      ast->b_type = *unique_ptr<string>($1);
+      ast->ident = $2.str();
+      ast->dims = *unique_ptr<vector<int>>($5);
       $$ = ast;
   }
   ;
 
+// 数组的各维长度或下标, 每一项是表达式结点的下标
+Indices
+  : '[' LOrExp ']'{
+      $$ = new vector<int>{$2};
+  }|Indices '[' LOrExp ']'{
+      $1->push_back($3);
+      $$ = $1;
+  }
+  ;
+
 FuncRParms
-  : Exp{
-      vector<unique_ptr<BaseAST>> *v = new vector<unique_ptr<BaseAST>>;
-      v->push_back(unique_ptr<BaseAST>($1));
+  : LOrExp{
+      vector<int> *v = new vector<int>;
+      v->push_back($1);
       $$ = v;
-  }|FuncRParms ',' Exp{
-      vector<unique_ptr<BaseAST>> *v = ($1);
-      v->push_back(unique_ptr<BaseAST>($3));
+  }|FuncRParms ',' LOrExp{
+      vector<int> *v = ($1);
+      v->push_back($3);
       $$ = v;
   }
   ;
@@ -239,7 +272,9 @@ Stmt
     ast->exp = unique_ptr<BaseAST>($2);
     $$ = ast;
   }|RETURN ';'{
-
+    auto ast=new StmtAST();
+    ast->type = SimpleStmtType::ret;
+    $$ = ast;
   }|LVal '=' Exp ';'{
     auto ast = new StmtAST();
     ast->type = SimpleStmtType::lval;
@@ -271,195 +306,103 @@ Stmt
   }
   ;
 
+// 表达式各层直接返回 expr_pool 中结点的下标, 只有一个孩子的层原样传递孩子的下标
 Exp
   : LOrExp {
-    auto ast= new ExpAST();
-    ast->lor_exp=unique_ptr<BaseAST>($1);
+    auto ast= new ExpAST($1);
     $$=ast;
   }
   ;
 
 LOrExp
   : LAndExp{
-      auto ast=new LOrExpAST();
-      ast->land_exp=unique_ptr<BaseAST>($1);
-      ast->op=-1;
-      $$=ast;
+      $$=$1;
   }|LOrExp LOR LAndExp{
-      auto ast=new LOrExpAST();
-      ast->lor_exp=unique_ptr<BaseAST>($1);
-      ast->land_exp=unique_ptr<BaseAST>($3);
-      ast->op=Or;
-      $$=ast;
+      $$=expr_node(ExprKind::binary, Or, $1, $3);
   }
   ;
 
   LAndExp
   : EqExp{
-      auto ast=new LAndExpAST();
-      ast->eq_exp=unique_ptr<BaseAST>($1);
-      ast->op=-1;
-      $$=ast;
+      $$=$1;
   }|LAndExp LAND EqExp{
-      auto ast=new LAndExpAST();
-      ast->land_exp=unique_ptr<BaseAST>($1);
-      ast->eq_exp=unique_ptr<BaseAST>($3);
-      ast->op=And;
-      $$=ast;
+      $$=expr_node(ExprKind::binary, And, $1, $3);
   }
   ;
 
   EqExp
   : RelExp{
-      auto ast=new EqExpAST();
-      ast->rel_exp=unique_ptr<BaseAST>($1);
-      ast->op=-1;
-      $$=ast;
+      $$=$1;
   }|EqExp EQ RelExp{
-      auto ast=new EqExpAST();
-      ast->eq_exp=unique_ptr<BaseAST>($1);
-      ast->rel_exp=unique_ptr<BaseAST>($3);
-      ast->op=Equal;
-      $$=ast;
+      $$=expr_node(ExprKind::binary, Equal, $1, $3);
   }|EqExp NEQ RelExp{
-      auto ast=new EqExpAST();
-      ast->eq_exp=unique_ptr<BaseAST>($1);
-      ast->rel_exp=unique_ptr<BaseAST>($3);
-      ast->op=NotEqual;
-      $$=ast;
+      $$=expr_node(ExprKind::binary, NotEqual, $1, $3);
   }
   ;
 
   RelExp
   : AddExp{
-      auto ast=new RelExpAST();
-      ast->add_exp=unique_ptr<BaseAST>($1);
-      ast->op=-1;
-      $$=ast;
+      $$=$1;
   }|RelExp LQ AddExp{
-      auto ast=new RelExpAST();
-      ast->rel_exp=unique_ptr<BaseAST>($1);
-      ast->add_exp=unique_ptr<BaseAST>($3);
-      ast->op=Less;
-      $$=ast;
+      $$=expr_node(ExprKind::binary, Less, $1, $3);
   }|RelExp GQ AddExp{
-      auto ast=new RelExpAST();
-      ast->rel_exp=unique_ptr<BaseAST>($1);
-      ast->add_exp=unique_ptr<BaseAST>($3);
-      ast->op=Greater;
-      $$=ast;
+      $$=expr_node(ExprKind::binary, Greater, $1, $3);
   }|RelExp LEQ AddExp{
-      auto ast=new RelExpAST();
-      ast->rel_exp=unique_ptr<BaseAST>($1);
-      ast->add_exp=unique_ptr<BaseAST>($3);
-      ast->op=LessEq;
-      $$=ast;
+      $$=expr_node(ExprKind::binary, LessEq, $1, $3);
   }|RelExp GEQ AddExp{
-      auto ast=new RelExpAST();
-      ast->rel_exp=unique_ptr<BaseAST>($1);
-      ast->add_exp=unique_ptr<BaseAST>($3);
-      ast->op=GreaterEq;
-      $$=ast;
+      $$=expr_node(ExprKind::binary, GreaterEq, $1, $3);
   }
   ;
 
   AddExp
   : MulExp{
-      auto ast=new AddExpAST();
-      ast->mu_exp=unique_ptr<BaseAST>($1);
-      ast->op=-1;
-      $$=ast;
+      $$=$1;
   }|AddExp '+' MulExp{
-      auto ast=new AddExpAST();
-      ast->mu_exp=unique_ptr<BaseAST>($3);
-      ast->add_exp=unique_ptr<BaseAST>($1);
-      ast->op=Add;
-      $$=ast;
+      $$=expr_node(ExprKind::binary, Add, $1, $3);
   }|AddExp '-' MulExp{
-      auto ast=new AddExpAST();
-      ast->mu_exp=unique_ptr<BaseAST>($3);
-      ast->add_exp=unique_ptr<BaseAST>($1);
-      ast->op=Sub;
-      $$=ast;
+      $$=expr_node(ExprKind::binary, Sub, $1, $3);
   }
   ;
 
   MulExp
   : UnaryExp {
-      auto ast=new MulExpAST();
-      ast->u_exp=unique_ptr<BaseAST>($1);
-      ast->op=-1;
-      $$=ast;
+      $$=$1;
   }|MulExp '*' UnaryExp{
-      auto ast=new MulExpAST();
-      ast->mu_exp=unique_ptr<BaseAST>($1);
-      ast->u_exp=unique_ptr<BaseAST>($3);
-      ast->op=Mul;
-      $$=ast;
+      $$=expr_node(ExprKind::binary, Mul, $1, $3);
   }|MulExp '/' UnaryExp{
-      auto ast=new MulExpAST();
-      ast->mu_exp=unique_ptr<BaseAST>($1);
-      ast->u_exp=unique_ptr<BaseAST>($3);
-      ast->op=Div;
-      $$=ast;
+      $$=expr_node(ExprKind::binary, Div, $1, $3);
   }|MulExp '%' UnaryExp{
-      auto ast=new MulExpAST();
-      ast->mu_exp=unique_ptr<BaseAST>($1);
-      ast->u_exp=unique_ptr<BaseAST>($3);
-      ast->op=Mod;
-      $$=ast;
+      $$=expr_node(ExprKind::binary, Mod, $1, $3);
   }
   ;
 
   UnaryExp
   : PrimaryExp{
-      auto ast=new UnaryExpAST();
-      ast->type=UnaryExpType::primary;
-      ast->pu_exp=unique_ptr<BaseAST>($1);
-      ast->op=-1;
-      $$=ast;
+      $$=$1;
   }|UnaryOp UnaryExp{
-      auto ast=new UnaryExpAST();
-      ast->type=UnaryExpType::unary;
-      ast->pu_exp=unique_ptr<BaseAST>($2);
-      ast->op=$1;
-      $$=ast;
+      // 一元加号不产生结点
+      if($1==NoOperation) $$=$2;
+      else $$=expr_node(ExprKind::unary, $1, $2);
   }|IDENT '(' FuncRParms ')' {
-      auto ast=new UnaryExpAST();
-      ast->type=UnaryExpType::func_call;
-      vector<unique_ptr<BaseAST>> *v_ptr = ($3);
-      ast->ident=*unique_ptr<string>($1);
-      for (auto it = v_ptr->begin(); it != v_ptr->end(); it++)
-        ast->params.push_back(move(*it));
-      $$=ast;
+      auto args=unique_ptr<vector<int>>($3);
+      $$=expr_call($1.view(), *args);
   }|IDENT '(' ')'{
-      auto ast=new UnaryExpAST();
-      ast->type=UnaryExpType::func_call;
-      ast->ident=*unique_ptr<string>($1);
-      $$=ast;
+      $$=expr_call($1.view(), {});
   }
   ;
 
 PrimaryExp
-  :'(' Exp ')'{
-    auto ast=new PrimaryExpAST();
-    ast->type = PrimaryExpType::exp;
-    ast->p_exp=unique_ptr<BaseAST>($2);
-    $$=ast;
+  :'(' LOrExp ')'{
+    $$=$2;
   }|Number {
-      auto ast=new PrimaryExpAST();
-      ast->type = PrimaryExpType::number;
-      ast->p_exp=unique_ptr<BaseAST>($1);
-      $$=ast;
-  }|LVal{
-      auto ast = new PrimaryExpAST();
-      ast->type = PrimaryExpType::lval;
-      ast->p_exp = unique_ptr<BaseAST>($1);
-      $$ = ast;
+      $$=$1;
+  }|IDENT{
+      $$=expr_node(ExprKind::lval, 0, expr_ident_id($1.view()));
+  }|IDENT Indices{
+      $$=expr_lval($1.view(), *unique_ptr<vector<int>>($2));
   }
   ;  
 
-
 UnaryOp
   : '+'{
     $$ = NoOperation;
@@ -500,17 +443,44 @@ ConstDecl
 ConstDef
   : IDENT '=' ConstInitVal{
     auto ast=new ConstDefAST();
-    ast->ident=*unique_ptr<string>($1);
+    ast->ident=$1.str();
     ast->c_initval=unique_ptr<BaseAST>($3);
     $$=ast;
+  }|IDENT Indices '=' ConstInitVal{
+    auto ast=new ConstDefAST();
+    ast->ident=$1.str();
+    ast->dims=*unique_ptr<vector<int>>($2);
+    ast->c_initval=unique_ptr<BaseAST>($4);
+    $$=ast;
   }
   ;
 
 ConstInitVal
   : ConstExp{
     auto ast=new ConstInitValAST();
+    ast->type=ConstInitValType::const_exp;
     ast->c_exp=unique_ptr<BaseAST>($1);
     $$=ast;
+  }|'{' '}'{
+    auto ast=new ConstInitValAST();
+    ast->type=ConstInitValType::list;
+    $$=ast;
+  }|'{' ConstInitValList '}'{
+    auto ast=new ConstInitValAST();
+    ast->type=ConstInitValType::list;
+    ast->list=move(*unique_ptr<vector<unique_ptr<BaseAST>>>($2));
+    $$=ast;
+  }
+  ;
+
+ConstInitValList
+  : ConstInitVal{
+    auto v = new vector<unique_ptr<BaseAST>>;
+    v->push_back(unique_ptr<BaseAST>($1));
+    $$ = v;
+  }|ConstInitValList ',' ConstInitVal{
+    $1->push_back(unique_ptr<BaseAST>($3));
+    $$ = $1;
   }
   ;
 
@@ -550,23 +520,57 @@ VarDecl
 VarDef
   : IDENT{
     auto ast = new VarDefAST();
-    ast->ident = *unique_ptr<string>($1);
+    ast->ident = $1.str();
     ast->ifhavev = false;
     $$ = ast;
   }|IDENT '=' InitVal{
     auto ast = new VarDefAST();
-    ast->ident = *unique_ptr<string>($1);
+    ast->ident = $1.str();
     ast->ifhavev = true;
     ast->initval = unique_ptr<BaseAST>($3);
     $$ = ast;
+  }|IDENT Indices{
+    auto ast = new VarDefAST();
+    ast->ident = $1.str();
+    ast->dims = *unique_ptr<vector<int>>($2);
+    ast->ifhavev = false;
+    $$ = ast;
+  }|IDENT Indices '=' InitVal{
+    auto ast = new VarDefAST();
+    ast->ident = $1.str();
+    ast->dims = *unique_ptr<vector<int>>($2);
+    ast->ifhavev = true;
+    ast->initval = unique_ptr<BaseAST>($4);
+    $$ = ast;
   }
   ;
 
 InitVal
   : Exp{
     auto ast = new InitValAST();
+    ast->type = InitValType::exp;
     ast->exp=unique_ptr<BaseAST>($1);
     $$=ast;
+  }|'{' '}'{
+    auto ast = new InitValAST();
+    ast->type = InitValType::list;
+    $$=ast;
+  }|'{' InitValList '}'{
+    auto ast = new InitValAST();
+    ast->type = InitValType::list;
+    ast->list=move(*unique_ptr<vector<unique_ptr<BaseAST>>>($2));
+    $$=ast;
+  }
+  ;
+
+InitValList
+  : InitVal{
+    auto v = new vector<unique_ptr<BaseAST>>;
+    v->push_back(unique_ptr<BaseAST>($1));
+    $$ = v;
+  }|InitValList ',' InitVal{
+    $1->push_back(unique_ptr<BaseAST>($3));
+    $$ = $1;
   }
   ;
 
@@ -607,16 +611,19 @@ VarDefList
 
 Number
   : INT_CONST {
-    auto ast=new NumberAST();
-    ast->num=$1;
-    $$ = ast;
+    $$=expr_node(ExprKind::number, 0, $1);
   }
   ;
 
 LVal
   : IDENT{
     auto ast = new LValAST();
-    ast->ident=*unique_ptr<string>($1);
+    ast->ident=$1.str();
+    $$=ast;
+  }|IDENT Indices{
+    auto ast = new LValAST();
+    ast->ident=$1.str();
+    ast->indices=*unique_ptr<vector<int>>($2);
     $$=ast;
   }
   ;
@@ -0,0 +1,17 @@
+#!/bin/sh
+# -cache: 编译期求值的调用读到的常量改变后, 调用者不能命中旧的缓存
+# 用法: cache_const.sh 编译器
+set -e
+compiler=$1
+dir=$(mktemp -d)
+trap 'rm -rf "$dir"' EXIT
+cd "$dir"
+write() {
+  printf 'const int K = %s;\nint g(int x) { return x + K; }\nint main() { putint(g(0)); return 0; }\n' "$1" > k.c
+}
+write 5
+"$compiler" -riscv k.c -o old.S -cache cache
+write 6
+"$compiler" -riscv k.c -o cached.S -cache cache
+"$compiler" -riscv k.c -o fresh.S
+cmp cached.S fresh.S
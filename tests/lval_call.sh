@@ -0,0 +1,17 @@
+#!/bin/sh
+# 被赋值的数组元素的下标中调用了被改写签名的函数
+# 用法: lval_call.sh 编译器
+set -e
+compiler=$1
+dir=$(mktemp -d)
+trap 'rm -rf "$dir"' EXIT
+cd "$dir"
+cat > l.c <<'SYSY'
+int ga0[16];
+int f3(int p0, int p1) { int la[700]; return p0 + 1; }
+int main() { ga0[f3(3, -19)] = f3(ga0[2], 15); putint(ga0[4]); return 0; }
+SYSY
+"$compiler" -koopa l.c -o l.koopa
+"$compiler" -riscv l.c -o l.S
+"$compiler" -interp l.c -o l.out
+test "$(cat l.out)" = 1
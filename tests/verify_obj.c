@@ -0,0 +1,41 @@
+// -verify-obj 的样例: 全局变量和数组, 常量数组, 局部数组, 多参数调用和循环
+const int N = 8;
+const int w[4] = {3, 1, 4, 1};
+int g = 7;
+int table[N][2];
+int zeros[100];
+
+int sum(int a[], int n)
+{
+  int i = 0, s = 0;
+  while (i < n)
+  {
+    s = s + a[i];
+    i = i + 1;
+  }
+  return s;
+}
+
+int mix(int a, int b, int c, int d, int e, int f, int h, int i, int j, int k)
+{
+  return a - b + c * d - e / f + h % i + j * k;
+}
+
+int main()
+{
+  int local[16] = {1, 2, 3};
+  int i = 0;
+  while (i < N)
+  {
+    table[i][0] = i * g;
+    table[i][1] = w[i % 4];
+    local[i + 8] = table[i][0] + table[i][1];
+    i = i + 1;
+  }
+  zeros[99] = sum(local, 16);
+  g = mix(g, 1, 2, 3, 4, 5, 6, 7, 8, zeros[99]);
+  if (g > 100 && zeros[0] == 0) putint(g);
+  else putint(-g);
+  putch(10);
+  return 0;
+}